@@ -2,18 +2,32 @@
 #include <fstream>
 #include "metav3/serialization/optimistic_binary.hpp"
 #include "metav3/serialization/json.hpp"
+#include "metav3/serialization/patch.hpp"
+#include "metav3/parallel_traversal.hpp"
 #include "debug/profile.hpp"
 #include "metav3/metav3_stl.hpp"
+#include "metav3/metav3_stl_map.hpp"
 #include "metafast/metafast.hpp"
 #include <benchmark/benchmark.h>
 #include <sstream>
+#include <chrono>
 #include <boost/serialization/serialization.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include "os/mmapped_file.hpp"
 #include <cstring> // for memcpy
+#include <sys/stat.h> // for mkdir
 #include "util/compressed_buffer.hpp"
+#include "util/compressed_stream.hpp"
+#include "util/block_compressed_buffer.hpp"
+#include "metafast/metafast_dictionary.hpp"
+#include "metafast/metafast_batch.hpp"
+#include "os/journal.hpp"
+#include "metafast/metafast_store.hpp"
+#include "metafast/metafast_stl.hpp"
+#include <dirent.h> // for cleaning up the journal directory
+#include <unistd.h>
 
 using namespace metav3;
 struct memcpy_speed_comparison
@@ -163,6 +177,23 @@ void MemcpyDirectReading(benchmark::State & state)
 }
 BENCHMARK(MemcpyDirectReading);
 
+// the same as MemcpyDirectReading, but with O_DIRECT instead of reading through
+// the page cache and then evicting
+void MemcpyODirectReading(benchmark::State & state)
+{
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    std::string memcpy_filename = "/tmp/memcpy_test";
+    test_write_memcpy(memcpy_filename, elements);
+    UnixFile(memcpy_filename, UnixFile::RDONLY).evict_from_os_cache();
+    while (state.KeepRunning())
+    {
+        DirectFileRead file(memcpy_filename);
+        std::vector<memcpy_speed_comparison> comparison = memcpy_from_bytes(file.get_bytes());
+        RAW_ASSERT(comparison == elements);
+    }
+}
+BENCHMARK(MemcpyODirectReading);
+
 void MemcpyCompressedReading(benchmark::State & state)
 {
     std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
@@ -186,6 +217,588 @@ void MemcpyCompressedReading(benchmark::State & state)
 }
 BENCHMARK(MemcpyCompressedReading);
 
+std::string serialize_comparison_data()
+{
+    std::stringstream buffer;
+    metaf::BinaryOutput output(buffer);
+    metaf::write_binary(output, generate_comparison_data());
+    return buffer.str();
+}
+
+// range_x is the Lz4Codec::Mode, range_y is the acceleration or compression level
+void CompressionCodecs(benchmark::State & state)
+{
+    std::string uncompressed = serialize_comparison_data();
+    Lz4Codec codec = { Lz4Codec::Mode(state.range_x()), state.range_y() };
+    size_t compressed_size = 1;
+    while (state.KeepRunning())
+    {
+        CompressedBuffer compressed(uncompressed, codec);
+        compressed_size = compressed.get_bytes().size();
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(uncompressed.size()));
+    state.SetLabel("ratio " + std::to_string(double(uncompressed.size()) / compressed_size));
+}
+BENCHMARK(CompressionCodecs)
+    ->ArgPair(Lz4Codec::FastMode, 1)->ArgPair(Lz4Codec::FastMode, 4)->ArgPair(Lz4Codec::FastMode, 16)->ArgPair(Lz4Codec::FastMode, 64)
+    ->ArgPair(Lz4Codec::HighCompressionMode, 1)->ArgPair(Lz4Codec::HighCompressionMode, 4)->ArgPair(Lz4Codec::HighCompressionMode, 9)->ArgPair(Lz4Codec::HighCompressionMode, 16);
+
+void DecompressionCodecs(benchmark::State & state)
+{
+    std::string uncompressed = serialize_comparison_data();
+    CompressedBuffer compressed(uncompressed, Lz4Codec{ Lz4Codec::Mode(state.range_x()), state.range_y() });
+    UncompressedBuffer reused;
+    while (state.KeepRunning())
+    {
+        reused.decompress(compressed.get_bytes());
+    }
+    RAW_ASSERT(uncompressed == reused.get_text());
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(uncompressed.size()));
+    state.SetLabel("ratio " + std::to_string(double(uncompressed.size()) / compressed.get_bytes().size()));
+}
+BENCHMARK(DecompressionCodecs)
+    ->ArgPair(Lz4Codec::FastMode, 1)->ArgPair(Lz4Codec::FastMode, 4)->ArgPair(Lz4Codec::FastMode, 16)->ArgPair(Lz4Codec::FastMode, 64)
+    ->ArgPair(Lz4Codec::HighCompressionMode, 1)->ArgPair(Lz4Codec::HighCompressionMode, 4)->ArgPair(Lz4Codec::HighCompressionMode, 9)->ArgPair(Lz4Codec::HighCompressionMode, 16);
+
+std::string large_comparison_data()
+{
+    std::string single = serialize_comparison_data();
+    std::string result;
+    for (int i = 0; i < 16; ++i)
+        result += single;
+    return result;
+}
+
+// range_x is the number of threads. compare the label against
+// CompressionCodecs/1/9 to see how much ratio the block split costs
+void BlockCompression(benchmark::State & state)
+{
+    std::string uncompressed = large_comparison_data();
+    size_t compressed_size = 1;
+    while (state.KeepRunning())
+    {
+        BlockCompressedBuffer compressed(uncompressed, Lz4Codec::HighCompression(9), BlockCompressedBuffer::default_block_size, state.range_x());
+        compressed_size = compressed.get_bytes().size();
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(uncompressed.size()));
+    state.SetLabel("ratio " + std::to_string(double(uncompressed.size()) / compressed_size));
+}
+BENCHMARK(BlockCompression)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+void BlockDecompression(benchmark::State & state)
+{
+    std::string uncompressed = large_comparison_data();
+    BlockCompressedBuffer compressed(uncompressed, Lz4Codec::HighCompression(9));
+    std::unique_ptr<unsigned char[]> output(new unsigned char[uncompressed.size()]);
+    while (state.KeepRunning())
+    {
+        BlockUncompressedBuffer::decompress_into(compressed.get_bytes(), { output.get(), output.get() + uncompressed.size() }, state.range_x());
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(uncompressed.size()));
+}
+BENCHMARK(BlockDecompression)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
+// the floats out of the comparison data, as one big array
+std::vector<float> comparison_floats()
+{
+    std::vector<float> result;
+    for (const memcpy_speed_comparison & element : generate_comparison_data())
+        result.push_back(element.f);
+    return result;
+}
+
+// range_x is the ShuffleFilter::Mode. uses fast lz4, and the time includes the shuffle
+void ShuffleCompression(benchmark::State & state)
+{
+    std::vector<float> floats = comparison_floats();
+    const unsigned char * begin = reinterpret_cast<const unsigned char *>(floats.data());
+    ArrayView<const unsigned char> bytes(begin, begin + floats.size() * sizeof(float));
+    ShuffleFilter filter = { ShuffleFilter::Mode(state.range_x()), GetMetaType<float>().GetSize() };
+    size_t compressed_size = 1;
+    while (state.KeepRunning())
+    {
+        CompressedBuffer compressed(bytes, Lz4Codec::Fast(), filter);
+        compressed_size = compressed.get_bytes().size();
+    }
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(bytes.size()));
+    state.SetLabel("ratio " + std::to_string(double(bytes.size()) / compressed_size));
+}
+BENCHMARK(ShuffleCompression)->Arg(ShuffleFilter::NoShuffle)->Arg(ShuffleFilter::ByteShuffle)->Arg(ShuffleFilter::BitShuffle);
+
+void ShuffleDecompression(benchmark::State & state)
+{
+    std::vector<float> floats = comparison_floats();
+    const unsigned char * begin = reinterpret_cast<const unsigned char *>(floats.data());
+    ArrayView<const unsigned char> bytes(begin, begin + floats.size() * sizeof(float));
+    ShuffleFilter filter = { ShuffleFilter::Mode(state.range_x()), GetMetaType<float>().GetSize() };
+    CompressedBuffer compressed(bytes, Lz4Codec::Fast(), filter);
+    UncompressedBuffer reused;
+    while (state.KeepRunning())
+    {
+        reused.decompress(compressed.get_bytes(), filter);
+    }
+    RAW_ASSERT(reused.get_bytes() == bytes);
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(bytes.size()));
+}
+BENCHMARK(ShuffleDecompression)->Arg(ShuffleFilter::NoShuffle)->Arg(ShuffleFilter::ByteShuffle)->Arg(ShuffleFilter::BitShuffle);
+
+// small records of a few hundred bytes each, the size where compressing
+// every record on its own doesn't work without a dictionary
+std::vector<std::vector<memcpy_speed_comparison>> generate_small_records()
+{
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    std::vector<std::vector<memcpy_speed_comparison>> records;
+    for (auto it = elements.begin(); it + 40 <= elements.end(); it += 40)
+        records.emplace_back(it, it + 40);
+    return records;
+}
+std::vector<std::string> serialize_records(const std::vector<std::vector<memcpy_speed_comparison>> & records)
+{
+    std::vector<std::string> result;
+    for (const auto & record : records)
+    {
+        std::stringstream buffer;
+        metaf::BinaryOutput output(buffer);
+        metaf::write_binary(output, record);
+        result.push_back(buffer.str());
+    }
+    return result;
+}
+
+// range_x is 0 for compressing every record on its own, 1 for using a dictionary
+void DictionaryRecordCompression(benchmark::State & state)
+{
+    std::vector<std::vector<memcpy_speed_comparison>> records = generate_small_records();
+    std::vector<std::string> serialized = serialize_records(records);
+    Lz4Dictionary dictionary = metaf::build_lz4_dictionary(records.begin(), records.begin() + 1000);
+    size_t uncompressed_size = 0;
+    size_t compressed_size = 1;
+    while (state.KeepRunning())
+    {
+        uncompressed_size = 0;
+        compressed_size = 0;
+        for (const std::string & record : serialized)
+        {
+            uncompressed_size += record.size();
+            if (state.range_x())
+                compressed_size += CompressedBuffer(record, dictionary).get_bytes().size();
+            else
+                compressed_size += CompressedBuffer(record, Lz4Codec::Fast()).get_bytes().size();
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(serialized.size()));
+    state.SetLabel("ratio " + std::to_string(double(uncompressed_size) / compressed_size));
+}
+BENCHMARK(DictionaryRecordCompression)->Arg(0)->Arg(1);
+
+void DictionaryRecordDecompression(benchmark::State & state)
+{
+    std::vector<std::vector<memcpy_speed_comparison>> records = generate_small_records();
+    std::vector<std::string> serialized = serialize_records(records);
+    Lz4Dictionary dictionary = metaf::build_lz4_dictionary(records.begin(), records.begin() + 1000);
+    std::vector<CompressedBuffer> compressed;
+    for (const std::string & record : serialized)
+        compressed.emplace_back(record, dictionary);
+    UncompressedBuffer reused;
+    std::vector<memcpy_speed_comparison> record;
+    while (state.KeepRunning())
+    {
+        // every record is read on its own, as in a random access lookup
+        for (const CompressedBuffer & buffer : compressed)
+        {
+            reused.decompress(buffer.get_bytes(), dictionary);
+            metaf::BinaryInput input(reused.get_bytes());
+            // members with default values are skipped, so start from scratch
+            record.clear();
+            metaf::read_binary(input, record);
+        }
+    }
+    RAW_ASSERT(record == records.back());
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(compressed.size()));
+}
+BENCHMARK(DictionaryRecordDecompression);
+
+// a directory with lots of small files, each one a serialized record
+std::vector<std::string> write_many_small_files(const std::vector<std::vector<memcpy_speed_comparison>> & records, size_t num_files)
+{
+    std::string directory = "/tmp/batch_loading_test/";
+    mkdir(directory.c_str(), 0755);
+    std::vector<std::string> filenames;
+    for (size_t i = 0; i < num_files; ++i)
+    {
+        filenames.push_back(directory + std::to_string(i));
+        std::ofstream file(filenames.back());
+        metaf::BinaryOutput output(file);
+        metaf::write_binary(output, records[i % records.size()]);
+    }
+    return filenames;
+}
+
+void ManySmallFilesMMappedReading(benchmark::State & state)
+{
+    std::vector<std::vector<memcpy_speed_comparison>> records = generate_small_records();
+    std::vector<std::string> filenames = write_many_small_files(records, 10000);
+    while (state.KeepRunning())
+    {
+        std::vector<std::vector<memcpy_speed_comparison>> loaded(filenames.size());
+        for (size_t i = 0; i < filenames.size(); ++i)
+        {
+            MMappedFileRead file(filenames[i]);
+            metaf::BinaryInput input(file.get_bytes());
+            metaf::read_binary(input, loaded[i]);
+        }
+        RAW_ASSERT(loaded.back() == records[(filenames.size() - 1) % records.size()]);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(filenames.size()));
+}
+BENCHMARK(ManySmallFilesMMappedReading);
+
+// range_x is the BatchFileLoader::Backend
+void ManySmallFilesBatchReading(benchmark::State & state)
+{
+    std::vector<std::vector<memcpy_speed_comparison>> records = generate_small_records();
+    std::vector<std::string> filenames = write_many_small_files(records, 10000);
+    BatchFileLoader loader(BatchFileLoader::Backend(state.range_x()));
+    while (state.KeepRunning())
+    {
+        std::vector<std::vector<memcpy_speed_comparison>> loaded;
+        size_t num_failed = metaf::read_binary_files(loader, { filenames.data(), filenames.data() + filenames.size() }, loaded);
+        RAW_VERIFY(!num_failed && loaded.back() == records[(filenames.size() - 1) % records.size()]);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(filenames.size()));
+    state.SetLabel(loader.get_backend() == BatchFileLoader::IoUringBackend ? "io_uring" : "thread pool");
+}
+BENCHMARK(ManySmallFilesBatchReading)->Arg(BatchFileLoader::IoUringBackend)->Arg(BatchFileLoader::ThreadPoolBackend);
+
+void remove_journal(const std::string & directory)
+{
+    if (DIR * dir = opendir(directory.c_str()))
+    {
+        while (dirent * entry = readdir(dir))
+            unlink((directory + '/' + entry->d_name).c_str());
+        closedir(dir);
+    }
+}
+
+// the usual way of logging records: one write call per record
+void JournalPerRecordWriting(benchmark::State & state)
+{
+    std::vector<std::vector<memcpy_speed_comparison>> records = generate_small_records();
+    std::string filename = "/tmp/journal_per_record_test";
+    while (state.KeepRunning())
+    {
+        UnixFile file(filename, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        for (const std::vector<memcpy_speed_comparison> & record : records)
+        {
+            std::stringstream buffer;
+            metaf::BinaryOutput output(buffer);
+            metaf::write_binary(output, record);
+            std::string serialized = buffer.str();
+            file.write({ reinterpret_cast<const unsigned char *>(serialized.data()), reinterpret_cast<const unsigned char *>(serialized.data() + serialized.size()) });
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(records.size()));
+}
+BENCHMARK(JournalPerRecordWriting);
+
+// range_x is the JournalWriter::FsyncPolicy
+void JournalWriting(benchmark::State & state)
+{
+    std::vector<std::vector<memcpy_speed_comparison>> records = generate_small_records();
+    std::string directory = "/tmp/journal_writing_test";
+    while (state.KeepRunning())
+    {
+        state.PauseTiming();
+        remove_journal(directory);
+        state.ResumeTiming();
+        JournalWriter writer(directory, JournalWriter::FsyncPolicy(state.range_x()));
+        for (const std::vector<memcpy_speed_comparison> & record : records)
+            writer.append(record);
+        RAW_VERIFY(writer.commit());
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(records.size()));
+}
+BENCHMARK(JournalWriting)->Arg(JournalWriter::NoFsync)->Arg(JournalWriter::FsyncOnRotate)->Arg(JournalWriter::FsyncOnCommit);
+
+void JournalReplay(benchmark::State & state)
+{
+    std::vector<std::vector<memcpy_speed_comparison>> records = generate_small_records();
+    std::string directory = "/tmp/journal_replay_test";
+    remove_journal(directory);
+    {
+        // small segments, to include the cost of switching between them
+        JournalWriter writer(directory, JournalWriter::NoFsync, JournalWriter::default_group_commit_size, 1024 * 1024);
+        for (const std::vector<memcpy_speed_comparison> & record : records)
+            writer.append(record);
+    }
+    std::vector<memcpy_speed_comparison> record;
+    while (state.KeepRunning())
+    {
+        JournalReader reader(directory);
+        size_t count = 0;
+        for (metaf::BinaryInput input : reader)
+        {
+            record.clear();
+            metaf::read_binary(input, record);
+            ++count;
+        }
+        RAW_ASSERT(count == records.size() && record == records.back());
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(records.size()));
+}
+BENCHMARK(JournalReplay);
+
+std::map<std::string, memcpy_speed_comparison> generate_lookup_table(size_t size)
+{
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    std::map<std::string, memcpy_speed_comparison> table;
+    for (size_t i = 0; i < size; ++i)
+        table["entry" + std::to_string(i)] = elements[i % elements.size()];
+    return table;
+}
+
+// the time from opening a lookup table to the first lookup. range_x is the
+// number of entries in the table. this loads the whole table into a std::map
+void LookupTableLoading(benchmark::State & state)
+{
+    std::map<std::string, memcpy_speed_comparison> table = generate_lookup_table(state.range_x());
+    std::string filename = "/tmp/lookup_table_test";
+    {
+        std::ofstream file(filename);
+        metaf::BinaryOutput output(file);
+        metaf::write_binary(output, table);
+    }
+    while (state.KeepRunning())
+    {
+        MMappedFileRead file(filename);
+        metaf::BinaryInput input(file.get_bytes());
+        std::map<std::string, memcpy_speed_comparison> loaded;
+        metaf::read_binary(input, loaded);
+        RAW_ASSERT(loaded.find("entry0")->second == table["entry0"]);
+    }
+}
+BENCHMARK(LookupTableLoading)->Arg(1000)->Arg(100000);
+
+// the same with a store, which only maps the file
+void LookupTableStoreOpening(benchmark::State & state)
+{
+    std::map<std::string, memcpy_speed_comparison> table = generate_lookup_table(state.range_x());
+    std::string filename = "/tmp/lookup_table_store_test";
+    RAW_VERIFY(metaf::write_store(filename, table));
+    while (state.KeepRunning())
+    {
+        metaf::Store<std::string, memcpy_speed_comparison> store(filename);
+        memcpy_speed_comparison found;
+        RAW_VERIFY(store.find(std::string("entry0"), found) && found == table["entry0"]);
+    }
+}
+BENCHMARK(LookupTableStoreOpening)->Arg(1000)->Arg(100000);
+
+void LookupTableStoreLookups(benchmark::State & state)
+{
+    std::map<std::string, memcpy_speed_comparison> table = generate_lookup_table(100000);
+    std::string filename = "/tmp/lookup_table_store_test";
+    RAW_VERIFY(metaf::write_store(filename, table));
+    metaf::Store<std::string, memcpy_speed_comparison> store(filename);
+    std::vector<HashedString<uint64_t, StableStringHash>> keys;
+    for (size_t i = 0; i < table.size(); i += 97)
+        keys.emplace_back("entry" + std::to_string(i));
+    memcpy_speed_comparison found;
+    while (state.KeepRunning())
+    {
+        for (const HashedString<uint64_t, StableStringHash> & key : keys)
+            RAW_VERIFY(store.find(key, found));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * int64_t(keys.size()));
+}
+BENCHMARK(LookupTableStoreLookups);
+
+// what deserializing a polymorphic pointer does for every object
+void RegisteredStructLookup(benchmark::State & state)
+{
+    const MetaType & type = GetMetaType<memcpy_speed_comparison>();
+    uint32_t hash = type.GetStructInfo()->GetName().get_hash();
+    while (state.KeepRunning())
+    {
+        for (int i = 0; i < 1000; ++i)
+        {
+            RAW_VERIFY(&MetaType::GetRegisteredStruct(hash) == &type);
+            RAW_VERIFY(&MetaType::GetStructType(typeid(memcpy_speed_comparison)) == &type);
+        }
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * 2000);
+}
+BENCHMARK(RegisteredStructLookup)->Threads(1)->Threads(4);
+
+// the static initialization only links the reflected structs into a list,
+// they get created on first use. main fills this in when it freezes the
+// registry, which doesn't create the others either
+struct StartupRegistration
+{
+    size_t num_lazy_structs = 0;
+    size_t num_registered_before_main = 0;
+    double microseconds_to_freeze = 0.0;
+};
+static StartupRegistration startup_registration;
+
+// the label says how much work got moved out of the static initialization.
+// the loop measures what the lazy creation costs every time that a type is
+// used afterwards
+void StructRegistrationAtStartup(benchmark::State & state)
+{
+    while (state.KeepRunning())
+    {
+        for (int i = 0; i < 1000; ++i)
+            benchmark::DoNotOptimize(&GetMetaType<memcpy_speed_comparison>());
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * 1000);
+    state.SetLabel(std::to_string(startup_registration.num_lazy_structs) + " lazy structs, "
+                   + std::to_string(startup_registration.num_registered_before_main) + " registered before main, "
+                   + std::to_string(startup_registration.microseconds_to_freeze) + "us to freeze");
+}
+BENCHMARK(StructRegistrationAtStartup);
+
+// what the metav3 serializers do for every struct they read
+void StructMemberLookup(benchmark::State & state)
+{
+    const MetaType::StructInfo & info = *GetMetaType<memcpy_speed_comparison>().GetStructInfo();
+    const ClassHeaderList & headers = info.GetCurrentHeaders();
+    while (state.KeepRunning())
+    {
+        for (int i = 0; i < 1000; ++i)
+            benchmark::DoNotOptimize(info.GetAllMembers(headers));
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * 1000);
+}
+BENCHMARK(StructMemberLookup)->Threads(1)->Threads(4);
+
+// arg 0 is the hand written operator==, arg 1 is the reflected comparison
+void ReflectedEquality(benchmark::State & state)
+{
+    std::vector<memcpy_speed_comparison> lhs = generate_comparison_data();
+    std::vector<memcpy_speed_comparison> rhs = lhs;
+    const MetaType & type = GetMetaType<std::vector<memcpy_speed_comparison>>();
+    while (state.KeepRunning())
+    {
+        RAW_VERIFY(state.range_x() ? type.Equals(lhs, rhs) : lhs == rhs);
+    }
+    state.SetItemsProcessed(state.iterations() * lhs.size());
+}
+BENCHMARK(ReflectedEquality)->Arg(0)->Arg(1);
+
+void ReflectedHashing(benchmark::State & state)
+{
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    const MetaType & type = GetMetaType<std::vector<memcpy_speed_comparison>>();
+    while (state.KeepRunning())
+    {
+        benchmark::DoNotOptimize(type.Hash(elements));
+    }
+    state.SetItemsProcessed(state.iterations() * elements.size());
+}
+BENCHMARK(ReflectedHashing);
+
+// sending what changed instead of all of it. arg 0 serializes everything,
+// arg 1 creates a patch for ten changed elements
+void ReflectedPatching(benchmark::State & state)
+{
+    std::vector<memcpy_speed_comparison> from = generate_comparison_data();
+    std::vector<memcpy_speed_comparison> to = from;
+    for (size_t i = 0; i < to.size(); i += to.size() / 10)
+        to[i].i += 1;
+    size_t size = 0;
+    while (state.KeepRunning())
+    {
+        if (state.range_x()) size = create_patch(from, to).size();
+        else size = OptimisticBinarySerializer().serialize(to).size();
+    }
+    state.SetItemsProcessed(state.iterations() * to.size());
+    state.SetLabel(std::to_string(size) + " bytes");
+}
+BENCHMARK(ReflectedPatching)->Arg(0)->Arg(1);
+
+// arg 0 is the copy constructor, arg 1 the same through MetaType::CopyConstruct,
+// arg 2 is MetaType::Clone and arg 3 a roundtrip through the serializer
+void ReflectedCopying(benchmark::State & state)
+{
+    typedef std::vector<memcpy_speed_comparison> Elements;
+    Elements elements = generate_comparison_data();
+    const MetaType & type = GetMetaType<Elements>();
+    alignas(Elements) unsigned char storage[sizeof(Elements)];
+    ArrayView<unsigned char> memory(storage, storage + sizeof(storage));
+    while (state.KeepRunning())
+    {
+        switch (state.range_x())
+        {
+        case 0:
+            new (storage) Elements(elements);
+            break;
+        case 1:
+            type.CopyConstruct(memory, elements);
+            break;
+        case 2:
+            type.Clone(memory, elements);
+            break;
+        case 3:
+        {
+            Elements * copy = new (storage) Elements();
+            OptimisticBinarySerializer().deserialize(*copy, OptimisticBinarySerializer().serialize(elements));
+            break;
+        }
+        }
+        type.Destroy(memory);
+    }
+    state.SetItemsProcessed(state.iterations() * elements.size());
+}
+BENCHMARK(ReflectedCopying)->Arg(0)->Arg(1)->Arg(2)->Arg(3);
+
+// lots of small maps, each of which needs scratch memory for its keys and
+// values while it gets read
+void ReflectionReadingSmallMaps(benchmark::State & state)
+{
+    std::vector<std::map<int, std::string>> maps(10000);
+    for (size_t i = 0; i < maps.size(); ++i)
+    {
+        for (int j = 0; j < int(i % 4); ++j)
+            maps[i][j] = "value";
+    }
+    std::string bytes = OptimisticBinarySerializer().serialize(maps);
+    while (state.KeepRunning())
+    {
+        std::vector<std::map<int, std::string>> read;
+        read_optimistic_binary(read, { reinterpret_cast<const unsigned char *>(bytes.data()), reinterpret_cast<const unsigned char *>(bytes.data() + bytes.size()) });
+        RAW_ASSERT(read.size() == maps.size());
+    }
+    state.SetItemsProcessed(state.iterations() * maps.size());
+}
+BENCHMARK(ReflectionReadingSmallMaps);
+
+// visits every value and adds up the floats. the argument is the number of
+// threads, 0 means one per core
+void ReflectedTraversal(benchmark::State & state)
+{
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    ParallelTraversal traversal(size_t(state.range_x()));
+    const MetaType & float_type = GetMetaType<float>();
+    while (state.KeepRunning())
+    {
+        double sum = traversal.Reduce(elements, 0.0, [&](double & sum, ConstMetaReference value)
+        {
+            if (&value.GetType() == &float_type)
+                sum += value.Get<float>();
+            return true;
+        },
+        [](double lhs, double rhs)
+        {
+            return lhs + rhs;
+        });
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * elements.size());
+    state.SetLabel(std::to_string(traversal.GetNumThreads()) + " threads");
+}
+BENCHMARK(ReflectedTraversal)->Arg(1)->Arg(4)->Arg(0);
+
 void ReflectionInMemory(benchmark::State & state)
 {
     std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
@@ -224,6 +837,45 @@ void ReflectionReading(benchmark::State & state)
 }
 BENCHMARK(ReflectionReading);
 
+// range_x is a combination of MMappedFileRead::ReadStrategy flags, range_y is 1
+// for reading a cold file and 0 for reading a file that's in the page cache.
+// this uses a bigger file than ReflectionReading so that the read ahead matters
+void ReflectionReadingStrategies(benchmark::State & state)
+{
+    std::string serialization_filename_fast = "/tmp/serialization_test_fast_strategies";
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    std::vector<std::vector<memcpy_speed_comparison>> copies(16, elements);
+    {
+        std::ofstream file(serialization_filename_fast);
+        metaf::BinaryOutput output(file);
+        metaf::write_binary(output, copies);
+    }
+    bool cold = state.range_y() != 0;
+    if (cold)
+    {
+        UnixFile(serialization_filename_fast, UnixFile::RDONLY).evict_from_os_cache();
+    }
+    while (state.KeepRunning())
+    {
+        MMappedFileRead file(serialization_filename_fast, state.range_x());
+        // the prefetch thread follows the chunks that the reader asks for
+        metaf::BinaryInput input = (state.range_x() & MMappedFileRead::BackgroundPrefetch) ? metaf::BinaryInput::FromChunks(file) : metaf::BinaryInput(file.get_bytes());
+        std::vector<std::vector<memcpy_speed_comparison>> comparison;
+        metaf::read_binary(input, comparison);
+        RAW_ASSERT(comparison.size() == copies.size() && comparison.back() == elements);
+        if (cold)
+            file.close_and_evict_from_os_cache();
+    }
+}
+BENCHMARK(ReflectionReadingStrategies)
+    ->ArgPair(MMappedFileRead::DefaultRead, 0)->ArgPair(MMappedFileRead::DefaultRead, 1)
+    ->ArgPair(MMappedFileRead::Populate, 0)->ArgPair(MMappedFileRead::Populate, 1)
+    ->ArgPair(MMappedFileRead::Sequential, 0)->ArgPair(MMappedFileRead::Sequential, 1)
+    ->ArgPair(MMappedFileRead::Sequential | MMappedFileRead::WillNeed, 0)->ArgPair(MMappedFileRead::Sequential | MMappedFileRead::WillNeed, 1)
+    ->ArgPair(MMappedFileRead::HugePages, 0)->ArgPair(MMappedFileRead::HugePages, 1)
+    ->ArgPair(MMappedFileRead::BackgroundPrefetch, 0)->ArgPair(MMappedFileRead::BackgroundPrefetch, 1)
+    ->UseRealTime();
+
 void ReflectionCompressedReading(benchmark::State & state)
 {
     std::string serialization_filename_fast = "/tmp/serialization_test_fast_compressed";
@@ -250,6 +902,115 @@ void ReflectionCompressedReading(benchmark::State & state)
 }
 BENCHMARK(ReflectionCompressedReading);
 
+void ReflectionWriting(benchmark::State & state)
+{
+    std::string serialization_filename_fast = "/tmp/serialization_test_fast_writing";
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    while (state.KeepRunning())
+    {
+        std::ofstream file(serialization_filename_fast);
+        metaf::BinaryOutput output(file);
+        metaf::write_binary(output, elements);
+    }
+}
+BENCHMARK(ReflectionWriting);
+
+void ReflectionMMappedWriting(benchmark::State & state)
+{
+    std::string serialization_filename_fast = "/tmp/serialization_test_fast_mmapped_writing";
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    while (state.KeepRunning())
+    {
+        MMappedFileWrite file(serialization_filename_fast);
+        {
+            MMappedFileWriteStream stream(file);
+            metaf::BinaryOutput output(stream);
+            metaf::write_binary(output, elements);
+        }
+        RAW_VERIFY(file.close());
+    }
+}
+BENCHMARK(ReflectionMMappedWriting);
+
+void ReflectionCompressedWriting(benchmark::State & state)
+{
+    std::string serialization_filename_fast = "/tmp/serialization_test_fast_compressed";
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    while (state.KeepRunning())
+    {
+        std::stringstream uncompressed;
+        metaf::BinaryOutput output(uncompressed);
+        metaf::write_binary(output, elements);
+        std::ofstream file(serialization_filename_fast);
+        std::string as_string = uncompressed.str();
+        CompressedBuffer compressed(as_string);
+        file.write(reinterpret_cast<const char *>(compressed.get_bytes().begin()), compressed.get_bytes().size());
+    }
+}
+BENCHMARK(ReflectionCompressedWriting);
+
+void ReflectionStreamCompressedWriting(benchmark::State & state)
+{
+    std::string serialization_filename_fast = "/tmp/serialization_test_fast_stream_compressed";
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    while (state.KeepRunning())
+    {
+        UnixFile file(serialization_filename_fast, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        CompressedOutputStream compressed(file);
+        metaf::BinaryOutput output(compressed);
+        metaf::write_binary(output, elements);
+        RAW_VERIFY(compressed.finish());
+    }
+}
+BENCHMARK(ReflectionStreamCompressedWriting);
+
+void ReflectionStreamCompressedReading(benchmark::State & state)
+{
+    std::string serialization_filename_fast = "/tmp/serialization_test_fast_stream_compressed";
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    {
+        UnixFile file(serialization_filename_fast, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        CompressedOutputStream compressed(file);
+        metaf::BinaryOutput output(compressed);
+        metaf::write_binary(output, elements);
+    }
+    while (state.KeepRunning())
+    {
+        MMappedFileRead file(serialization_filename_fast);
+        StreamingDecompressor decompressor(file.get_bytes());
+        metaf::BinaryInput input = metaf::BinaryInput::FromChunks(decompressor);
+        std::vector<memcpy_speed_comparison> comparison;
+        metaf::read_binary(input, comparison);
+        RAW_ASSERT(comparison == elements);
+        file.close_and_evict_from_os_cache();
+    }
+}
+BENCHMARK(ReflectionStreamCompressedReading);
+
+void ReflectionPipelinedReading(benchmark::State & state)
+{
+    std::string serialization_filename_fast = "/tmp/serialization_test_fast_stream_compressed";
+    std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
+    {
+        UnixFile file(serialization_filename_fast, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        CompressedOutputStream compressed(file);
+        metaf::BinaryOutput output(compressed);
+        metaf::write_binary(output, elements);
+    }
+    while (state.KeepRunning())
+    {
+        {
+            PipelinedFileLoader loader(serialization_filename_fast);
+            metaf::BinaryInput input = metaf::BinaryInput::FromChunks(loader);
+            std::vector<memcpy_speed_comparison> comparison;
+            metaf::read_binary(input, comparison);
+            RAW_ASSERT(comparison == elements);
+        }
+        UnixFile(serialization_filename_fast, UnixFile::RDONLY).evict_from_os_cache();
+    }
+}
+BENCHMARK(ReflectionPipelinedReading);
+
 void SlowReflectionReading(benchmark::State & state)
 {
     std::vector<memcpy_speed_comparison> elements = generate_comparison_data();
@@ -264,7 +1025,29 @@ void SlowReflectionReading(benchmark::State & state)
         RAW_ASSERT(comparison == elements);
     }
 }
-//BENCHMARK(SlowReflectionReading);
+BENCHMARK(SlowReflectionReading);
+
+// a big array of numbers, where the cost is all in stepping from element to
+// element
+void SlowReflectionLargeArray(benchmark::State & state)
+{
+    std::vector<float> elements(1024 * 1024);
+    for (size_t i = 0; i < elements.size(); ++i)
+        elements[i] = float(i);
+    std::stringstream buffer;
+    write_optimistic_binary(elements, buffer);
+    std::string in_memory = buffer.str();
+    while (state.KeepRunning())
+    {
+        std::stringstream out;
+        write_optimistic_binary(elements, out);
+        std::vector<float> comparison;
+        read_optimistic_binary(comparison, { reinterpret_cast<const unsigned char *>(in_memory.data()), reinterpret_cast<const unsigned char *>(in_memory.data() + in_memory.size()) });
+        RAW_ASSERT(comparison == elements);
+    }
+    state.SetItemsProcessed(state.iterations() * elements.size());
+}
+BENCHMARK(SlowReflectionLargeArray);
 
 void JsonReflectionReading(benchmark::State & state)
 {
@@ -311,6 +1094,13 @@ void BoostSerializationReading(benchmark::State & state)
 
 int main(int argc, char * argv[])
 {
+    // the structs only got created if something used them during the static
+    // initialization. the others get created when they are first used
+    startup_registration.num_lazy_structs = MetaType::GetNumLazyStructs();
+    startup_registration.num_registered_before_main = MetaType::GetNumRegisteredStructs();
+    auto freeze_start = std::chrono::high_resolution_clock::now();
+    MetaType::FreezeStructRegistry();
+    startup_registration.microseconds_to_freeze = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - freeze_start).count();
     int result = 0;
 #ifndef DISABLE_TESTS
     ::testing::InitGoogleTest(&argc, argv);
@@ -1,23 +1,51 @@
 #include "metafast/metafast.hpp"
-#include <unordered_map>
+#include "util/memoizingMap.hpp"
+#include <stdexcept>
 
 namespace metaf
 {
+void BinaryInput::memcpy_across_chunks(byte * output, size_t size)
+{
+    for (;;)
+    {
+        size_t to_copy = std::min(size, input.size());
+        output = std::copy(input.begin(), input.begin() + to_copy, output);
+        input = input.subview(to_copy);
+        size -= to_copy;
+        if (!size)
+            return;
+        input = next_chunk(chunk_source);
+        if (input.empty())
+            RAW_THROW(std::runtime_error("reached the end of the input in the middle of a value"));
+    }
+}
+
 namespace detail
 {
-static std::unordered_map<const metav3::MetaType *, std::pair<void (*)(BinaryOutput &, metav3::ConstMetaReference), void (*)(BinaryInput &, metav3::MetaReference)> > & registered_functions_by_type()
+typedef std::pair<void (*)(BinaryOutput &, metav3::ConstMetaReference), void (*)(BinaryInput &, metav3::MetaReference)> TypeErasedFunctions;
+// the structs register these right before their MetaType gets created, which
+// can happen on any thread. the MetaType constructor is what makes the struct
+// visible to other threads, so a lookup never gets in before the registration
+static concurrent_memoizing_map<const metav3::MetaType *, TypeErasedFunctions> & registered_functions_by_type()
 {
-    static std::unordered_map<const metav3::MetaType *, std::pair<void (*)(BinaryOutput &, metav3::ConstMetaReference), void (*)(BinaryInput &, metav3::MetaReference)> > result;
+    static concurrent_memoizing_map<const metav3::MetaType *, TypeErasedFunctions> result;
     return result;
 }
 
 void register_type_erased_functions(const metav3::MetaType & type, void (*serialize)(BinaryOutput &, metav3::ConstMetaReference), void (*deserialize)(BinaryInput &, metav3::MetaReference))
 {
-    registered_functions_by_type()[&type] = { serialize, deserialize };
+    registered_functions_by_type().get(&type, [&](const metav3::MetaType *)
+    {
+        return TypeErasedFunctions(serialize, deserialize);
+    });
 }
 std::pair<void (*)(BinaryOutput &, metav3::ConstMetaReference), void (*)(BinaryInput &, metav3::MetaReference)> get_type_erased_functions(const metav3::MetaType & type)
 {
-    return registered_functions_by_type()[&type];
+    // throwing doesn't store anything, so a miss doesn't stay in the map
+    return registered_functions_by_type().get(&type, [](const metav3::MetaType *) -> TypeErasedFunctions
+    {
+        RAW_THROW(std::runtime_error("the struct has no serialization functions. is it abstract?"));
+    });
 }
 void serialize_struct(BinaryOutput & output, metav3::ConstMetaReference ref)
 {
@@ -819,6 +847,29 @@ TEST(metafast, pointer_to_base)
     ASSERT_EQ(*a_derived, *b_derived);
 }
 
+// only used in the test below. the abstract version doesn't register the
+// type erased functions, the test does that by hand
+struct RegisteredByHand
+{
+    int a = 0;
+};
+REFLECT_ABSTRACT_CLASS_START(RegisteredByHand, 0)
+    REFLECT_MEMBER(a);
+REFLECT_CLASS_END()
+
+TEST(metafast, type_erased_functions)
+{
+    // registered before GetMetaType returns
+    ASSERT_EQ(&metaf::detail::RegisterDeserializeStruct<VirtualDerived>::deserialize, metaf::detail::get_type_erased_functions(metav3::GetMetaType<VirtualDerived>()).second);
+    // a miss throws and doesn't get remembered, so a later registration
+    // still works
+    const metav3::MetaType & not_registered = metav3::GetMetaType<RegisteredByHand>();
+    ASSERT_THROW(metaf::detail::get_type_erased_functions(not_registered), std::runtime_error);
+    ASSERT_THROW(metaf::detail::get_type_erased_functions(not_registered), std::runtime_error);
+    metaf::detail::RegisterDeserializeStruct<RegisteredByHand>::Register(not_registered);
+    ASSERT_EQ(&metaf::detail::RegisterDeserializeStruct<RegisteredByHand>::serialize, metaf::detail::get_type_erased_functions(not_registered).first);
+}
+
 
 
 struct TestBinarySerializer
@@ -22,9 +22,30 @@ struct BinaryInput
     {
     }
 
+    // reads from a source that hands out the bytes in chunks, like a
+    // StreamingDecompressor. source.next_chunk() has to return the next chunk
+    // or an empty range at the end of the input. a chunk only has to stay
+    // valid until the next call to next_chunk(), which means that you can not
+    // deserialize StringViews from this
+    template<typename Source>
+    static BinaryInput FromChunks(Source & source)
+    {
+        BinaryInput result(ArrayView<const byte>{});
+        result.next_chunk = &call_next_chunk<Source>;
+        result.chunk_source = std::addressof(source);
+        return result;
+    }
+
+    bool is_chunked() const
+    {
+        return next_chunk != nullptr;
+    }
+
     template<typename T>
     void memcpy(T & output)
     {
+        if (UNLIKELY(input.size() < sizeof(T)) && is_chunked())
+            return memcpy_across_chunks(reinterpret_cast<byte *>(std::addressof(output)), sizeof(T));
         auto end = input.begin() + sizeof(T);
         std::copy(input.begin(), end, reinterpret_cast<byte *>(std::addressof(output)));
         input = { end, input.end() };
@@ -49,6 +70,17 @@ struct BinaryInput
     }
 
     ArrayView<const byte> input;
+
+private:
+    ArrayView<const byte> (*next_chunk)(void *) = nullptr;
+    void * chunk_source = nullptr;
+
+    template<typename Source>
+    static ArrayView<const byte> call_next_chunk(void * source)
+    {
+        return static_cast<Source *>(source)->next_chunk();
+    }
+    void memcpy_across_chunks(byte * output, size_t size);
 };
 
 struct BinaryOutput
@@ -64,15 +96,6 @@ struct BinaryOutput
         auto begin = reinterpret_cast<const char *>(std::addressof(data));
         std::copy(begin, begin + sizeof(T), std::ostreambuf_iterator<char>(output));
     }
-    typedef std::ostream::pos_type pos_type;
-    pos_type current_position() const
-    {
-        return output.tellp();
-    }
-    void go_to_position(pos_type position)
-    {
-        output.seekp(position);
-    }
 
 private:
     std::ostream & output;
@@ -105,9 +128,10 @@ void optimistic_reflect_registered_class<type_to_register>(OptimisticBinaryDeser
 template<>\
 void reflect_registered_class<type_to_register, OptimisticBinarySerializer<type_to_register>>(OptimisticBinarySerializer<type_to_register> & archive, int8_t version)\
 {\
-    MemberCounter<type_to_register> count_members;\
-    reflect_registered_class_any_archive<type_to_register>()(count_members, version);\
-    archive.member_count = count_members.get_count();\
+    NonDefaultMembers<type_to_register> non_default_members = archive.GetNonDefaultMembers();\
+    reflect_registered_class_any_archive<type_to_register>()(non_default_members, version);\
+    archive.member_count = non_default_members.get_count();\
+    archive.flag_to_write = non_default_members.get_flags();\
     return reflect_registered_class_any_archive<type_to_register>()(archive, version);\
 }
 #else
@@ -124,14 +148,38 @@ void reflect_registered_class<type_to_register, OptimisticBinarySerializer<type_
 }
 #endif
 
-#define REFLECT_ABSTRACT_CLASS_START(type_to_register, current_version)\
+// the MetaType gets created the first time that GetMetaType is called for
+// it. until then the struct only sits in the list of lazy registrations.
+// on_create runs before the MetaType gets constructed, because the
+// constructor makes the type visible to lookups on other threads. so
+// on_create may only use the address of the type
+#define REFLECT_CLASS_META_TYPE(type_to_register, current_version, on_create)\
 namespace metav3\
 {\
 template<>\
-const MetaType MetaType::MetaTypeConstructor<type_to_register>::type = MetaType::RegisterStruct<type_to_register>(#type_to_register, current_version, &metaf::detail::GetBoth<type_to_register>);\
+const MetaType & MetaType::MetaTypeConstructor<type_to_register>::Get()\
+{\
+    struct Created\
+    {\
+        Created()\
+            : before_created((on_create(type), true))\
+            , type(MetaType::RegisterStruct<type_to_register>(#type_to_register, current_version, &metaf::detail::GetBoth<type_to_register>))\
+        {\
+        }\
+        bool before_created;\
+        const MetaType type;\
+    };\
+    static const Created created;\
+    return created.type;\
+}\
 }\
 namespace metaf\
 {\
+static const metav3::MetaType::LazyStructRegistration PP_CONCAT(lazy_registration_, __LINE__)(&metav3::MetaType::MetaTypeConstructor<type_to_register>::Get);\
+}
+#define REFLECT_CLASS_ARCHIVES_START(type_to_register, current_version)\
+namespace metaf\
+{\
 template<>\
 struct reflect_registered_class_any_archive<type_to_register>\
 {\
@@ -149,12 +197,12 @@ template<template<typename> class Ar, typename T>\
 inline void metaf::reflect_registered_class_any_archive<type_to_register>::operator()(Ar<T> & archive, int8_t version) const\
 {\
     archive.begin(version);
+#define REFLECT_ABSTRACT_CLASS_START(type_to_register, current_version)\
+REFLECT_CLASS_META_TYPE(type_to_register, current_version, metaf::detail::ignore_created_type)\
+REFLECT_CLASS_ARCHIVES_START(type_to_register, current_version)
 #define REFLECT_CLASS_START(type_to_register, current_version)\
-namespace metaf\
-{\
-static detail::RegisterDeserializeStruct<type_to_register> PP_CONCAT(register_deserialize_, __LINE__);\
-}\
-REFLECT_ABSTRACT_CLASS_START(type_to_register, current_version)
+REFLECT_CLASS_META_TYPE(type_to_register, current_version, metaf::detail::RegisterDeserializeStruct<type_to_register>::Register)\
+REFLECT_CLASS_ARCHIVES_START(type_to_register, current_version)
 #define REFLECT_MEMBER(member_name) archive.member(#member_name, &T::member_name)
 #define REFLECT_BASE(class_name) archive.template base<class_name>()
 #define REFLECT_CLASS_END() archive.finish();\
@@ -253,12 +301,16 @@ void serialize_struct(BinaryOutput & output, metav3::ConstMetaReference ref);
 void deserialize_struct(BinaryInput & input, metav3::MetaReference ref);
 void register_type_erased_functions(const metav3::MetaType &, void (*)(BinaryOutput &, metav3::ConstMetaReference), void (*)(BinaryInput &, metav3::MetaReference));
 std::pair<void (*)(BinaryOutput &, metav3::ConstMetaReference), void (*)(BinaryInput &, metav3::MetaReference)> get_type_erased_functions(const metav3::MetaType &);
+inline void ignore_created_type(const metav3::MetaType &)
+{
+}
 template<typename S>
 struct RegisterDeserializeStruct
 {
-    RegisterDeserializeStruct()
+    // gets called right before the MetaType of S is created at this address
+    static void Register(const metav3::MetaType & type)
     {
-        register_type_erased_functions(metav3::GetMetaType<S>(), &serialize, &deserialize);
+        register_type_erased_functions(type, &serialize, &deserialize);
     }
 
     static void serialize(BinaryOutput & output, metav3::ConstMetaReference ref)
@@ -453,6 +505,55 @@ private:
         RAW_ASSERT(count <= 64, "Serialization only supports structs with up to 64 members. This is required to only use one bit of overhead per member. Can you move some members to a nested struct?");
     }
 };
+
+// figures out which members are not at their default value before anything
+// gets written. that way the serializer can write the flags first and never
+// has to seek back in the output, which means that the output can be a pure
+// stream. (like a file that gets compressed while writing)
+template<typename T>
+struct NonDefaultMembers
+{
+    NonDefaultMembers(const T & object, const T & defaults)
+        : object(object), defaults(defaults)
+    {
+    }
+
+    void begin(int8_t)
+    {
+    }
+    template<typename M>
+    void member(StringView<const char> name, M T::*m)
+    {
+        if (!detail::is_default(object, m, defaults))
+            flags |= 1ull << count_members.get_count();
+        count_members.member(name, m);
+    }
+    template<typename B>
+    void base()
+    {
+        if (!detail::is_default(static_cast<const B &>(object), static_cast<const B &>(defaults)))
+            flags |= 1ull << count_members.get_count();
+        count_members.template base<B>();
+    }
+    void finish()
+    {
+    }
+
+    uint8_t get_count() const
+    {
+        return count_members.get_count();
+    }
+    uint64_t get_flags() const
+    {
+        return flags;
+    }
+
+private:
+    const T & object;
+    const T & defaults;
+    MemberCounter<T> count_members;
+    uint64_t flags = 0;
+};
 #endif
 
 template<typename T>
@@ -551,7 +652,6 @@ struct OptimisticBinarySerializer
 #ifdef SKIP_DEFAULT_MEMBERS
     OptimisticBinarySerializer(const T & object, BinaryOutput & output, const T & defaults)
         : object(object), output(output), defaults(defaults)
-        , position_to_write_flag(output.current_position())
     {
     }
 #else
@@ -571,34 +671,28 @@ struct OptimisticBinarySerializer
     template<typename M>
     void member(StringView<const char>, M T::*m)
     {
-        if (!detail::is_default(object, m, defaults))
-        {
-            write_member_start();
+        if (should_write_member())
             write_member(m);
-        }
         after_member();
     }
     template<typename B>
     void base()
     {
-        if (!detail::is_default(static_cast<const B &>(object), static_cast<const B &>(defaults)))
-        {
-            write_member_start();
+        if (should_write_member())
             detail::serialize_struct(output, static_cast<const B &>(object), static_cast<const B &>(defaults));
-        }
         after_member();
     }
     void finish()
     {
-        if (member_count == 0)
-            return;
-        BinaryOutput::pos_type position_now = output.current_position();
-        output.go_to_position(position_to_write_flag);
-        write_flag();
-        output.go_to_position(position_now);
+    }
+
+    NonDefaultMembers<T> GetNonDefaultMembers() const
+    {
+        return { object, defaults };
     }
 
     uint8_t member_count;
+    uint64_t flag_to_write = 0;
 #else
     void begin(int8_t)
     {
@@ -624,9 +718,7 @@ private:
     BinaryOutput & output;
 #ifdef SKIP_DEFAULT_MEMBERS
     const T & defaults;
-    BinaryOutput::pos_type position_to_write_flag;
     uint8_t current_member = 0;
-    uint64_t flag_to_write = 0;
 
     void write_flag()
     {
@@ -640,9 +732,9 @@ private:
             detail::memcpy_reference(output, flag_to_write);
     }
 
-    void write_member_start()
+    bool should_write_member() const
     {
-        flag_to_write |= 1ull << current_member;
+        return flag_to_write & (1ull << current_member);
     }
     void after_member()
     {
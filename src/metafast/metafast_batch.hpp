@@ -0,0 +1,24 @@
+#pragma once
+
+#include "metafast/metafast.hpp"
+#include "os/batch_file_loader.hpp"
+#include <string>
+#include <vector>
+
+namespace metaf
+{
+// loads every file with the loader and deserializes it into results[i] on one
+// of the worker threads. returns the number of files that couldn't be loaded.
+// the objects for those files are left default constructed
+template<typename T>
+size_t read_binary_files(BatchFileLoader & loader, ArrayView<const std::string> filenames, std::vector<T> & results)
+{
+    results.clear();
+    results.resize(filenames.size());
+    return loader.load(filenames, [&](size_t index, ArrayView<const unsigned char> bytes)
+    {
+        BinaryInput input(bytes);
+        read_binary(input, results[index]);
+    });
+}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "metafast/metafast.hpp"
+#include "util/compressed_buffer.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace metaf
+{
+// serializes every object on its own, the same way that you would store them
+// as individual records, and builds a lz4 dictionary from that. pass in a
+// few hundred to a few thousand typical objects
+template<typename It>
+Lz4Dictionary build_lz4_dictionary(It begin, It end, size_t dictionary_size = Lz4Dictionary::max_size)
+{
+    std::vector<std::string> samples;
+    for (; begin != end; ++begin)
+    {
+        std::stringstream buffer;
+        BinaryOutput output(buffer);
+        write_binary(output, *begin);
+        samples.push_back(buffer.str());
+    }
+    return Lz4Dictionary::FromSamples({ samples.data(), samples.data() + samples.size() }, dictionary_size);
+}
+}
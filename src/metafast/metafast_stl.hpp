@@ -83,6 +83,7 @@ struct reference_specialization<StringView<const C>>
 {
     void operator()(BinaryInput & input, StringView<const C> & data)
     {
+        RAW_ASSERT(!input.is_chunked(), "a StringView would point into a chunk that gets reused. deserialize into a std::string instead");
         size_t size = 0;
         reference(input, size);
         auto end_of_string = input.input.begin() + size;
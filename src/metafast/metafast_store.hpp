@@ -0,0 +1,110 @@
+#pragma once
+
+#include "metafast/metafast.hpp"
+#include "os/mapped_store.hpp"
+#include "util/shared_ptr.hpp"
+#include "util/string/hashed_string.hpp"
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace metaf
+{
+namespace detail
+{
+// string keys are stored as they are, so that a HashedString with the
+// StableStringHash can be looked up with the hash that it already has. all
+// other keys are stored in their binary serialized form
+inline std::string encode_store_key(const std::string & key)
+{
+    return key;
+}
+template<typename K>
+std::string encode_store_key(const K & key)
+{
+    std::stringstream buffer;
+    BinaryOutput output(buffer);
+    write_binary(output, key);
+    return buffer.str();
+}
+inline ArrayView<const unsigned char> as_store_bytes(const std::string & bytes)
+{
+    const unsigned char * begin = reinterpret_cast<const unsigned char *>(bytes.data());
+    return { begin, begin + bytes.size() };
+}
+inline uint64_t store_key_hash(const std::string & encoded_key)
+{
+    return StableStringHash::hash(encoded_key.data(), encoded_key.data() + encoded_key.size());
+}
+}
+
+// builds a store file that Store<K, T> can read. returns false if the file
+// couldn't be written
+template<typename K, typename T, typename C, typename A>
+bool write_store(StringView<const char> filename, const std::map<K, T, C, A> & table)
+{
+    MappedStoreBuilder builder;
+    for (const auto & entry : table)
+    {
+        std::string key = detail::encode_store_key(entry.first);
+        std::stringstream value;
+        BinaryOutput output(value);
+        write_binary(output, entry.second);
+        builder.add(detail::store_key_hash(key), detail::as_store_bytes(key), detail::as_store_bytes(value.str()));
+    }
+    return builder.write(filename);
+}
+
+// a persistent lookup table of reflected objects. opening it takes the same
+// time no matter how big the table is, and find() only deserializes the value
+// that it finds
+template<typename K, typename T>
+struct Store
+{
+    Store(StringView<const char> filename, int read_strategy = MMappedFileRead::DefaultRead)
+        : store(filename, read_strategy)
+    {
+    }
+
+    bool is_valid() const
+    {
+        return store.is_valid();
+    }
+    size_t size() const
+    {
+        return store.size();
+    }
+
+    bool find(const K & key, T & value) const
+    {
+        std::string encoded = detail::encode_store_key(key);
+        return find_encoded(detail::store_key_hash(encoded), detail::as_store_bytes(encoded), value);
+    }
+    // for string keys. reuses the hash that the HashedString already computed
+    bool find(const HashedString<uint64_t, StableStringHash> & key, T & value) const
+    {
+        return find_encoded(key.get_hash(), detail::as_store_bytes(key.get()), value);
+    }
+    // the serialized value, pointing into the mapped file
+    bool find_bytes(const K & key, ArrayView<const unsigned char> & bytes) const
+    {
+        std::string encoded = detail::encode_store_key(key);
+        return store.find(detail::store_key_hash(encoded), detail::as_store_bytes(encoded), bytes);
+    }
+
+private:
+    bool find_encoded(uint64_t hash, ArrayView<const unsigned char> key, T & value) const
+    {
+        ArrayView<const unsigned char> bytes;
+        if (!store.find(hash, key, bytes))
+            return false;
+        // members with default values are skipped, so start from scratch
+        value = T();
+        BinaryInput input(bytes);
+        read_binary(input, value);
+        return true;
+    }
+
+    MappedStore store;
+};
+}
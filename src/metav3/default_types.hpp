@@ -8,23 +8,29 @@ namespace metav3
 template<typename T, size_t Size>
 struct MetaType::MetaTypeConstructor<T[Size]>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterArray<T[Size]>(GetMetaType<T>(), Size);
+        return type;
+    }
 };
-template<typename T, size_t Size>
-const MetaType MetaType::MetaTypeConstructor<T[Size]>::type = MetaType::RegisterArray<T[Size]>(GetMetaType<T>(), Size);
 template<typename T>
 struct MetaType::MetaTypeConstructor<T *>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterPointerToStruct<T *>();
+        return type;
+    }
 };
-template<typename T>
-const MetaType MetaType::MetaTypeConstructor<T *>::type = MetaType::RegisterPointerToStruct<T *>();
 template<typename T, typename D>
 struct MetaType::MetaTypeConstructor<std::unique_ptr<T, D>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterPointerToStruct<std::unique_ptr<T, D>>();
+        return type;
+    }
 };
-template<typename T, typename D>
-const MetaType MetaType::MetaTypeConstructor<std::unique_ptr<T, D>>::type = MetaType::RegisterPointerToStruct<std::unique_ptr<T, D>>();
 
 }
@@ -1,9 +1,11 @@
 #include "metav3/metav3.hpp"
+#include "metav3/scratch_allocator.hpp"
 
 #include "debug/assert.hpp"
 #include <stdexcept>
 #include <algorithm>
 #include <util/algorithm.hpp>
+#include <atomic>
 #include <mutex>
 #include <typeindex>
 #include <unordered_map>
@@ -52,35 +54,141 @@ MetaType::MetaType(MapInfo map_info, GeneralInformation general)
 }
 namespace
 {
+// an open addressing table with linear probing that never changes after it
+// was built, so it can be read from any number of threads without a lock
+template<typename Key>
+struct FrozenLookup
+{
+    struct Slot
+    {
+        Key key;
+        const MetaType * type;
+    };
+
+    explicit FrozenLookup(size_t num_entries)
+    {
+        // at most half full, so that the probe sequences stay short
+        size_t size = 1;
+        while (size < 2 * num_entries)
+            size *= 2;
+        slots.resize(size, Slot{ Key(), nullptr });
+        mask = size - 1;
+    }
+    void Insert(Key key, const MetaType & type)
+    {
+        size_t index = size_t(key) & mask;
+        while (slots[index].type)
+            index = (index + 1) & mask;
+        slots[index] = { key, &type };
+    }
+    template<typename Matches>
+    const MetaType * Find(Key key, Matches && matches) const
+    {
+        for (size_t index = size_t(key) & mask;; index = (index + 1) & mask)
+        {
+            const Slot & slot = slots[index];
+            if (!slot.type)
+                return nullptr;
+            if (slot.key == key && matches(*slot.type))
+                return slot.type;
+        }
+    }
+
+private:
+    std::vector<Slot> slots;
+    size_t mask;
+};
+uint64_t HashStructName(StringView<const char> name)
+{
+    return StableStringHash::hash(name.begin(), name.end());
+}
+bool StructNameEquals(const MetaType & type, StringView<const char> name)
+{
+    const std::string & stored = type.GetStructInfo()->GetName().get();
+    return stored.size() == name.size() && std::equal(name.begin(), name.end(), stored.begin());
+}
+struct FrozenStructRegistry
+{
+    explicit FrozenStructRegistry(const std::unordered_map<uint32_t, const MetaType *> & all_types)
+        : by_hash(all_types.size()), by_type(all_types.size()), by_name(all_types.size())
+    {
+        for (const auto & entry : all_types)
+        {
+            const MetaType & type = *entry.second;
+            by_hash.Insert(entry.first, type);
+            by_type.Insert(type.GetTypeInfo().hash_code(), type);
+            by_name.Insert(HashStructName(type.GetStructInfo()->GetName().get()), type);
+        }
+    }
+
+    FrozenLookup<uint32_t> by_hash;
+    FrozenLookup<size_t> by_type;
+    FrozenLookup<uint64_t> by_name;
+};
+
+// while the static registration is running, every lookup takes the mutex.
+// after FreezeStructRegistry the lookups go to an immutable table first and
+// only take the mutex if the type isn't in there. structs that get registered
+// after that are only in the locked maps at first. once there are as many of
+// those as there are in the table, a new table with all of them gets
+// published. the old tables stay alive because a reader may still be looking
+// at one. since every table is at least twice as big as the one before it,
+// building them costs O(1) per struct and all of them together take at most
+// twice the memory of the last one
 struct GlobalStructStorage
 {
-    const MetaType & GetByName(const ReflectionHashedString & name) const
+    const MetaType * FindByName(const ReflectionHashedString & name) const
     {
+        if (const FrozenStructRegistry * registry = frozen.load(std::memory_order_acquire))
+        {
+            if (const MetaType * found = registry->by_hash.Find(name.get_hash(), [&](const MetaType & type){ return type.GetStructInfo()->GetName() == name; }))
+                return found;
+        }
         std::lock_guard<std::mutex> lock(mutex);
         auto found = by_name.find(name);
-        if (found == by_name.end()) RAW_THROW(std::runtime_error("tried to get a type that wasn't registered"));
-        else return *found->second;
+        if (found == by_name.end()) return nullptr;
+        else return found->second;
     }
-    const MetaType & GetByType(const std::type_info & type) const
+    const MetaType * FindByType(const std::type_info & type) const
     {
+        if (const FrozenStructRegistry * registry = frozen.load(std::memory_order_acquire))
+        {
+            if (const MetaType * found = registry->by_type.Find(type.hash_code(), [&](const MetaType & stored){ return stored.GetTypeInfo() == type; }))
+                return found;
+        }
         std::lock_guard<std::mutex> lock(mutex);
         auto found = by_type.find(std::type_index(type));
-        if (found == by_type.end()) RAW_THROW(std::runtime_error("tried to get a type that wasn't registered"));
-        else return *found->second;
+        if (found == by_type.end()) return nullptr;
+        else return found->second;
     }
-    const ReflectionHashedString & GetStoredName(StringView<const char> name) const
+    const ReflectionHashedString * FindStoredName(StringView<const char> name) const
     {
+        if (const FrozenStructRegistry * registry = frozen.load(std::memory_order_acquire))
+        {
+            if (const MetaType * found = registry->by_name.Find(HashStructName(name), [&](const MetaType & type){ return StructNameEquals(type, name); }))
+                return &found->GetStructInfo()->GetName();
+        }
         std::lock_guard<std::mutex> lock(mutex);
         auto found = stored_names.find(name);
-        if (found == stored_names.end()) RAW_THROW(std::runtime_error("tried to get a type that wasn't registered"));
-        return found->second;
+        if (found == stored_names.end()) return nullptr;
+        return &found->second;
     }
-    const MetaType & GetByHash(uint32_t hash) const
+    const MetaType * FindByHash(uint32_t hash) const
     {
+        if (const FrozenStructRegistry * registry = frozen.load(std::memory_order_acquire))
+        {
+            if (const MetaType * found = registry->by_hash.Find(hash, [](const MetaType &){ return true; }))
+                return found;
+        }
         std::lock_guard<std::mutex> lock(mutex);
         auto found = by_hash.find(hash);
-        if (found == by_hash.end()) RAW_THROW(std::runtime_error("tried to get a type that wasn't registered"));
-        return *found->second;
+        if (found == by_hash.end()) return nullptr;
+        return found->second;
+    }
+    size_t GetNumTypes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return by_hash.size();
     }
     void AddType(const MetaType & to_add)
     {
@@ -91,14 +199,52 @@ struct GlobalStructStorage
         RAW_VERIFY(by_type.emplace(to_add.GetTypeInfo(), &to_add).second); // this will trigger if you register a struct under two different names
         RAW_VERIFY(stored_names.emplace(name.get(), name).second);
         RAW_VERIFY(by_hash.emplace(name.get_hash(), &to_add).second); // this will trigger if there's a hash collision in the registered names
+        if (is_frozen && !num_late_registrations)
+            PublishFrozenIfGrown();
+    }
+
+    void Freeze()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_frozen = true;
+        PublishFrozen();
+    }
+    void BeginLateRegistration()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++num_late_registrations;
+    }
+    void EndLateRegistration()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--num_late_registrations == 0 && is_frozen)
+            PublishFrozenIfGrown();
     }
 
 private:
+    // these have to be called with the mutex locked
+    void PublishFrozen()
+    {
+        all_frozen.emplace_back(new FrozenStructRegistry(by_hash));
+        num_frozen_types = by_hash.size();
+        frozen.store(all_frozen.back().get(), std::memory_order_release);
+    }
+    void PublishFrozenIfGrown()
+    {
+        if (by_hash.size() >= 2 * num_frozen_types)
+            PublishFrozen();
+    }
+
     mutable std::mutex mutex;
     std::map<ReflectionHashedString, const MetaType *> by_name;
     std::map<std::type_index, const MetaType *> by_type;
     std::unordered_map<StringView<const char>, ReflectionHashedString> stored_names;
     std::unordered_map<uint32_t, const MetaType *> by_hash;
+    bool is_frozen = false;
+    int num_late_registrations = 0;
+    size_t num_frozen_types = 0;
+    std::atomic<const FrozenStructRegistry *> frozen{ nullptr };
+    std::vector<std::unique_ptr<FrozenStructRegistry>> all_frozen;
 };
 GlobalStructStorage & GetGlobalStructStorage()
 {
@@ -111,6 +257,25 @@ GlobalStructStorage & GetGlobalStructStorage()
 // information from other types using the static reference below. by organizing the
 // code like this, address sanitizer will complain if I get it wrong
 static GlobalStructStorage & global_struct_storage = GetGlobalStructStorage();
+
+// the lazy registrations push themselves from the static initialization of
+// other translation units, so these have to work before any constructor in
+// this file ran. atomics and mutexes are constant initialized, so they do
+std::atomic<const MetaType::LazyStructRegistration *> pending_lazy_structs{ nullptr };
+std::atomic<size_t> num_lazy_structs{ 0 };
+std::mutex register_all_mutex;
+
+template<typename T, typename Find>
+const T & FindRegisteredStruct(const Find & find)
+{
+    if (const T * found = find())
+        return *found;
+    // it may be a struct that hasn't been used yet
+    MetaType::RegisterAllStructs();
+    if (const T * found = find())
+        return *found;
+    RAW_THROW(std::runtime_error("tried to get a type that wasn't registered"));
+}
 }
 MetaType::MetaType(StructInfo struct_info, GeneralInformation general)
     : category(Struct), struct_info(std::move(struct_info)), general(std::move(general))
@@ -124,6 +289,7 @@ MetaType::MetaType(PointerToStructInfo pointer_to_struct_info, GeneralInformatio
 MetaType::MetaType(TypeErasureInfo type_erasure_info, GeneralInformation general)
     : category(TypeErasure), type_erasure_info(std::move(type_erasure_info)), general(std::move(general))
 {
+    this->type_erasure_info.self = this;
 }
 
 MetaType::MetaType(MetaType && other)
@@ -171,6 +337,7 @@ MetaType::MetaType(MetaType && other)
         break;
     case TypeErasure:
         new (&type_erasure_info) TypeErasureInfo(std::move(other.type_erasure_info));
+        type_erasure_info.self = this;
         break;
     }
 }
@@ -236,8 +403,8 @@ MetaType::EnumInfo::EnumInfo(std::map<int32_t, std::string> values)
     }
 }
 
-MetaType::ArrayInfo::ArrayInfo(const MetaType & value_type, size_t array_size, MetaRandomAccessIterator (*begin)(MetaReference))
-    : begin(begin), value_type(value_type), array_size(array_size)
+MetaType::ArrayInfo::ArrayInfo(const MetaType & value_type, size_t array_size, MetaRandomAccessIterator (*begin)(MetaReference), unsigned char * (*data)(MetaReference))
+    : begin(begin), data(data), value_type(value_type), array_size(array_size)
 {
 }
 MetaType::StructInfo::StructInfo(ReflectionHashedString name, int8_t current_version, GetInfoFunction get_both)
@@ -284,8 +451,8 @@ MetaReference MetaType::PointerToStructInfo::AssignNew(MetaReference pointer, co
     return as_reference;
 }
 
-MetaType::TypeErasureInfo::TypeErasureInfo(const MetaType & self, target_type_function target_type)
-    : self(&self), target_type(std::move(target_type))
+MetaType::TypeErasureInfo::TypeErasureInfo(target_type_function target_type)
+    : target_type(std::move(target_type))
 {
 }
 const MetaType * MetaType::TypeErasureInfo::TargetType(ConstMetaReference reference) const
@@ -319,19 +486,76 @@ std::map<std::pair<const MetaType *, const MetaType *>, MetaType::TypeErasureInf
 
 const MetaType & MetaType::GetStructType(const ReflectionHashedString & name)
 {
-    return global_struct_storage.GetByName(name);
+    return FindRegisteredStruct<MetaType>([&]{ return global_struct_storage.FindByName(name); });
 }
 const MetaType & MetaType::GetStructType(const std::type_info & type)
 {
-    return global_struct_storage.GetByType(type);
+    return FindRegisteredStruct<MetaType>([&]{ return global_struct_storage.FindByType(type); });
 }
 const ReflectionHashedString & MetaType::GetRegisteredStructName(StringView<const char> name)
 {
-    return global_struct_storage.GetStoredName(name);
+    return FindRegisteredStruct<ReflectionHashedString>([&]{ return global_struct_storage.FindStoredName(name); });
 }
 const MetaType & MetaType::GetRegisteredStruct(uint32_t hash)
 {
-    return global_struct_storage.GetByHash(hash);
+    return FindRegisteredStruct<MetaType>([&]{ return global_struct_storage.FindByHash(hash); });
+}
+void MetaType::FreezeStructRegistry()
+{
+    global_struct_storage.Freeze();
+}
+MetaType::LazyStructRegistration::LazyStructRegistration(const MetaType & (*get)())
+    : get(get), next(pending_lazy_structs.load(std::memory_order_relaxed))
+{
+    while (!pending_lazy_structs.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed))
+    {
+    }
+    num_lazy_structs.fetch_add(1, std::memory_order_relaxed);
+}
+void MetaType::RegisterAllStructs()
+{
+    // if a struct looks up another struct while it's being created, that
+    // lookup should just miss instead of waiting for itself
+    static thread_local bool registering_on_this_thread = false;
+    if (registering_on_this_thread)
+        return;
+    // there is no shortcut when the list is empty: another thread may have
+    // taken the list and still be creating the structs in it. the mutex is
+    // held until all of them are created, so waiting for it means that a
+    // lookup on this thread doesn't give up too early. this only runs when a
+    // lookup missed, so the lock doesn't get in the way of the fast path
+    std::lock_guard<std::mutex> lock(register_all_mutex);
+    const LazyStructRegistration * pending = pending_lazy_structs.exchange(nullptr, std::memory_order_acquire);
+    if (!pending)
+        return;
+    registering_on_this_thread = true;
+    struct Reset
+    {
+        ~Reset()
+        {
+            registering_on_this_thread = false;
+        }
+    } reset;
+    // publish one new table after the freeze instead of one per struct
+    LateStructRegistration late_registration;
+    for (; pending; pending = pending->next)
+        pending->get();
+}
+size_t MetaType::GetNumRegisteredStructs()
+{
+    return global_struct_storage.GetNumTypes();
+}
+size_t MetaType::GetNumLazyStructs()
+{
+    return num_lazy_structs.load(std::memory_order_relaxed);
+}
+MetaType::LateStructRegistration::LateStructRegistration()
+{
+    global_struct_storage.BeginLateRegistration();
+}
+MetaType::LateStructRegistration::~LateStructRegistration()
+{
+    global_struct_storage.EndLateRegistration();
 }
 
 int32_t MetaType::EnumInfo::GetAsInt(ConstMetaReference reference) const
@@ -456,6 +680,683 @@ const MetaType::StructInfo::AllMemberCollection & MetaType::StructInfo::GetAllMe
     });
 }
 
+namespace
+{
+template<typename Member>
+MetaType::StructInfo::FlatMemberPlan::Step MemberStep(const Member & member, ptrdiff_t offset)
+{
+    return { MetaType::StructInfo::FlatMemberPlan::Step::Member, offset, member.GetMemberType().GetSize(), &member.GetMemberType(), &member.GetName(), nullptr, nullptr, 0 };
+}
+MetaType::StructInfo::FlatMemberPlan::Step ConditionalStep(const MetaConditionalMember & member, ptrdiff_t base_offset)
+{
+    MetaType::StructInfo::FlatMemberPlan::Step result = MemberStep(member.GetMember(), base_offset + member.GetMember().GetOffset());
+    result.kind = MetaType::StructInfo::FlatMemberPlan::Step::ConditionalMember;
+    result.condition = member.GetCondition();
+    result.condition_struct = &member.GetMember().GetStructType();
+    result.condition_offset = base_offset;
+    return result;
+}
+}
+
+const MetaType::StructInfo::FlatMemberPlan & MetaType::StructInfo::GetFlatMemberPlan(const ClassHeaderList & versions) const
+{
+    return flat_member_plans.get(versions, [&](const ClassHeaderList & versions)
+    {
+        typedef FlatMemberPlan::Step Step;
+        const AllMemberCollection & all = GetAllMembers(versions);
+        FlatMemberPlan plan;
+        for (const auto & member : all.base_members.members)
+            plan.members.push_back(MemberStep(member, member.GetOffset()));
+        for (const auto & member : all.base_members.conditional_members)
+            plan.members.push_back(ConditionalStep(member.GetConditionalMember(), member.GetBaseOffset()));
+        for (const auto & member : all.direct_members.members)
+            plan.members.push_back(MemberStep(member, member.GetOffset()));
+        for (const auto & member : all.direct_members.conditional_members)
+            plan.members.push_back(ConditionalStep(member, 0));
+
+        // merges members that are next to each other into RawBytes steps
+        // if they pass is_raw
+        auto merge_raw_runs = [&](std::vector<Step> & steps, bool (MetaType::*is_raw_type)() const)
+        {
+            for (const Step & step : plan.members)
+            {
+                bool is_raw = step.kind == Step::Member && (step.type->*is_raw_type)();
+                if (is_raw && !steps.empty())
+                {
+                    Step & previous = steps.back();
+                    if (previous.kind == Step::RawBytes && previous.offset + ptrdiff_t(previous.size) == step.offset)
+                    {
+                        previous.size += step.size;
+                        continue;
+                    }
+                }
+                steps.push_back(step);
+                if (is_raw)
+                {
+                    steps.back().kind = Step::RawBytes;
+                    steps.back().type = nullptr;
+                    steps.back().name = nullptr;
+                }
+            }
+        };
+        merge_raw_runs(plan.binary_steps, &MetaType::IsSerializedAsRawBytes);
+        merge_raw_runs(plan.memcpy_steps, &MetaType::IsMemcpySafe);
+
+        std::vector<const Step *> by_offset;
+        for (const Step & step : plan.members)
+            by_offset.push_back(&step);
+        std::sort(by_offset.begin(), by_offset.end(), [](const Step * lhs, const Step * rhs)
+        {
+            return lhs->offset < rhs->offset;
+        });
+        plan.members_are_memcpy_safe = true;
+        for (const Step * step : by_offset)
+        {
+            if (step->kind != Step::Member || step->offset != ptrdiff_t(plan.members_end) || !step->type->IsMemcpySafe())
+            {
+                plan.members_are_memcpy_safe = false;
+                break;
+            }
+            plan.members_end += step->size;
+        }
+        return plan;
+    });
+}
+
+bool MetaType::IsMemcpySafe() const
+{
+    if (!general.is_trivially_copyable)
+        return false;
+    switch (category)
+    {
+    case Bool:
+    case Char:
+    case Int8:
+    case Uint8:
+    case Int16:
+    case Uint16:
+    case Int32:
+    case Uint32:
+    case Int64:
+    case Uint64:
+    case Float:
+    case Double:
+    case Enum:
+        return true;
+    case Array:
+        return array_info.value_type.IsMemcpySafe() && array_info.array_size * array_info.value_type.GetSize() == GetSize();
+    case Struct:
+    {
+        const StructInfo::FlatMemberPlan & plan = struct_info.GetFlatMemberPlan(struct_info.GetCurrentHeaders());
+        return plan.members_are_memcpy_safe && plan.members_end == GetSize();
+    }
+    default:
+        // pointers are trivially copyable, but they own what they point to
+        return false;
+    }
+}
+
+bool MetaType::IsSerializedAsRawBytes() const
+{
+    switch (category)
+    {
+    case Bool:
+    case Char:
+    case Int8:
+    case Uint8:
+    case Int16:
+    case Uint16:
+    case Int32:
+    case Uint32:
+    case Int64:
+    case Uint64:
+    case Float:
+    case Double:
+    case Enum:
+        return true;
+    case Array:
+        return array_info.IsContiguous() && array_info.value_type.IsSerializedAsRawBytes() && array_info.array_size * array_info.value_type.GetSize() == GetSize();
+    default:
+        return false;
+    }
+}
+
+namespace
+{
+uint64_t HashCombine(uint64_t hash, uint64_t value)
+{
+    static constexpr uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+    return ((hash << 5 | hash >> 59) ^ value) * multiplier;
+}
+// a word at a time. the bytes that don't fill a whole word get zero padded,
+// and the size gets mixed in so that trailing zeros still make a difference
+uint64_t HashBytes(uint64_t hash, ArrayView<const unsigned char> bytes)
+{
+    const unsigned char * it = bytes.begin();
+    size_t size = bytes.size();
+    hash = HashCombine(hash, size);
+    for (; size >= sizeof(uint64_t); it += sizeof(uint64_t), size -= sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, it, sizeof(word));
+        hash = HashCombine(hash, word);
+    }
+    if (size)
+    {
+        uint64_t word = 0;
+        memcpy(&word, it, size);
+        hash = HashCombine(hash, word);
+    }
+    return hash;
+}
+bool BytesEqual(ArrayView<const unsigned char> lhs, ArrayView<const unsigned char> rhs)
+{
+    return lhs.size() == rhs.size() && (lhs.empty() || memcmp(lhs.begin(), rhs.begin(), lhs.size()) == 0);
+}
+// the final mix, so that the low bits depend on all of the input. the
+// container hashes add up the hashes of their elements, which needs this
+uint64_t FinishHash(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+template<typename It>
+bool ElementsEqual(const MetaType & value_type, It lhs, It lhs_end, It rhs)
+{
+    for (; lhs != lhs_end; ++lhs, ++rhs)
+    {
+        if (!value_type.Equals(*lhs, *rhs))
+            return false;
+    }
+    return true;
+}
+template<typename It>
+uint64_t HashElements(const MetaType & value_type, uint64_t hash, It begin, It end)
+{
+    for (; begin != end; ++begin)
+        hash = HashCombine(hash, value_type.Hash(*begin));
+    return hash;
+}
+bool ContiguousEqual(const MetaContiguousRange & lhs, const MetaContiguousRange & rhs)
+{
+    if (lhs.size() != rhs.size())
+        return false;
+    if (lhs.GetValueType().IsMemcpySafe())
+        return BytesEqual(lhs.GetMemory(), rhs.GetMemory());
+    return ElementsEqual(lhs.GetValueType(), lhs.begin(), lhs.end(), rhs.begin());
+}
+uint64_t HashContiguous(uint64_t hash, const MetaContiguousRange & range)
+{
+    if (range.GetValueType().IsMemcpySafe())
+        return HashBytes(hash, range.GetMemory());
+    return HashElements(range.GetValueType(), HashCombine(hash, range.size()), range.begin(), range.end());
+}
+
+// sets and maps may be unordered, so two equal ones don't have to iterate in
+// the same order. this gets called if they don't: it groups the elements of
+// rhs by hash and finds a partner for every element of lhs. each partner can
+// only be used once, for the multi containers
+template<typename It, typename GetKey, typename Equal>
+bool UnorderedEqual(It lhs, It lhs_end, It rhs, It rhs_end, const MetaType & key_type, const GetKey & get_key, const Equal & equal)
+{
+    std::vector<std::pair<uint64_t, It>> candidates;
+    for (; rhs != rhs_end; ++rhs)
+        candidates.emplace_back(key_type.Hash(get_key(rhs)), rhs);
+    std::sort(candidates.begin(), candidates.end(), [](const std::pair<uint64_t, It> & a, const std::pair<uint64_t, It> & b)
+    {
+        return a.first < b.first;
+    });
+    std::vector<bool> used(candidates.size(), false);
+    for (; lhs != lhs_end; ++lhs)
+    {
+        uint64_t hash = key_type.Hash(get_key(lhs));
+        auto found = std::lower_bound(candidates.begin(), candidates.end(), hash, [](const std::pair<uint64_t, It> & a, uint64_t hash)
+        {
+            return a.first < hash;
+        });
+        for (;; ++found)
+        {
+            if (found == candidates.end() || found->first != hash)
+                return false;
+            size_t index = found - candidates.begin();
+            if (!used[index] && equal(lhs, found->second))
+            {
+                used[index] = true;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+bool StructEqual(ConstMetaReference lhs, ConstMetaReference rhs)
+{
+    const MetaType::StructInfo & info = *lhs.GetType().GetStructInfo();
+    typedef MetaType::StructInfo::FlatMemberPlan::Step Step;
+    for (const Step & step : info.GetFlatMemberPlan(info.GetCurrentHeaders()).memcpy_steps)
+    {
+        if (step.kind == Step::RawBytes)
+        {
+            if (!BytesEqual(step.GetBytes(lhs), step.GetBytes(rhs)))
+                return false;
+            continue;
+        }
+        bool lhs_has_member = step.ObjectHasMember(lhs);
+        if (lhs_has_member != step.ObjectHasMember(rhs))
+            return false;
+        if (lhs_has_member && !step.type->Equals(step.GetReference(lhs), step.GetReference(rhs)))
+            return false;
+    }
+    return true;
+}
+uint64_t HashStruct(uint64_t hash, ConstMetaReference object)
+{
+    const MetaType::StructInfo & info = *object.GetType().GetStructInfo();
+    typedef MetaType::StructInfo::FlatMemberPlan::Step Step;
+    for (const Step & step : info.GetFlatMemberPlan(info.GetCurrentHeaders()).memcpy_steps)
+    {
+        if (step.kind == Step::RawBytes)
+            hash = HashBytes(hash, step.GetBytes(object));
+        else if (!step.ObjectHasMember(object))
+            hash = HashCombine(hash, 0);
+        else
+            hash = HashCombine(hash, step.type->Hash(step.GetReference(object)));
+    }
+    return hash;
+}
+}
+
+bool MetaType::Equals(ConstMetaReference lhs, ConstMetaReference rhs) const
+{
+    RAW_ASSERT(&lhs.GetType() == this && &rhs.GetType() == this);
+    // some of the infos want a MetaReference even though they only read
+    const MetaReference & lhs_ref = lhs;
+    const MetaReference & rhs_ref = rhs;
+    if (lhs.GetMemory().begin() == rhs.GetMemory().begin())
+        return true;
+    switch (category)
+    {
+    case Bool:
+    case Char:
+    case Int8:
+    case Uint8:
+    case Int16:
+    case Uint16:
+    case Int32:
+    case Uint32:
+    case Int64:
+    case Uint64:
+    case Float:
+    case Double:
+    case Enum:
+        return BytesEqual(lhs.GetMemory(), rhs.GetMemory());
+    case String:
+    {
+        StringView<const char> lhs_string = string_info.GetAsRange(lhs);
+        StringView<const char> rhs_string = string_info.GetAsRange(rhs);
+        return lhs_string.size() == rhs_string.size() && std::equal(lhs_string.begin(), lhs_string.end(), rhs_string.begin());
+    }
+    case List:
+        if (list_info.IsContiguous())
+            return ContiguousEqual(list_info.GetContiguousRange(lhs_ref), list_info.GetContiguousRange(rhs_ref));
+        return list_info.size(lhs) == list_info.size(rhs) && ElementsEqual(list_info.value_type, list_info.begin(lhs_ref), list_info.end(lhs_ref), list_info.begin(rhs_ref));
+    case Array:
+        if (IsMemcpySafe())
+            return BytesEqual(lhs.GetMemory(), rhs.GetMemory());
+        if (array_info.IsContiguous())
+            return ContiguousEqual(array_info.GetContiguousRange(lhs_ref), array_info.GetContiguousRange(rhs_ref));
+        return ElementsEqual(array_info.value_type, array_info.begin(lhs_ref), array_info.end(lhs_ref), array_info.begin(rhs_ref));
+    case Set:
+    {
+        if (set_info.size(lhs) != set_info.size(rhs))
+            return false;
+        // ordered sets can be compared element by element
+        if (ElementsEqual(set_info.value_type, set_info.begin(lhs), set_info.end(lhs), set_info.begin(rhs)))
+            return true;
+        auto get_key = [](const SetInfo::SetIterator & it) { return *it; };
+        return UnorderedEqual(set_info.begin(lhs), set_info.end(lhs), set_info.begin(rhs), set_info.end(rhs), set_info.value_type, get_key, [&](const SetInfo::SetIterator & a, const SetInfo::SetIterator & b)
+        {
+            return set_info.value_type.Equals(*a, *b);
+        });
+    }
+    case Map:
+    {
+        if (map_info.size(lhs) != map_info.size(rhs))
+            return false;
+        auto pair_equal = [&](const MapInfo::MapIterator & a, const MapInfo::MapIterator & b)
+        {
+            return map_info.key_type.Equals(a->first, b->first) && map_info.mapped_type.Equals(a->second, b->second);
+        };
+        bool same_order = true;
+        for (auto a = map_info.begin(lhs), b = map_info.begin(rhs), end = map_info.end(lhs); a != end; ++a, ++b)
+        {
+            if (!pair_equal(a, b))
+            {
+                same_order = false;
+                break;
+            }
+        }
+        if (same_order)
+            return true;
+        auto get_key = [](const MapInfo::MapIterator & it) { return it->first; };
+        return UnorderedEqual(map_info.begin(lhs), map_info.end(lhs), map_info.begin(rhs), map_info.end(rhs), map_info.key_type, get_key, pair_equal);
+    }
+    case Struct:
+        if (IsMemcpySafe())
+            return BytesEqual(lhs.GetMemory(), rhs.GetMemory());
+        return StructEqual(lhs, rhs);
+    case PointerToStruct:
+    {
+        MetaPointer lhs_pointer = pointer_to_struct_info.GetAsPointer(lhs);
+        MetaPointer rhs_pointer = pointer_to_struct_info.GetAsPointer(rhs);
+        if (!lhs_pointer || !rhs_pointer)
+            return !lhs_pointer && !rhs_pointer;
+        const MetaType & lhs_type = lhs_pointer->GetType();
+        return &lhs_type == &rhs_pointer->GetType() && lhs_type.Equals(*lhs_pointer, *rhs_pointer);
+    }
+    case TypeErasure:
+    {
+        const MetaType * lhs_type = type_erasure_info.TargetType(lhs);
+        if (lhs_type != type_erasure_info.TargetType(rhs))
+            return false;
+        return !lhs_type || lhs_type->Equals(type_erasure_info.Target(lhs_ref), type_erasure_info.Target(rhs_ref));
+    }
+    }
+    RAW_THROW(std::runtime_error("unhandled case in the switch above"));
+}
+
+uint64_t MetaType::Hash(ConstMetaReference object) const
+{
+    RAW_ASSERT(&object.GetType() == this);
+    const MetaReference & object_ref = object;
+    uint64_t hash = category;
+    switch (category)
+    {
+    case Bool:
+    case Char:
+    case Int8:
+    case Uint8:
+    case Int16:
+    case Uint16:
+    case Int32:
+    case Uint32:
+    case Int64:
+    case Uint64:
+    case Float:
+    case Double:
+    case Enum:
+        hash = HashBytes(hash, object.GetMemory());
+        break;
+    case String:
+    {
+        StringView<const char> str = string_info.GetAsRange(object);
+        hash = HashBytes(hash, { reinterpret_cast<const unsigned char *>(str.begin()), reinterpret_cast<const unsigned char *>(str.end()) });
+        break;
+    }
+    case List:
+        if (list_info.IsContiguous())
+            hash = HashContiguous(hash, list_info.GetContiguousRange(object_ref));
+        else
+            hash = HashElements(list_info.value_type, HashCombine(hash, list_info.size(object)), list_info.begin(object_ref), list_info.end(object_ref));
+        break;
+    case Array:
+        if (IsMemcpySafe())
+            hash = HashBytes(hash, object.GetMemory());
+        else if (array_info.IsContiguous())
+            hash = HashContiguous(hash, array_info.GetContiguousRange(object_ref));
+        else
+            hash = HashElements(array_info.value_type, hash, array_info.begin(object_ref), array_info.end(object_ref));
+        break;
+    case Set:
+    {
+        // a sum, so that the order doesn't matter
+        uint64_t sum = 0;
+        for (auto it = set_info.begin(object), end = set_info.end(object); it != end; ++it)
+            sum += FinishHash(set_info.value_type.Hash(*it));
+        hash = HashCombine(HashCombine(hash, set_info.size(object)), sum);
+        break;
+    }
+    case Map:
+    {
+        uint64_t sum = 0;
+        for (auto it = map_info.begin(object), end = map_info.end(object); it != end; ++it)
+            sum += FinishHash(HashCombine(map_info.key_type.Hash(it->first), map_info.mapped_type.Hash(it->second)));
+        hash = HashCombine(HashCombine(hash, map_info.size(object)), sum);
+        break;
+    }
+    case Struct:
+        if (IsMemcpySafe())
+            hash = HashBytes(hash, object.GetMemory());
+        else
+            hash = HashStruct(hash, object);
+        break;
+    case PointerToStruct:
+    {
+        MetaPointer pointer = pointer_to_struct_info.GetAsPointer(object);
+        if (pointer)
+            hash = HashCombine(hash, pointer->GetType().Hash(*pointer));
+        break;
+    }
+    case TypeErasure:
+    {
+        const MetaType * target_type = type_erasure_info.TargetType(object);
+        if (target_type)
+            hash = HashCombine(hash, target_type->Hash(type_erasure_info.Target(object_ref)));
+        break;
+    }
+    }
+    return FinishHash(hash);
+}
+
+void MetaType::CopyConstruct(ArrayView<unsigned char> memory, ConstMetaReference other) const
+{
+    RAW_ASSERT(&other.GetType() == this);
+    RAW_ASSERT(general.copy_construct, "the type is not copy constructible");
+    general.copy_construct(memory, other.GetMemory());
+}
+void MetaType::MoveConstruct(ArrayView<unsigned char> memory, MetaReference other) const
+{
+    RAW_ASSERT(&other.GetType() == this);
+    RAW_ASSERT(general.move_construct, "the type is not move constructible");
+    general.move_construct(memory, other.GetMemory());
+}
+
+namespace
+{
+void CopyBytes(ArrayView<unsigned char> target, ArrayView<const unsigned char> source)
+{
+    RAW_ASSERT(target.size() == source.size());
+    if (!source.empty())
+        memcpy(target.begin(), source.begin(), source.size());
+}
+template<typename It>
+void CloneElements(const MetaType & value_type, It target, It source, It source_end)
+{
+    for (; source != source_end; ++source, ++target)
+        value_type.CloneInto(*target, *source);
+}
+void CloneContiguous(const MetaContiguousRange & target, const MetaContiguousRange & source)
+{
+    if (source.GetValueType().IsMemcpySafe())
+        CopyBytes(target.GetMemory(), source.GetMemory());
+    else
+        CloneElements(source.GetValueType(), target.begin(), source.begin(), source.end());
+}
+// true if the copy constructor does the same thing as a clone. structs are
+// only in here if they are memcpy safe, because they may have members that
+// aren't reflected, and the copy constructor would copy those too
+bool CopyIsClone(const MetaType & type)
+{
+    if (type.IsMemcpySafe())
+        return true;
+    switch (type.category)
+    {
+    case MetaType::String:
+        return true;
+    case MetaType::List:
+        return CopyIsClone(type.GetListInfo()->value_type);
+    case MetaType::Array:
+        return CopyIsClone(type.GetArrayInfo()->value_type);
+    case MetaType::Set:
+        return CopyIsClone(type.GetSetInfo()->value_type);
+    case MetaType::Map:
+        return CopyIsClone(type.GetMapInfo()->key_type) && CopyIsClone(type.GetMapInfo()->mapped_type);
+    default:
+        return false;
+    }
+}
+void CloneStruct(MetaReference target, ConstMetaReference source)
+{
+    const MetaType::StructInfo & info = *source.GetType().GetStructInfo();
+    typedef MetaType::StructInfo::FlatMemberPlan::Step Step;
+    for (const Step & step : info.GetFlatMemberPlan(info.GetCurrentHeaders()).memcpy_steps)
+    {
+        if (step.kind == Step::RawBytes)
+            CopyBytes(step.GetBytes(target), step.GetBytes(source));
+        else if (step.ObjectHasMember(source))
+            step.type->CloneInto(step.GetReference(target), step.GetReference(source));
+    }
+}
+}
+
+void MetaType::Clone(ArrayView<unsigned char> memory, ConstMetaReference source) const
+{
+    RAW_ASSERT(&source.GetType() == this);
+    if (IsMemcpySafe())
+        return CopyBytes(memory, source.GetMemory());
+    // the copy constructor can allocate exactly the right amount and copy
+    // into uninitialized memory, which beats resizing and then overwriting
+    if (IsCopyConstructible() && CopyIsClone(*this))
+        return CopyConstruct(memory, source);
+    Construct(memory);
+    try
+    {
+        CloneInto(MetaReference(*this, memory), source);
+    }
+    catch (...)
+    {
+        Destroy(memory);
+        throw;
+    }
+}
+
+void MetaType::CloneInto(MetaReference target, ConstMetaReference source) const
+{
+    RAW_ASSERT(&target.GetType() == this && &source.GetType() == this);
+    const MetaReference & source_ref = source;
+    if (target.GetMemory().begin() == source.GetMemory().begin())
+        return;
+    switch (category)
+    {
+    case Bool:
+    case Char:
+    case Int8:
+    case Uint8:
+    case Int16:
+    case Uint16:
+    case Int32:
+    case Uint32:
+    case Int64:
+    case Uint64:
+    case Float:
+    case Double:
+    case Enum:
+        return CopyBytes(target.GetMemory(), source.GetMemory());
+    case String:
+        return string_info.SetFromRange(target, string_info.GetAsRange(source));
+    case List:
+        list_info.resize(target, list_info.size(source));
+        if (list_info.IsContiguous())
+            return CloneContiguous(list_info.GetContiguousRange(target), list_info.GetContiguousRange(source_ref));
+        return CloneElements(list_info.value_type, list_info.begin(target), list_info.begin(source_ref), list_info.end(source_ref));
+    case Array:
+        if (IsMemcpySafe())
+            return CopyBytes(target.GetMemory(), source.GetMemory());
+        if (array_info.IsContiguous())
+            return CloneContiguous(array_info.GetContiguousRange(target), array_info.GetContiguousRange(source_ref));
+        return CloneElements(array_info.value_type, array_info.begin(target), array_info.begin(source_ref), array_info.end(source_ref));
+    case Set:
+    {
+        // there is no clear(), so start over with an empty set
+        if (set_info.size(target))
+        {
+            Destroy(target.GetMemory());
+            Construct(target.GetMemory());
+        }
+        if (!set_info.size(source))
+            return;
+        const MetaType & value_type = set_info.value_type;
+        MetaScratchAllocator::Buffer buffer = MetaScratchAllocator::ForThisThread().Allocate(value_type);
+        for (auto it = set_info.begin(source), end = set_info.end(source); it != end; ++it)
+        {
+            MetaOwningMemory element(value_type, buffer.GetMemory());
+            value_type.CloneInto(static_cast<MetaReference &>(element), *it);
+            set_info.insert(target, std::move(element));
+        }
+        return;
+    }
+    case Map:
+    {
+        if (map_info.size(target))
+        {
+            Destroy(target.GetMemory());
+            Construct(target.GetMemory());
+        }
+        if (!map_info.size(source))
+            return;
+        const MetaType & key_type = map_info.key_type;
+        const MetaType & mapped_type = map_info.mapped_type;
+        MetaScratchAllocator & allocator = MetaScratchAllocator::ForThisThread();
+        MetaScratchAllocator::Buffer key_buffer = allocator.Allocate(key_type);
+        MetaScratchAllocator::Buffer value_buffer = allocator.Allocate(mapped_type);
+        for (auto it = map_info.begin(source), end = map_info.end(source); it != end; ++it)
+        {
+            MetaOwningMemory key(key_type, key_buffer.GetMemory());
+            MetaOwningMemory value(mapped_type, value_buffer.GetMemory());
+            key_type.CloneInto(static_cast<MetaReference &>(key), it->first);
+            mapped_type.CloneInto(static_cast<MetaReference &>(value), it->second);
+            map_info.insert(target, std::move(key), std::move(value));
+        }
+        return;
+    }
+    case Struct:
+        if (IsMemcpySafe())
+            return CopyBytes(target.GetMemory(), source.GetMemory());
+        return CloneStruct(target, source);
+    case PointerToStruct:
+    {
+        MetaPointer pointer = pointer_to_struct_info.GetAsPointer(source);
+        if (!pointer)
+        {
+            Destroy(target.GetMemory());
+            Construct(target.GetMemory());
+            return;
+        }
+        const MetaType & pointee_type = pointer->GetType();
+        pointee_type.CloneInto(pointer_to_struct_info.AssignNew(target, pointee_type), *pointer);
+        return;
+    }
+    case TypeErasure:
+    {
+        const MetaType * target_type = type_erasure_info.TargetType(source);
+        if (!target_type)
+        {
+            Destroy(target.GetMemory());
+            Construct(target.GetMemory());
+            return;
+        }
+        target_type->CloneInto(type_erasure_info.AssignNew(target, *target_type), type_erasure_info.Target(source_ref));
+        return;
+    }
+    }
+    RAW_THROW(std::runtime_error("unhandled case in the switch above"));
+}
+
 const BaseClass::BaseMemberCollection & BaseClass::GetMembers(const ClassHeaderList & versions) const
 {
     return members.get(versions, [&](const ClassHeaderList & versions)
@@ -512,26 +1413,38 @@ const BaseClass::BaseMemberCollection & BaseClass::GetMembers(const ClassHeaderL
 
 #define CreateSimpleType(cpp_type, meta_tag)\
 template<>\
-const MetaType MetaType::MetaTypeConstructor<cpp_type>::type = MetaType::RegisterSimple<cpp_type>(MetaType::meta_tag)
-CreateSimpleType(bool, Bool);
-CreateSimpleType(char, Char);
-CreateSimpleType(int8_t, Int8);
-CreateSimpleType(uint8_t, Uint8);
-CreateSimpleType(int16_t, Int16);
-CreateSimpleType(uint16_t, Uint16);
-CreateSimpleType(int, Int32);
-CreateSimpleType(unsigned, Uint32);
-CreateSimpleType(long, Int64);
-CreateSimpleType(unsigned long, Uint64);
-CreateSimpleType(long long, Int64);
-CreateSimpleType(unsigned long long, Uint64);
-CreateSimpleType(float, Float);
-CreateSimpleType(double, Double);
+const MetaType & MetaType::MetaTypeConstructor<cpp_type>::Get()\
+{\
+    static const MetaType type = MetaType::RegisterSimple<cpp_type>(MetaType::meta_tag);\
+    return type;\
+}
+CreateSimpleType(bool, Bool)
+CreateSimpleType(char, Char)
+CreateSimpleType(int8_t, Int8)
+CreateSimpleType(uint8_t, Uint8)
+CreateSimpleType(int16_t, Int16)
+CreateSimpleType(uint16_t, Uint16)
+CreateSimpleType(int, Int32)
+CreateSimpleType(unsigned, Uint32)
+CreateSimpleType(long, Int64)
+CreateSimpleType(unsigned long, Uint64)
+CreateSimpleType(long long, Int64)
+CreateSimpleType(unsigned long long, Uint64)
+CreateSimpleType(float, Float)
+CreateSimpleType(double, Double)
 #undef CreateSimpleType
 template<>
-const MetaType MetaType::MetaTypeConstructor<StringView<const char> >::type = MetaType::RegisterString<StringView<const char> >();
+const MetaType & MetaType::MetaTypeConstructor<StringView<const char> >::Get()
+{
+    static const MetaType type = MetaType::RegisterString<StringView<const char> >();
+    return type;
+}
 template<>
-const MetaType MetaType::MetaTypeConstructor<std::string>::type = MetaType::RegisterString<std::string>();
+const MetaType & MetaType::MetaTypeConstructor<std::string>::Get()
+{
+    static const MetaType type = MetaType::RegisterString<std::string>();
+    return type;
+}
 template<>
 struct MetaType::StringInfo::Specialization<std::string>
 {
@@ -693,6 +1606,18 @@ ClassHeaderList::const_iterator ClassHeaderList::find(const ReflectionHashedStri
     return const_cast<ClassHeaderList &>(*this).find(class_name);
 }
 
+size_t ClassHeaderListHash::operator()(const ClassHeaderList & headers) const
+{
+    // the names are already hashed, so this only has to mix those
+    size_t result = headers.size();
+    for (const ClassHeader & header : headers)
+    {
+        size_t hash = size_t(header.GetClassName().get_hash()) * 31 + uint8_t(header.GetVersion());
+        result ^= hash + 0x9e3779b9 + (result << 6) + (result >> 2);
+    }
+    return result;
+}
+
 
 BaseClass::BaseClass(const MetaType & base, const MetaType & derived, ptrdiff_t offset)
     : base(&base), derived(&derived), offset(offset)
@@ -718,6 +1643,9 @@ BaseClass BaseClass::Combine(const BaseClass & basebase, const BaseClass & base)
 #include <algorithm>
 #include "os/memoryManager.hpp"
 #include <array>
+#include <thread>
+#include <chrono>
+#include <limits>
 
 using namespace metav3;
 
@@ -766,6 +1694,32 @@ TEST(new_meta, deque)
     }
 }
 
+TEST(new_meta, list_resize)
+{
+    std::vector<int> a_list = { 1, 2, 3 };
+    MetaReference variant(a_list);
+    const MetaType::ListInfo * info = variant.GetType().GetListInfo();
+    ASSERT_TRUE(info->IsContiguous());
+    info->reserve(variant, 100);
+    ASSERT_LE(100u, a_list.capacity());
+    info->resize(variant, 5);
+    ASSERT_EQ((std::vector<int>{ 1, 2, 3, 0, 0 }), a_list);
+    ASSERT_EQ(reinterpret_cast<unsigned char *>(a_list.data()), info->data(variant));
+    info->GetElement(variant, 4).Get<int>() = 5;
+    ASSERT_EQ(5, a_list[4]);
+
+    std::deque<int> a_deque = { 1, 2, 3 };
+    MetaReference deque_variant(a_deque);
+    info = deque_variant.GetType().GetListInfo();
+    ASSERT_FALSE(info->IsContiguous());
+    // does nothing, but shouldn't crash either
+    info->reserve(deque_variant, 100);
+    info->resize(deque_variant, 2);
+    info->resize(deque_variant, 4);
+    info->GetElement(deque_variant, 3).Get<int>() = 4;
+    ASSERT_EQ((std::deque<int>{ 1, 2, 0, 4 }), a_deque);
+}
+
 TEST(new_meta, string_list)
 {
     std::vector<std::string> a_list = { "bar", "baz", "foo", "really_long_string_without_small_string_optimization" };
@@ -1037,24 +1991,18 @@ struct too_large
 
     unsigned char stuff[1024];
 };
-struct small_struct
-{
-    small_struct(int i = 0)
-        : i(i)
-    {
-    }
-
-    int i;
-};
 static MetaType::StructInfo::MembersAndBases CreateEmptyMemberCollection(int8_t)
 {
     return {{{}, {}}, {{}}};
 }
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<too_large>::type = MetaType::RegisterStruct<too_large>("testing_too_large", 0, &CreateEmptyMemberCollection);
-template<>
-const MetaType MetaType::MetaTypeConstructor<small_struct>::type = MetaType::RegisterStruct<small_struct>("testing_small_struct", 0, &CreateEmptyMemberCollection);
+const MetaType & MetaType::MetaTypeConstructor<too_large>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<too_large>("testing_too_large", 0, &CreateEmptyMemberCollection);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_too_large(&MetaType::MetaTypeConstructor<too_large>::Get);
 namespace
 {
 struct struct_with_members
@@ -1090,7 +2038,12 @@ static MetaType::StructInfo::MembersAndBases get_struct_with_members_members(int
 }
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<struct_with_members>::type = MetaType::RegisterStruct<struct_with_members>("testing_struct_with_members", 0, &get_struct_with_members_members);
+const MetaType & MetaType::MetaTypeConstructor<struct_with_members>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<struct_with_members>("testing_struct_with_members", 0, &get_struct_with_members_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_struct_with_members(&MetaType::MetaTypeConstructor<struct_with_members>::Get);
 namespace
 {
 TEST(new_meta, members)
@@ -1170,7 +2123,11 @@ float * begin(AVector3Type & vector)
 }
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<AVector3Type>::type = MetaType::RegisterArray<AVector3Type>(GetMetaType<float>(), 3);
+const MetaType & MetaType::MetaTypeConstructor<AVector3Type>::Get()
+{
+    static const MetaType type = MetaType::RegisterArray<AVector3Type>(GetMetaType<float>(), 3);
+    return type;
+}
 namespace
 {
 TEST(new_meta, custom_array)
@@ -1190,6 +2147,37 @@ TEST(new_meta, custom_array)
         ASSERT_EQ(info->end(as_variant), begin);
     }
 }
+TEST(new_meta, contiguous_range)
+{
+    int a[3] = { 1, 2, 3 };
+    MetaReference array_variant(a);
+    const MetaType::ArrayInfo * array_info = array_variant.GetType().GetArrayInfo();
+    ASSERT_TRUE(array_info->IsContiguous());
+    MetaContiguousRange array_range = array_info->GetContiguousRange(array_variant);
+    ASSERT_EQ(3u, array_range.size());
+    ASSERT_EQ(reinterpret_cast<unsigned char *>(a), array_range.GetMemory().begin());
+    ASSERT_EQ(sizeof(a), array_range.GetMemory().size());
+    int sum = 0;
+    for (MetaReference element : array_range)
+        sum += element.Get<int>();
+    ASSERT_EQ(6, sum);
+
+    AVector3Type vec = { 3.0f, 2.0f, 1.0f };
+    MetaReference vec_variant(vec);
+    const MetaType::ArrayInfo * vec_info = vec_variant.GetType().GetArrayInfo();
+    ASSERT_TRUE(vec_info->IsContiguous());
+    ASSERT_EQ(1.0f, vec_info->GetContiguousRange(vec_variant)[2].Get<float>());
+
+    std::vector<std::string> list = { "a", "b" };
+    MetaReference list_variant(list);
+    MetaContiguousRange list_range = list_variant.GetType().GetListInfo()->GetContiguousRange(list_variant);
+    ASSERT_EQ(2u, list_range.size());
+    ASSERT_EQ("b", list_range[1].Get<std::string>());
+    ASSERT_EQ("a", (*list_range.begin()).Get<std::string>());
+
+    std::deque<int> not_contiguous;
+    ASSERT_FALSE(MetaReference(not_contiguous).GetType().GetListInfo()->IsContiguous());
+}
 
 TEST(new_meta, nested_array)
 {
@@ -1223,7 +2211,11 @@ enum ABC
 };
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<ABC>::type = MetaType::RegisterEnum<ABC>({ { A, "A" }, { B, "B" }, { C, "C" } });
+const MetaType & MetaType::MetaTypeConstructor<ABC>::Get()
+{
+    static const MetaType type = MetaType::RegisterEnum<ABC>({ { A, "A" }, { B, "B" }, { C, "C" } });
+    return type;
+}
 namespace
 {
 TEST(new_meta, enum)
@@ -1288,11 +2280,26 @@ static MetaType::StructInfo::MembersAndBases get_derived_struct_info(int8_t)
 }
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<base_struct_a>::type = MetaType::RegisterStruct<base_struct_a>("base_struct_a", 0, &get_base_struct_a_members);
+const MetaType & MetaType::MetaTypeConstructor<base_struct_a>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<base_struct_a>("base_struct_a", 0, &get_base_struct_a_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_base_struct_a(&MetaType::MetaTypeConstructor<base_struct_a>::Get);
 template<>
-const MetaType MetaType::MetaTypeConstructor<base_struct_b>::type = MetaType::RegisterStruct<base_struct_b>("base_struct_b", 0, &get_base_struct_b_members);
+const MetaType & MetaType::MetaTypeConstructor<base_struct_b>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<base_struct_b>("base_struct_b", 0, &get_base_struct_b_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_base_struct_b(&MetaType::MetaTypeConstructor<base_struct_b>::Get);
 template<>
-const MetaType MetaType::MetaTypeConstructor<derived_struct>::type = MetaType::RegisterStruct<derived_struct>("derived_struct", 0, &get_derived_struct_info);
+const MetaType & MetaType::MetaTypeConstructor<derived_struct>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<derived_struct>("derived_struct", 0, &get_derived_struct_info);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_derived_struct(&MetaType::MetaTypeConstructor<derived_struct>::Get);
 namespace
 {
 TEST(new_meta, derived)
@@ -1326,6 +2333,49 @@ TEST(new_meta, derived)
     ASSERT_EQ(derived.a + derived.b + derived.c, sum);
 }
 
+TEST(new_meta, flat_member_plan)
+{
+    const MetaType::StructInfo & info = *GetMetaType<derived_struct>().GetStructInfo();
+    typedef MetaType::StructInfo::FlatMemberPlan::Step Step;
+    const MetaType::StructInfo::FlatMemberPlan & plan = info.GetFlatMemberPlan(info.GetCurrentHeaders());
+    ASSERT_EQ(&plan, &info.GetFlatMemberPlan(info.GetCurrentHeaders()));
+    ASSERT_EQ(3u, plan.members.size());
+    derived_struct derived(5, 6, 7);
+    MetaReference as_meta(derived);
+    ASSERT_EQ("a", plan.members[0].GetName());
+    ASSERT_EQ(5, plan.members[0].GetReference(as_meta).Get<int>());
+    ASSERT_EQ("b", plan.members[1].GetName());
+    ASSERT_EQ(6, plan.members[1].GetReference(as_meta).Get<int>());
+    ASSERT_EQ("c", plan.members[2].GetName());
+    ASSERT_EQ(7, plan.members[2].GetReference(as_meta).Get<int>());
+    // the three ints are next to each other, so they can be copied at once
+    ASSERT_EQ(1u, plan.binary_steps.size());
+    ASSERT_EQ(Step::RawBytes, plan.binary_steps[0].kind);
+    ASSERT_EQ(0, plan.binary_steps[0].offset);
+    ASSERT_EQ(sizeof(derived_struct), plan.binary_steps[0].size);
+}
+
+TEST(new_meta, memcpy_safe)
+{
+    ASSERT_TRUE(GetMetaType<int>().IsMemcpySafe());
+    ASSERT_TRUE(GetMetaType<float[4]>().IsMemcpySafe());
+    ASSERT_TRUE(GetMetaType<derived_struct>().IsMemcpySafe());
+    ASSERT_TRUE(GetMetaType<derived_struct[2]>().IsMemcpySafe());
+    ASSERT_FALSE(GetMetaType<std::string>().IsMemcpySafe());
+    ASSERT_FALSE(GetMetaType<std::vector<int>>().IsMemcpySafe());
+    // has members that aren't memcpy safe
+    ASSERT_FALSE(GetMetaType<struct_with_members>().IsMemcpySafe());
+    // the bytes of the struct don't belong to any reflected member
+    ASSERT_FALSE(GetMetaType<too_large>().IsMemcpySafe());
+
+    ASSERT_TRUE(GetMetaType<int>().IsSerializedAsRawBytes());
+    ASSERT_TRUE(GetMetaType<float[4]>().IsSerializedAsRawBytes());
+    ASSERT_TRUE(GetMetaType<AVector3Type>().IsSerializedAsRawBytes());
+    // structs start with their name and version
+    ASSERT_FALSE(GetMetaType<derived_struct>().IsSerializedAsRawBytes());
+    ASSERT_FALSE(GetMetaType<derived_struct[2]>().IsSerializedAsRawBytes());
+}
+
 struct base_struct_d
 {
     base_struct_d(int d = 0)
@@ -1363,9 +2413,19 @@ static MetaType::StructInfo::MembersAndBases get_derived_derived_info(int8_t)
 }
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<base_struct_d>::type = MetaType::RegisterStruct<base_struct_d>("base_struct_d", 0, &get_base_struct_d_members);
+const MetaType & MetaType::MetaTypeConstructor<base_struct_d>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<base_struct_d>("base_struct_d", 0, &get_base_struct_d_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_base_struct_d(&MetaType::MetaTypeConstructor<base_struct_d>::Get);
 template<>
-const MetaType MetaType::MetaTypeConstructor<derived_derived>::type = MetaType::RegisterStruct<derived_derived>("derived_derived", 0, &get_derived_derived_info);
+const MetaType & MetaType::MetaTypeConstructor<derived_derived>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<derived_derived>("derived_derived", 0, &get_derived_derived_info);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_derived_derived(&MetaType::MetaTypeConstructor<derived_derived>::Get);
 namespace
 {
 TEST(new_meta, derived_two_levels)
@@ -1430,7 +2490,12 @@ static MetaType::StructInfo::MembersAndBases get_derived_derived_derived_info(in
 }
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<derived_derived_derived>::type = MetaType::RegisterStruct<derived_derived_derived>("derived_derived_derived", 0, &get_derived_derived_derived_info);
+const MetaType & MetaType::MetaTypeConstructor<derived_derived_derived>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<derived_derived_derived>("derived_derived_derived", 0, &get_derived_derived_derived_info);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_derived_derived_derived(&MetaType::MetaTypeConstructor<derived_derived_derived>::Get);
 namespace
 {
 TEST(new_meta, derived_three_levels)
@@ -1501,11 +2566,26 @@ static MetaType::StructInfo::MembersAndBases get_pointer_to_struct_derived_membe
 }
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<pointer_to_struct_base>::type = MetaType::RegisterStruct<pointer_to_struct_base>("pointer_to_struct_base", 0, &get_pointer_to_struct_base_members);
+const MetaType & MetaType::MetaTypeConstructor<pointer_to_struct_base>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<pointer_to_struct_base>("pointer_to_struct_base", 0, &get_pointer_to_struct_base_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_pointer_to_struct_base(&MetaType::MetaTypeConstructor<pointer_to_struct_base>::Get);
 template<>
-const MetaType MetaType::MetaTypeConstructor<pointer_to_struct_offsetting_base>::type = MetaType::RegisterStruct<pointer_to_struct_offsetting_base>("pointer_to_struct_offsetting_base", 0, &get_pointer_to_struct_offsetting_base_members);
+const MetaType & MetaType::MetaTypeConstructor<pointer_to_struct_offsetting_base>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<pointer_to_struct_offsetting_base>("pointer_to_struct_offsetting_base", 0, &get_pointer_to_struct_offsetting_base_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_pointer_to_struct_offsetting_base(&MetaType::MetaTypeConstructor<pointer_to_struct_offsetting_base>::Get);
 template<>
-const MetaType MetaType::MetaTypeConstructor<pointer_to_struct_derived>::type = MetaType::RegisterStruct<pointer_to_struct_derived>("pointer_to_struct_derived", 0, &get_pointer_to_struct_derived_members);
+const MetaType & MetaType::MetaTypeConstructor<pointer_to_struct_derived>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<pointer_to_struct_derived>("pointer_to_struct_derived", 0, &get_pointer_to_struct_derived_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_pointer_to_struct_derived(&MetaType::MetaTypeConstructor<pointer_to_struct_derived>::Get);
 namespace
 {
 TEST(new_meta, pointer_to_struct)
@@ -1543,6 +2623,75 @@ TEST(new_meta, pointer_to_struct)
     ASSERT_EQ(ptr->a + d.b + d.c, sum);
 }
 
+TEST(new_meta, equals_and_hash)
+{
+    auto equal_and_same_hash = [](auto lhs, auto rhs)
+    {
+        const MetaType & type = GetMetaType<decltype(lhs)>();
+        return type.Equals(lhs, rhs) && type.Hash(lhs) == type.Hash(rhs);
+    };
+    auto different = [](auto lhs, auto rhs)
+    {
+        return !GetMetaType<decltype(lhs)>().Equals(lhs, rhs);
+    };
+    ASSERT_TRUE(equal_and_same_hash(5, 5));
+    ASSERT_TRUE(different(5, 6));
+    // numbers are compared by their bytes
+    ASSERT_TRUE(different(0.0f, -0.0f));
+    ASSERT_TRUE(equal_and_same_hash(std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::quiet_NaN()));
+    ASSERT_TRUE(equal_and_same_hash(std::string("foo"), std::string("foo")));
+    ASSERT_TRUE(different(std::string("foo"), std::string("fooo")));
+    // memcpy safe
+    ASSERT_TRUE(equal_and_same_hash(derived_struct(1, 2, 3), derived_struct(1, 2, 3)));
+    ASSERT_TRUE(different(derived_struct(1, 2, 3), derived_struct(1, 2, 4)));
+    // not memcpy safe because of the vector
+    ASSERT_TRUE(equal_and_same_hash(struct_with_members(1, 2.0f), struct_with_members(1, 2.0f)));
+    struct_with_members longer(1, 2.0f);
+    longer.c.push_back(3);
+    ASSERT_TRUE(different(struct_with_members(1, 2.0f), longer));
+    ASSERT_TRUE(equal_and_same_hash(std::vector<std::string>{ "a", "b" }, std::vector<std::string>{ "a", "b" }));
+    ASSERT_TRUE(different(std::vector<std::string>{ "a", "b" }, std::vector<std::string>{ "a", "c" }));
+    ASSERT_TRUE(equal_and_same_hash(std::deque<int>{ 1, 2 }, std::deque<int>{ 1, 2 }));
+    ASSERT_TRUE(different(std::deque<int>{ 1, 2 }, std::deque<int>{ 1 }));
+
+    // unordered containers are equal no matter in which order they iterate
+    std::unordered_set<std::string> many_strings;
+    std::unordered_set<std::string> reversed;
+    many_strings.reserve(1);
+    for (int i = 0; i < 100; ++i)
+        many_strings.insert(std::to_string(i));
+    reversed.reserve(1000);
+    for (int i = 99; i >= 0; --i)
+        reversed.insert(std::to_string(i));
+    ASSERT_TRUE(equal_and_same_hash(many_strings, reversed));
+    reversed.erase("50");
+    reversed.insert("100");
+    ASSERT_TRUE(different(many_strings, reversed));
+    ASSERT_TRUE(equal_and_same_hash(std::unordered_multiset<int>{ 1, 1, 2 }, std::unordered_multiset<int>{ 2, 1, 1 }));
+    ASSERT_TRUE(different(std::unordered_multiset<int>{ 1, 1, 2 }, std::unordered_multiset<int>{ 1, 2, 2 }));
+    ASSERT_TRUE(equal_and_same_hash(std::map<std::string, int>{ { "a", 1 } }, std::map<std::string, int>{ { "a", 1 } }));
+    ASSERT_TRUE(different(std::map<std::string, int>{ { "a", 1 } }, std::map<std::string, int>{ { "a", 2 } }));
+    ASSERT_TRUE(different(std::unordered_map<int, int>{ { 1, 1 }, { 2, 2 } }, std::unordered_map<int, int>{ { 1, 2 }, { 2, 1 } }));
+
+    // pointers are compared by what they point to
+    std::unique_ptr<pointer_to_struct_base> lhs(new pointer_to_struct_derived(5, 6, 7));
+    std::unique_ptr<pointer_to_struct_base> rhs(new pointer_to_struct_derived(5, 6, 7));
+    std::unique_ptr<pointer_to_struct_base> base_only(new pointer_to_struct_base(5));
+    std::unique_ptr<pointer_to_struct_base> null;
+    const MetaType & pointer_type = GetMetaType<std::unique_ptr<pointer_to_struct_base>>();
+    ASSERT_TRUE(pointer_type.Equals(lhs, rhs));
+    ASSERT_EQ(pointer_type.Hash(lhs), pointer_type.Hash(rhs));
+    ASSERT_FALSE(pointer_type.Equals(lhs, base_only));
+    ASSERT_FALSE(pointer_type.Equals(lhs, null));
+    ASSERT_TRUE(pointer_type.Equals(null, null));
+
+    std::unordered_set<struct_with_members, ReflectedHash<struct_with_members>, ReflectedEqual<struct_with_members>> index;
+    index.insert(struct_with_members(1, 2.0f));
+    index.insert(struct_with_members(1, 2.0f));
+    index.insert(struct_with_members(2, 2.0f));
+    ASSERT_EQ(2u, index.size());
+}
+
 struct ATypeErasure : BaseTypeErasure<sizeof(void *), CopyVTable>
 {
     using BaseTypeErasure<sizeof(void *), CopyVTable>::BaseTypeErasure;
@@ -1551,7 +2700,11 @@ struct ATypeErasure : BaseTypeErasure<sizeof(void *), CopyVTable>
 namespace metav3
 {
 template<>
-const MetaType MetaType::MetaTypeConstructor<ATypeErasure>::type = MetaType::RegisterTypeErasure<ATypeErasure>();
+const MetaType & MetaType::MetaTypeConstructor<ATypeErasure>::Get()
+{
+    static const MetaType type = MetaType::RegisterTypeErasure<ATypeErasure>();
+    return type;
+}
 }
 namespace
 {
@@ -1572,6 +2725,260 @@ TEST(new_meta, type_erasure)
     ASSERT_TRUE(new_inner_info);
     ASSERT_EQ(0, new_inner.Get<base_struct_a>().a);
 }
+
+TEST(new_meta, copy_and_clone)
+{
+    // structs only get a copy constructor if it's trivial, they get copied
+    // with Clone
+    const MetaType & type = GetMetaType<struct_with_members>();
+    ASSERT_FALSE(type.IsCopyConstructible());
+    ASSERT_TRUE(type.IsMoveConstructible());
+    const MetaType & vector_type = GetMetaType<std::vector<int>>();
+    ASSERT_TRUE(vector_type.IsCopyConstructible());
+    std::vector<int> numbers = { 1, 2, 3 };
+    alignas(std::vector<int>) unsigned char vector_storage[sizeof(std::vector<int>)];
+    vector_type.CopyConstruct({ vector_storage, vector_storage + sizeof(vector_storage) }, numbers);
+    ASSERT_EQ(numbers, reinterpret_cast<std::vector<int> &>(vector_storage));
+    vector_type.Destroy({ vector_storage, vector_storage + sizeof(vector_storage) });
+    struct_with_members original(1, 2.0f);
+    original.c.push_back(3);
+    alignas(struct_with_members) unsigned char storage[sizeof(struct_with_members)];
+    ArrayView<unsigned char> memory(storage, storage + sizeof(storage));
+    type.Clone(memory, original);
+    ASSERT_TRUE(type.Equals(original, MetaReference(type, memory)));
+    type.Destroy(memory);
+    type.MoveConstruct(memory, original);
+    ASSERT_EQ(3u, reinterpret_cast<struct_with_members &>(storage).c.size());
+    ASSERT_TRUE(original.c.empty());
+    type.Destroy(memory);
+
+    // a unique_ptr can't be copied, but it can be cloned
+    const MetaType & pointers_type = GetMetaType<std::vector<std::unique_ptr<base_struct_a>>>();
+    ASSERT_FALSE(pointers_type.IsCopyConstructible());
+    ASSERT_TRUE(pointers_type.IsMoveConstructible());
+    std::vector<std::unique_ptr<base_struct_a>> pointers;
+    pointers.emplace_back(new base_struct_a(5));
+    pointers.emplace_back();
+    std::vector<std::unique_ptr<base_struct_a>> cloned_pointers;
+    cloned_pointers.emplace_back();
+    cloned_pointers.emplace_back(new base_struct_a(6));
+    cloned_pointers.emplace_back(new base_struct_a(7));
+    pointers_type.CloneInto(cloned_pointers, pointers);
+    ASSERT_TRUE(pointers_type.Equals(pointers, cloned_pointers));
+    ASSERT_NE(pointers[0].get(), cloned_pointers[0].get());
+
+    // cloning into something that isn't empty replaces what's there
+    auto clone_into = [](auto & target, const auto & source)
+    {
+        const MetaType & type = GetMetaType<typename std::remove_reference<decltype(target)>::type>();
+        type.CloneInto(target, source);
+        return type.Equals(target, source);
+    };
+    std::map<std::string, std::vector<std::string>> map = { { "a", { "b", "c" } }, { "d", {} } };
+    std::map<std::string, std::vector<std::string>> cloned_map = { { "e", { "f" } } };
+    ASSERT_TRUE(clone_into(cloned_map, map));
+    std::unordered_multiset<int> set = { 1, 1, 2 };
+    std::unordered_multiset<int> cloned_set = { 3 };
+    ASSERT_TRUE(clone_into(cloned_set, set));
+    std::deque<struct_with_members> deque = { struct_with_members(1, 2.0f), struct_with_members(3, 4.0f) };
+    std::deque<struct_with_members> cloned_deque;
+    ASSERT_TRUE(clone_into(cloned_deque, deque));
+    std::string strings[2] = { "foo", "bar" };
+    std::string cloned_strings[2];
+    ASSERT_TRUE(clone_into(cloned_strings, strings));
+    derived_struct memcpy_safe(1, 2, 3);
+    derived_struct cloned_memcpy_safe;
+    ASSERT_TRUE(clone_into(cloned_memcpy_safe, memcpy_safe));
+
+    MetaType::TypeErasureInfo::SupportedType<ATypeErasure, base_struct_a> support;
+    ATypeErasure type_erasure((base_struct_a(5)));
+    ATypeErasure cloned_type_erasure;
+    ASSERT_TRUE(clone_into(cloned_type_erasure, type_erasure));
+    ASSERT_EQ(5, cloned_type_erasure.target<base_struct_a>()->a);
+}
+
+// the implicit copy constructor of this one exists but doesn't compile, so
+// just registering it used to be a compile error
+struct holder_of_unique_ptrs
+{
+    std::vector<std::unique_ptr<int>> values;
+};
+static MetaType::StructInfo::MembersAndBases get_holder_of_unique_ptrs_members(int8_t)
+{
+    return
+    {
+        {
+            {
+                MetaMember("values", &holder_of_unique_ptrs::values)
+            },
+            {
+            }
+        },
+        {
+            {
+            }
+        }
+    };
+}
+}
+template<>
+const MetaType & MetaType::MetaTypeConstructor<holder_of_unique_ptrs>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<holder_of_unique_ptrs>("testing_holder_of_unique_ptrs", 0, &get_holder_of_unique_ptrs_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_holder_of_unique_ptrs(&MetaType::MetaTypeConstructor<holder_of_unique_ptrs>::Get);
+namespace
+{
+TEST(new_meta, struct_with_uncopyable_members)
+{
+    const MetaType & type = GetMetaType<holder_of_unique_ptrs>();
+    ASSERT_FALSE(type.IsCopyConstructible());
+    ASSERT_TRUE(type.IsMoveConstructible());
+    ASSERT_FALSE(GetMetaType<std::vector<holder_of_unique_ptrs>>().IsCopyConstructible());
+    ASSERT_FALSE((GetMetaType<std::array<holder_of_unique_ptrs, 2>>().IsCopyConstructible()));
+}
+
+// this one doesn't have a LazyStructRegistration, so it gets created by the
+// first GetMetaType in the test below
+struct registered_after_freeze
+{
+};
+}
+template<>
+const MetaType & MetaType::MetaTypeConstructor<registered_after_freeze>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<registered_after_freeze>("testing_registered_after_freeze", 0, &CreateEmptyMemberCollection);
+    return type;
+}
+namespace
+{
+TEST(new_meta, frozen_struct_registry)
+{
+    MetaType::FreezeStructRegistry();
+    const MetaType & derived = GetMetaType<derived_struct>();
+    const ReflectionHashedString & name = derived.GetStructInfo()->GetName();
+    ASSERT_EQ(&derived, &MetaType::GetStructType(typeid(derived_struct)));
+    ASSERT_EQ(&derived, &MetaType::GetStructType(name));
+    ASSERT_EQ(&derived, &MetaType::GetRegisteredStruct(name.get_hash()));
+    ASSERT_EQ(name, MetaType::GetRegisteredStructName(StringView<const char>("derived_struct")));
+    ASSERT_THROW(MetaType::GetStructType(ReflectionHashedString("not_registered")), std::runtime_error);
+
+    {
+        // a late registration would usually come from loading a shared
+        // library in here
+        MetaType::LateStructRegistration registration;
+        ASSERT_EQ(&derived, &MetaType::GetStructType(name));
+    }
+    ASSERT_EQ(&derived, &MetaType::GetStructType(typeid(derived_struct)));
+    // one struct after the freeze doesn't rebuild the table, but it still
+    // has to be found
+    const MetaType & late = GetMetaType<registered_after_freeze>();
+    ASSERT_EQ(&late, &MetaType::GetStructType(typeid(registered_after_freeze)));
+    ASSERT_EQ(&late, &MetaType::GetStructType(late.GetStructInfo()->GetName()));
+    ASSERT_EQ(&late, &MetaType::GetRegisteredStruct(late.GetStructInfo()->GetName().get_hash()));
+
+    // the lookups don't block each other any more
+    std::vector<std::thread> threads;
+    std::atomic<int> num_wrong(0);
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&]
+        {
+            for (int j = 0; j < 10000; ++j)
+            {
+                if (&MetaType::GetStructType(typeid(derived_struct)) != &derived || &MetaType::GetRegisteredStruct(name.get_hash()) != &derived)
+                    ++num_wrong;
+            }
+        });
+    }
+    for (std::thread & thread : threads)
+        thread.join();
+    ASSERT_EQ(0, num_wrong.load());
+}
+
+struct lazily_registered
+{
+};
+}
+template<>
+const MetaType & MetaType::MetaTypeConstructor<lazily_registered>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<lazily_registered>("testing_lazily_registered", 0, &CreateEmptyMemberCollection);
+    return type;
+}
+namespace
+{
+
+TEST(new_meta, lazy_struct_registration)
+{
+    // whatever else is still pending would get created by the lookup below
+    MetaType::RegisterAllStructs();
+    size_t num_registered = MetaType::GetNumRegisteredStructs();
+    size_t num_lazy = MetaType::GetNumLazyStructs();
+    // this would usually be a global, but then an earlier test could have
+    // created it already
+    static const MetaType::LazyStructRegistration registration(&MetaType::MetaTypeConstructor<lazily_registered>::Get);
+    ASSERT_EQ(num_lazy + 1, MetaType::GetNumLazyStructs());
+    ASSERT_EQ(num_registered, MetaType::GetNumRegisteredStructs());
+    // the lookup doesn't find it at first, so it registers everything that's
+    // still pending and then tries again
+    const MetaType & type = MetaType::GetStructType(ReflectionHashedString("testing_lazily_registered"));
+    ASSERT_EQ(&GetMetaType<lazily_registered>(), &type);
+    ASSERT_EQ(num_registered + 1, MetaType::GetNumRegisteredStructs());
+    ASSERT_EQ(&type, &MetaType::GetRegisteredStruct(type.GetStructInfo()->GetName().get_hash()));
+    ASSERT_EQ(&type, &MetaType::GetStructType(typeid(lazily_registered)));
+    MetaType::RegisterAllStructs();
+    ASSERT_EQ(num_registered + 1, MetaType::GetNumRegisteredStructs());
+}
+
+// the first one takes a while to create, so that a lookup for the second one
+// comes in while a different thread is still in RegisterAllStructs
+struct slow_to_create
+{
+};
+struct created_after_slow_one
+{
+};
+std::atomic<bool> started_creating_slow_one(false);
+}
+template<>
+const MetaType & MetaType::MetaTypeConstructor<slow_to_create>::Get()
+{
+    struct Created
+    {
+        Created()
+            : type((started_creating_slow_one = true, std::this_thread::sleep_for(std::chrono::milliseconds(50)), MetaType::RegisterStruct<slow_to_create>("testing_slow_to_create", 0, &CreateEmptyMemberCollection)))
+        {
+        }
+        const MetaType type;
+    };
+    static const Created created;
+    return created.type;
+}
+template<>
+const MetaType & MetaType::MetaTypeConstructor<created_after_slow_one>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<created_after_slow_one>("testing_created_after_slow_one", 0, &CreateEmptyMemberCollection);
+    return type;
+}
+namespace
+{
+TEST(new_meta, lookup_during_lazy_registration)
+{
+    MetaType::RegisterAllStructs();
+    // the list is last in, first out, so the slow one gets created first
+    static const MetaType::LazyStructRegistration register_second(&MetaType::MetaTypeConstructor<created_after_slow_one>::Get);
+    static const MetaType::LazyStructRegistration register_first(&MetaType::MetaTypeConstructor<slow_to_create>::Get);
+    std::thread registering([]{ MetaType::RegisterAllStructs(); });
+    while (!started_creating_slow_one)
+        std::this_thread::yield();
+    // the list is empty now, but the struct isn't created yet
+    const MetaType * found = nullptr;
+    EXPECT_NO_THROW(found = &MetaType::GetStructType(ReflectionHashedString("testing_created_after_slow_one")));
+    registering.join();
+    ASSERT_EQ(&GetMetaType<created_after_slow_one>(), found);
+}
 }
 
 #endif
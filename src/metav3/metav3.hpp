@@ -48,6 +48,7 @@ struct MetaMember;
 struct MetaConditionalMember;
 struct MetaType;
 struct MetaRandomAccessIterator;
+struct MetaContiguousRange;
 struct ConstMetaReference;
 
 struct MetaReference
@@ -231,6 +232,10 @@ struct ClassHeaderList : std::vector<ClassHeader>
     const_iterator find(const ClassHeader & header) const;
     const_iterator find(const ReflectionHashedString & class_name) const;
 };
+struct ClassHeaderListHash
+{
+    size_t operator()(const ClassHeaderList & headers) const;
+};
 
 struct BaseClass
 {
@@ -261,7 +266,7 @@ private:
     const MetaType * base;
     const MetaType * derived;
     ptrdiff_t offset;
-    memoizing_map<ClassHeaderList, BaseMemberCollection> members;
+    concurrent_memoizing_map<ClassHeaderList, BaseMemberCollection, ClassHeaderListHash> members;
 
     template<typename Base, typename Derived>
     static ptrdiff_t calculate_offset()
@@ -326,10 +331,51 @@ struct MetaType
     {
         general.construct(memory);
     }
+    bool IsCopyConstructible() const
+    {
+        return general.copy_construct != nullptr;
+    }
+    bool IsMoveConstructible() const
+    {
+        return general.move_construct != nullptr;
+    }
+    // calls the copy constructor of the type. for a deep copy of types that
+    // can't be copied, like structs that hold a unique_ptr, use Clone
+    void CopyConstruct(ArrayView<unsigned char> memory, ConstMetaReference other) const;
+    void MoveConstruct(ArrayView<unsigned char> memory, MetaReference other) const;
     void Destroy(ArrayView<unsigned char> memory) const
     {
         general.destroy(memory);
     }
+    // constructs a copy of source in memory by going through the reflection
+    // information. the result is the same as serializing source and reading
+    // it back: pointers get new objects to point to, and members that aren't
+    // reflected are left default constructed. memcpy safe parts are copied
+    // in one go and lists get resized up front, so this is a lot faster than
+    // a roundtrip through a serializer
+    void Clone(ArrayView<unsigned char> memory, ConstMetaReference source) const;
+    // the same, for a target that already exists. overwrites its reflected
+    // values and replaces the contents of its sets, maps and pointers
+    void CloneInto(MetaReference target, ConstMetaReference source) const;
+    // trivially copyable, and every byte of the object belongs to a reflected
+    // member or element, all the way down. so the object can be copied with
+    // memcpy and there is no padding with random bytes in it. for structs
+    // this is about the members of the current version
+    bool IsMemcpySafe() const;
+    // the binary serializers write this type as nothing but its own bytes.
+    // true for numbers, enums and arrays of those, so a block of them can be
+    // read and written with one memcpy
+    bool IsSerializedAsRawBytes() const;
+
+    // compares the reflected values of two objects of this type, recursing
+    // into members, elements and the structs that pointers point to. numbers
+    // are compared by their bytes, so 0.0 and -0.0 are different and a NaN
+    // is equal to itself. that's what lets memcpy safe parts get compared
+    // with one memcmp, and it's what you want for caching and deduplication
+    bool Equals(ConstMetaReference lhs, ConstMetaReference rhs) const;
+    // a hash of the reflected values that is consistent with Equals. not
+    // stable across builds, so don't store it
+    uint64_t Hash(ConstMetaReference object) const;
 
     struct GeneralInformation
     {
@@ -341,7 +387,10 @@ struct MetaType
                 typeid(T), sizeof(T), alignof(T),
                 &Allocate<T>::allocate,
                 &PlacementConstruct<T, std::is_default_constructible<T>::value>::construct,
+                CopyConstruct<T, metav3::is_copy_constructible<T>::value>::copy,
+                MoveConstruct<T, metav3::is_move_constructible<T>::value>::move,
                 &Destroy<T>::destroy,
+                std::is_trivially_copyable<T>::value,
             };
         }
 
@@ -374,6 +423,55 @@ struct MetaType
                 RAW_ASSERT(false, "the type is not default constructible");
             }
         };
+        // nullptr for types that can't be copied or moved
+        template<typename T, bool is_copy_constructible>
+        struct CopyConstruct
+        {
+            static constexpr void (*copy)(ArrayView<unsigned char>, ArrayView<const unsigned char>) = nullptr;
+        };
+        template<typename T>
+        struct CopyConstruct<T, true>
+        {
+            static void copy(ArrayView<unsigned char> memory, ArrayView<const unsigned char> other)
+            {
+                detail::assert_range_size_and_alignment(memory, sizeof(T), alignof(T));
+                new (memory.begin()) T(*reinterpret_cast<const T *>(other.begin()));
+            }
+        };
+        template<typename T, size_t Size>
+        struct CopyConstruct<T[Size], true>
+        {
+            static void copy(ArrayView<unsigned char> memory, ArrayView<const unsigned char> other)
+            {
+                detail::assert_range_size_and_alignment(memory, sizeof(T[Size]), alignof(T[Size]));
+                const T * begin = reinterpret_cast<const T *>(other.begin());
+                std::uninitialized_copy(begin, begin + Size, reinterpret_cast<T *>(memory.begin()));
+            }
+        };
+        template<typename T, bool is_move_constructible>
+        struct MoveConstruct
+        {
+            static constexpr void (*move)(ArrayView<unsigned char>, ArrayView<unsigned char>) = nullptr;
+        };
+        template<typename T>
+        struct MoveConstruct<T, true>
+        {
+            static void move(ArrayView<unsigned char> memory, ArrayView<unsigned char> other)
+            {
+                detail::assert_range_size_and_alignment(memory, sizeof(T), alignof(T));
+                new (memory.begin()) T(std::move(*reinterpret_cast<T *>(other.begin())));
+            }
+        };
+        template<typename T, size_t Size>
+        struct MoveConstruct<T[Size], true>
+        {
+            static void move(ArrayView<unsigned char> memory, ArrayView<unsigned char> other)
+            {
+                detail::assert_range_size_and_alignment(memory, sizeof(T[Size]), alignof(T[Size]));
+                T * begin = reinterpret_cast<T *>(other.begin());
+                std::uninitialized_copy(std::make_move_iterator(begin), std::make_move_iterator(begin + Size), reinterpret_cast<T *>(memory.begin()));
+            }
+        };
         template<typename T>
         struct Destroy
         {
@@ -399,20 +497,74 @@ struct MetaType
         uint32_t alignment;
         allocate_pointer (*allocate)();
         void (*construct)(ArrayView<unsigned char>);
+        void (*copy_construct)(ArrayView<unsigned char>, ArrayView<const unsigned char>);
+        void (*move_construct)(ArrayView<unsigned char>, ArrayView<unsigned char>);
         void (*destroy)(ArrayView<unsigned char>);
+        bool is_trivially_copyable;
     };
     const AllTypesThatExist category;
 
+    // GetMetaType<T>() returns MetaTypeConstructor<T>::Get(). a type gets
+    // registered by specializing Get in one .cpp file, or by specializing
+    // the whole struct for templates. Get should create the type in a
+    // function local static, so that it only gets created when it's first
+    // used instead of at static initialization, where a program would pay
+    // for thousands of types that it may never use. a struct should also
+    // have a LazyStructRegistration, so that it can be found by name
     template<typename T>
     struct MetaTypeConstructor
     {
-        static const MetaType type;
+        static const MetaType & Get();
     };
 
     static const MetaType & GetStructType(const std::type_info &);
     static const MetaType & GetStructType(const ReflectionHashedString &);
     static const ReflectionHashedString & GetRegisteredStructName(StringView<const char> name);
     static const MetaType & GetRegisteredStruct(uint32_t hash);
+    // the lookups above take a lock until this gets called. call it once the
+    // static registration is done, for example at the start of main. after
+    // that they read from an immutable table and only block for structs that
+    // aren't in there. this doesn't create the structs that nobody used yet.
+    // they get added like late registrations, see below. call
+    // RegisterAllStructs first to have all of them in the table, at the cost
+    // of creating every struct at startup
+    static void FreezeStructRegistry();
+    // structs that get registered after the freeze (for example from a plugin)
+    // are found through the slower locked lookup until enough of them came
+    // together to double the size of the table, then the table gets rebuilt.
+    // to only check for that once for several structs, register them while
+    // one of these is alive
+    struct LateStructRegistration
+    {
+        LateStructRegistration();
+        ~LateStructRegistration();
+        LateStructRegistration(const LateStructRegistration &) = delete;
+        LateStructRegistration & operator=(const LateStructRegistration &) = delete;
+    };
+    // a struct that gets created on first use isn't in the registry until
+    // then. so that it can still be found by name or hash, it puts one of
+    // these into a list at static initialization, which is just a pointer
+    // store. the lookups above go through that list when they don't find a
+    // struct, but if you're going to look up a lot of types by hash (for
+    // example to deserialize something) call RegisterAllStructs up front.
+    // FreezeStructRegistry also calls it
+    struct LazyStructRegistration
+    {
+        explicit LazyStructRegistration(const MetaType & (*get)());
+        LazyStructRegistration(const LazyStructRegistration &) = delete;
+        LazyStructRegistration & operator=(const LazyStructRegistration &) = delete;
+
+    private:
+        friend struct MetaType;
+        const MetaType & (*get)();
+        const LazyStructRegistration * next;
+    };
+    static void RegisterAllStructs();
+    // the structs that are in the registry right now
+    static size_t GetNumRegisteredStructs();
+    // the structs that were declared with a LazyStructRegistration, whether
+    // they have been registered yet or not
+    static size_t GetNumLazyStructs();
 
     struct SimpleInfo
     {
@@ -479,19 +631,59 @@ struct MetaType
         void (*push_back)(MetaReference, MetaReference && value);
         MetaRandomAccessIterator (*begin)(MetaReference);
         MetaRandomAccessIterator (*end)(MetaReference);
+        // does nothing for containers that can't reserve, like std::deque
+        void (*reserve)(MetaReference, size_t);
+        // new elements are default constructed
+        void (*resize)(MetaReference, size_t);
+        // the first element, for containers that store their elements next to
+        // each other. nullptr for all other containers
+        unsigned char * (*data)(MetaReference);
+
+        bool IsContiguous() const
+        {
+            return data != nullptr;
+        }
+        // only for contiguous lists
+        MetaContiguousRange GetContiguousRange(MetaReference object) const;
+        // cheaper than going through begin() if the list is contiguous
+        MetaReference GetElement(MetaReference object, size_t index) const;
+
+    private:
+        template<typename T, typename = void>
+        struct ReserveSpecialization
+        {
+            static void reserve(MetaReference, size_t)
+            {
+            }
+        };
+        template<typename T>
+        struct DataSpecialization
+        {
+            static constexpr unsigned char * (*data)(MetaReference) = nullptr;
+        };
     };
     struct ArrayInfo
     {
         template<typename T>
         static ArrayInfo Create(const MetaType & value_type, size_t array_size)
         {
-            return { value_type, array_size, &BeginSpecialization<T>::begin };
+            return { value_type, array_size, &BeginSpecialization<T>::begin, BeginSpecialization<T>::data() };
         }
 
-        ArrayInfo(const MetaType & value_type, size_t array_size, MetaRandomAccessIterator (*begin)(MetaReference object));
+        ArrayInfo(const MetaType & value_type, size_t array_size, MetaRandomAccessIterator (*begin)(MetaReference object), unsigned char * (*data)(MetaReference object));
 
         MetaRandomAccessIterator (*begin)(MetaReference object);
         MetaRandomAccessIterator end(MetaReference object) const;
+        // the first element if begin() returns a plain pointer, which is the
+        // case for C arrays, std::array and most custom arrays. nullptr if not
+        unsigned char * (*data)(MetaReference object);
+
+        bool IsContiguous() const
+        {
+            return data != nullptr;
+        }
+        // only for contiguous arrays
+        MetaContiguousRange GetContiguousRange(MetaReference object) const;
 
         const MetaType & value_type;
         size_t array_size;
@@ -506,6 +698,7 @@ struct MetaType
         struct BeginSpecialization
         {
             static MetaRandomAccessIterator begin(MetaReference object);
+            static unsigned char * (*data())(MetaReference object);
         };
     };
     struct SetInfo
@@ -517,6 +710,20 @@ struct MetaType
         std::pair<SetIterator, bool> (*insert)(MetaReference set, MetaReference && value);
         SetIterator (*begin)(ConstMetaReference set);
         SetIterator (*end)(ConstMetaReference set);
+        // removes one element that is equal to value. returns false if there
+        // is none
+        bool (*erase_one)(MetaReference set, ConstMetaReference value);
+
+        template<typename T>
+        static bool EraseOne(MetaReference object, ConstMetaReference value)
+        {
+            T & set = object.Get<T>();
+            auto found = set.find(value.Get<typename T::value_type>());
+            if (found == set.end())
+                return false;
+            set.erase(found);
+            return true;
+        }
 
         template<typename T>
         struct Creator
@@ -541,7 +748,8 @@ struct MetaType
                     [](ConstMetaReference object) -> SetIterator
                     {
                         return const_cast<T &>(object.Get<T>()).end();
-                    }
+                    },
+                    &EraseOne<T>
                 };
             }
         };
@@ -606,6 +814,31 @@ struct MetaType
         std::pair<MapIterator, bool> (*insert)(MetaReference map, MetaReference && key, MetaReference && value);
         MapIterator (*begin)(ConstMetaReference map);
         MapIterator (*end)(ConstMetaReference map);
+        // the value for the key, or a null pointer. for multimaps it's the
+        // first one with that key
+        MetaPointer (*find)(MetaReference map, ConstMetaReference key);
+        // removes one element with the key. returns false if there is none
+        bool (*erase_one)(MetaReference map, ConstMetaReference key);
+
+        template<typename T>
+        static MetaPointer Find(MetaReference object, ConstMetaReference key)
+        {
+            T & map = object.Get<T>();
+            auto found = map.find(key.Get<typename T::key_type>());
+            if (found == map.end())
+                return MetaPointer(GetMetaType<typename T::mapped_type>(), nullptr);
+            return MetaPointer(MetaReference(found->second));
+        }
+        template<typename T>
+        static bool EraseOne(MetaReference object, ConstMetaReference key)
+        {
+            T & map = object.Get<T>();
+            auto found = map.find(key.Get<typename T::key_type>());
+            if (found == map.end())
+                return false;
+            map.erase(found);
+            return true;
+        }
 
         template<typename T>
         struct Creator
@@ -631,7 +864,9 @@ struct MetaType
                     [](ConstMetaReference object) -> MapIterator
                     {
                         return const_cast<T &>(object.Get<T>()).end();
-                    }
+                    },
+                    &Find<T>,
+                    &EraseOne<T>
                 };
             }
         };
@@ -738,16 +973,22 @@ struct MetaType
         const AllMemberCollection & GetAllMembers(const ClassHeaderList & versions) const;
         const BaseClassCollection & GetDirectBaseClasses(int8_t version) const;
         const BaseClassCollection & GetAllBaseClasses(const ClassHeaderList & versions) const;
+        struct FlatMemberPlan;
+        // the same members as GetAllMembers, but flattened into one list in
+        // the order in which the serializers visit them, with the offsets of
+        // the bases already added in. built once per header list
+        const FlatMemberPlan & GetFlatMemberPlan(const ClassHeaderList & versions) const;
 
     private:
         ReflectionHashedString name;
         int8_t current_version;
         lazy_initialize<ClassHeaderList> current_headers;
         GetInfoFunction get_both;
-        memoizing_map<int8_t, MemberCollection> direct_members;
-        memoizing_map<ClassHeaderList, AllMemberCollection> all_members;
-        memoizing_map<ClassHeaderList, BaseClassCollection> all_bases;
-        memoizing_map<int8_t, BaseClassCollection> direct_bases;
+        concurrent_memoizing_map<int8_t, MemberCollection> direct_members;
+        concurrent_memoizing_map<ClassHeaderList, AllMemberCollection, ClassHeaderListHash> all_members;
+        concurrent_memoizing_map<ClassHeaderList, BaseClassCollection, ClassHeaderListHash> all_bases;
+        concurrent_memoizing_map<int8_t, BaseClassCollection> direct_bases;
+        concurrent_memoizing_map<ClassHeaderList, FlatMemberPlan, ClassHeaderListHash> flat_member_plans;
     };
     struct PointerToStructInfo
     {
@@ -780,7 +1021,7 @@ struct MetaType
         PointerToStructInfo(const MetaType & target_type, pointer_function get_as_pointer, assign_function assign);
         pointer_function get_as_pointer;
         assign_function assign;
-        memoizing_map<const MetaType *, ptrdiff_t> cached_offsets;
+        concurrent_memoizing_map<const MetaType *, ptrdiff_t> cached_offsets;
 
         template<typename T>
         static MetaPointer templated_get_as_pointer(const PointerToStructInfo & info, ConstMetaReference ref)
@@ -804,7 +1045,7 @@ struct MetaType
         template<typename T>
         static TypeErasureInfo Create()
         {
-            return TypeErasureInfo(GetMetaType<T>(), &templated_target_type<T>);
+            return TypeErasureInfo(&templated_target_type<T>);
         }
         template<typename TypeErasure, typename CapturedType>
         struct SupportedType
@@ -840,8 +1081,11 @@ struct MetaType
             assign_function assign;
         };
         static std::map<std::pair<const MetaType *, const MetaType *>, RegisteredSupportedType> & GetSupportedTypes();
-        TypeErasureInfo(const MetaType & self, target_type_function target_type);
-        const MetaType * self;
+        explicit TypeErasureInfo(target_type_function target_type);
+        // gets set by the MetaType, because GetMetaType can't be called
+        // while the type is still being created
+        friend struct MetaType;
+        const MetaType * self = nullptr;
         target_type_function target_type;
 
         template<typename T>
@@ -974,7 +1218,7 @@ private:
 template<typename T>
 const MetaType & GetMetaType()
 {
-    return MetaType::MetaTypeConstructor<T>::type;
+    return MetaType::MetaTypeConstructor<T>::Get();
 }
 
 
@@ -1081,6 +1325,10 @@ struct MetaConditionalMember
     {
         return member;
     }
+    bool (*GetCondition() const)(ConstMetaReference object)
+    {
+        return condition.condition;
+    }
 
 private:
     MetaMember member;
@@ -1288,6 +1536,108 @@ struct MetaRandomAccessIterator : std::iterator<std::random_access_iterator_tag,
         return *this;
     }
 };
+// elements that are stored right next to each other, like in a std::vector
+// or a C array. walking over these is just pointer arithmetic, where going
+// through a MetaRandomAccessIterator costs a few indirect calls per element
+struct MetaContiguousRange
+{
+    MetaContiguousRange(const MetaType & value_type, unsigned char * data, size_t size)
+        : value_type(&value_type), first(data), num_elements(size), stride(value_type.GetSize())
+    {
+    }
+
+    struct iterator : std::iterator<std::forward_iterator_tag, MetaReference>
+    {
+        iterator(const MetaType & value_type, unsigned char * element, size_t stride)
+            : value_type(&value_type), element(element), stride(stride)
+        {
+        }
+
+        MetaReference operator*() const
+        {
+            return MetaReference(*value_type, { element, element + stride });
+        }
+        iterator & operator++()
+        {
+            element += stride;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator copy(*this);
+            ++*this;
+            return copy;
+        }
+        bool operator==(const iterator & other) const
+        {
+            return element == other.element;
+        }
+        bool operator!=(const iterator & other) const
+        {
+            return element != other.element;
+        }
+
+    private:
+        const MetaType * value_type;
+        unsigned char * element;
+        size_t stride;
+    };
+
+    iterator begin() const
+    {
+        return { *value_type, first, stride };
+    }
+    iterator end() const
+    {
+        return { *value_type, first + num_elements * stride, stride };
+    }
+    MetaReference operator[](size_t index) const
+    {
+        unsigned char * element = first + index * stride;
+        return MetaReference(*value_type, { element, element + stride });
+    }
+
+    const MetaType & GetValueType() const
+    {
+        return *value_type;
+    }
+    size_t size() const
+    {
+        return num_elements;
+    }
+    bool empty() const
+    {
+        return num_elements == 0;
+    }
+    // all elements, as one block of memory
+    ArrayView<unsigned char> GetMemory() const
+    {
+        return { first, first + num_elements * stride };
+    }
+
+private:
+    const MetaType * value_type;
+    unsigned char * first;
+    size_t num_elements;
+    size_t stride;
+};
+
+template<typename T>
+struct MetaType::ListInfo::ReserveSpecialization<T, decltype(std::declval<T &>().reserve(size_t()))>
+{
+    static void reserve(MetaReference object, size_t size)
+    {
+        object.Get<T>().reserve(size);
+    }
+};
+template<typename T, typename A>
+struct MetaType::ListInfo::DataSpecialization<std::vector<T, A>>
+{
+    static unsigned char * data(MetaReference object)
+    {
+        return reinterpret_cast<unsigned char *>(object.Get<std::vector<T, A>>().data());
+    }
+};
 template<typename T>
 MetaType::ListInfo MetaType::ListInfo::Creator<T>::Create()
 {
@@ -1309,9 +1659,31 @@ MetaType::ListInfo MetaType::ListInfo::Creator<T>::Create()
         [](MetaReference object) -> MetaRandomAccessIterator
         {
             return object.Get<T>().end();
-        }
+        },
+        &ReserveSpecialization<T>::reserve,
+        [](MetaReference object, size_t size)
+        {
+            object.Get<T>().resize(size);
+        },
+        DataSpecialization<T>::data
     };
 }
+inline MetaContiguousRange MetaType::ListInfo::GetContiguousRange(MetaReference object) const
+{
+    RAW_ASSERT(IsContiguous());
+    return { value_type, data(object), size(object) };
+}
+inline MetaReference MetaType::ListInfo::GetElement(MetaReference object, size_t index) const
+{
+    if (data)
+    {
+        size_t value_size = value_type.GetSize();
+        unsigned char * element = data(object) + index * value_size;
+        return MetaReference(value_type, { element, element + value_size });
+    }
+    else
+        return begin(object)[index];
+}
 inline MetaRandomAccessIterator MetaType::ArrayInfo::end(MetaReference object) const
 {
     return begin(object) + array_size;
@@ -1322,6 +1694,24 @@ inline MetaRandomAccessIterator MetaType::ArrayInfo::BeginSpecialization<T>::beg
     using std::begin;
     return begin(object.Get<T>());
 }
+template<typename T>
+inline unsigned char * (*MetaType::ArrayInfo::BeginSpecialization<T>::data())(MetaReference object)
+{
+    using std::begin;
+    typedef decltype(begin(std::declval<T &>())) Iterator;
+    if (!std::is_pointer<Iterator>::value)
+        return nullptr;
+    return [](MetaReference object)
+    {
+        using std::begin;
+        return reinterpret_cast<unsigned char *>(std::addressof(*begin(object.Get<T>())));
+    };
+}
+inline MetaContiguousRange MetaType::ArrayInfo::GetContiguousRange(MetaReference object) const
+{
+    RAW_ASSERT(IsContiguous());
+    return { value_type, data(object), array_size };
+}
 
 struct BaseClass::BaseMemberCollection
 {
@@ -1394,6 +1784,15 @@ struct BaseClass::BaseMemberCollection
         {
             return { member.GetMember(), offset };
         }
+        const MetaConditionalMember & GetConditionalMember() const
+        {
+            return member;
+        }
+        // the offset of the base that declares the member
+        ptrdiff_t GetBaseOffset() const
+        {
+            return offset;
+        }
 
     private:
         friend BaseClass;
@@ -1412,6 +1811,97 @@ struct MetaType::StructInfo::AllMemberCollection
     MemberCollection direct_members;
     BaseClass::BaseMemberCollection base_members;
 };
+
+struct MetaType::StructInfo::FlatMemberPlan
+{
+    struct Step
+    {
+        enum Kind
+        {
+            Member,
+            ConditionalMember,
+            // several members that are just bytes, see binary_steps
+            RawBytes
+        };
+
+        bool ObjectHasMember(ConstMetaReference object) const
+        {
+            if (kind != ConditionalMember)
+                return true;
+            unsigned char * begin = const_cast<unsigned char *>(object.GetMemory().begin()) + condition_offset;
+            return condition(ConstMetaReference(*condition_struct, { begin, begin + condition_struct->GetSize() }));
+        }
+        MetaReference GetReference(MetaReference object) const
+        {
+            unsigned char * begin = object.GetMemory().begin() + offset;
+            return MetaReference(*type, { begin, begin + size });
+        }
+        ConstMetaReference GetReference(ConstMetaReference object) const
+        {
+            unsigned char * begin = const_cast<unsigned char *>(object.GetMemory().begin()) + offset;
+            return ConstMetaReference(*type, { begin, begin + size });
+        }
+        const ReflectionHashedString & GetName() const
+        {
+            return *name;
+        }
+        ArrayView<const unsigned char> GetBytes(ConstMetaReference object) const
+        {
+            return { object.GetMemory().begin() + offset, object.GetMemory().begin() + offset + size };
+        }
+        ArrayView<unsigned char> GetBytes(MetaReference object) const
+        {
+            return { object.GetMemory().begin() + offset, object.GetMemory().begin() + offset + size };
+        }
+
+        Kind kind;
+        // from the start of the most derived struct
+        ptrdiff_t offset;
+        size_t size;
+        // null for RawBytes
+        const MetaType * type;
+        const ReflectionHashedString * name;
+        // for ConditionalMember: the condition gets called with the struct
+        // that declares the member, which starts at condition_offset
+        bool (*condition)(ConstMetaReference object);
+        const MetaType * condition_struct;
+        ptrdiff_t condition_offset;
+    };
+
+    // every member on its own, for formats that need the names
+    std::vector<Step> members;
+    // the same, except that runs of members that are serialized as raw bytes
+    // (numbers, bools, enums and arrays of those) that are next to each other
+    // in memory are merged into one RawBytes step. for binary formats that
+    // write members back to back
+    std::vector<Step> binary_steps;
+    // the same idea, but the runs are of memcpy safe members. for copying,
+    // comparing and hashing
+    std::vector<Step> memcpy_steps;
+    // true if there are no conditional members, every member is memcpy safe
+    // and the members cover the bytes from zero to members_end without gaps
+    bool members_are_memcpy_safe = false;
+    size_t members_end = 0;
+};
+
+// for using reflected types as keys in hash tables without writing a hash
+// function and an operator== for them
+template<typename T>
+struct ReflectedHash
+{
+    size_t operator()(const T & object) const
+    {
+        return GetMetaType<T>().Hash(object);
+    }
+};
+template<typename T>
+struct ReflectedEqual
+{
+    bool operator()(const T & lhs, const T & rhs) const
+    {
+        return GetMetaType<T>().Equals(lhs, rhs);
+    }
+};
 } // end namespace meta
 
 #include "metav3/default_types.hpp"
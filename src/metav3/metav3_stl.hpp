@@ -15,27 +15,33 @@ namespace metav3
 template<typename T, size_t Size>
 struct MetaType::MetaTypeConstructor<std::array<T, Size>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterArray<std::array<T, Size>>(GetMetaType<T>(), Size);
+        return type;
+    }
 };
-template<typename T, size_t Size>
-const MetaType MetaType::MetaTypeConstructor<std::array<T, Size>>::type = MetaType::RegisterArray<std::array<T, Size>>(GetMetaType<T>(), Size);
 
 template<typename T, typename A>
 struct MetaType::MetaTypeConstructor<std::deque<T, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterList<std::deque<T, A>>();
+        return type;
+    }
 };
-template<typename T, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::deque<T, A>>::type = MetaType::RegisterList<std::deque<T, A>>();
 
 template<typename T, typename C, typename A>
 struct MetaType::MetaTypeConstructor<std::multiset<T, C, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterSet<std::multiset<T, C, A>>();
+        return type;
+    }
 };
 template<typename T, typename C, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::multiset<T, C, A>>::type = MetaType::RegisterSet<std::multiset<T, C, A>>();
-template<typename T, typename C, typename A>
 struct MetaType::SetInfo::Creator<std::multiset<T, C, A>>
 {
     static SetInfo Create()
@@ -59,7 +65,8 @@ struct MetaType::SetInfo::Creator<std::multiset<T, C, A>>
             [](ConstMetaReference object) -> SetIterator
             {
                 return const_cast<Self &>(object.Get<Self>()).end();
-            }
+            },
+            &EraseOne<Self>
         };
     }
 };
@@ -67,7 +74,11 @@ struct MetaType::SetInfo::Creator<std::multiset<T, C, A>>
 template<typename F, typename S>
 struct MetaType::MetaTypeConstructor<std::pair<F, S>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterStruct<std::pair<F, S>>("pair", 0, &GetMembers);
+        return type;
+    }
 
 private:
     static StructInfo::MemberCollection GetMembers(int)
@@ -82,25 +93,27 @@ private:
         };
     }
 };
-template<typename F, typename S>
-const MetaType MetaType::MetaTypeConstructor<std::pair<F, S>>::type = MetaType::RegisterStruct<std::pair<F, S>>("pair", 0, &MetaType::MetaTypeConstructor<std::pair<F, S>>::GetMembers);
 
 template<typename T, typename C, typename A>
 struct MetaType::MetaTypeConstructor<std::set<T, C, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterSet<std::set<T, C, A>>();
+        return type;
+    }
 };
-template<typename T, typename C, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::set<T, C, A>>::type = MetaType::RegisterSet<std::set<T, C, A>>();
 
 template<typename T, typename H, typename E, typename A>
 struct MetaType::MetaTypeConstructor<std::unordered_multiset<T, H, E, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterSet<std::unordered_multiset<T, H, E, A>>();
+        return type;
+    }
 };
 template<typename T, typename H, typename E, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::unordered_multiset<T, H, E, A>>::type = MetaType::RegisterSet<std::unordered_multiset<T, H, E, A>>();
-template<typename T, typename H, typename E, typename A>
 struct MetaType::SetInfo::Creator<std::unordered_multiset<T, H, E, A>>
 {
     static SetInfo Create()
@@ -124,7 +137,8 @@ struct MetaType::SetInfo::Creator<std::unordered_multiset<T, H, E, A>>
             [](ConstMetaReference object) -> SetIterator
             {
                 return const_cast<Self &>(object.Get<Self>()).end();
-            }
+            },
+            &EraseOne<Self>
         };
     }
 };
@@ -132,19 +146,23 @@ struct MetaType::SetInfo::Creator<std::unordered_multiset<T, H, E, A>>
 template<typename K, typename V, typename H, typename E, typename A>
 struct MetaType::MetaTypeConstructor<std::unordered_map<K, V, H, E, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterMap<std::unordered_map<K, V, H, E, A>>();
+        return type;
+    }
 };
-template<typename K, typename V, typename H, typename E, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::unordered_map<K, V, H, E, A>>::type = MetaType::RegisterMap<std::unordered_map<K, V, H, E, A>>();
 
 template<typename K, typename V, typename H, typename E, typename A>
 struct MetaType::MetaTypeConstructor<std::unordered_multimap<K, V, H, E, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterMap<std::unordered_multimap<K, V, H, E, A>>();
+        return type;
+    }
 };
 template<typename K, typename V, typename H, typename E, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::unordered_multimap<K, V, H, E, A>>::type = MetaType::RegisterMap<std::unordered_multimap<K, V, H, E, A>>();
-template<typename K, typename V, typename H, typename E, typename A>
 struct MetaType::MapInfo::Creator<std::unordered_multimap<K, V, H, E, A>>
 {
     static MapInfo Create()
@@ -169,7 +187,9 @@ struct MetaType::MapInfo::Creator<std::unordered_multimap<K, V, H, E, A>>
             [](ConstMetaReference object) -> MapIterator
             {
                 return const_cast<Self &>(object.Get<Self>()).end();
-            }
+            },
+            &Find<Self>,
+            &EraseOne<Self>
         };
     }
 };
@@ -177,17 +197,21 @@ struct MetaType::MapInfo::Creator<std::unordered_multimap<K, V, H, E, A>>
 template<typename T, typename H, typename E, typename A>
 struct MetaType::MetaTypeConstructor<std::unordered_set<T, H, E, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterSet<std::unordered_set<T, H, E, A>>();
+        return type;
+    }
 };
-template<typename T, typename H, typename E, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::unordered_set<T, H, E, A>>::type = MetaType::RegisterSet<std::unordered_set<T, H, E, A>>();
 
 template<typename T, typename A>
 struct MetaType::MetaTypeConstructor<std::vector<T, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterList<std::vector<T, A>>();
+        return type;
+    }
 };
-template<typename T, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::vector<T, A>>::type = MetaType::RegisterList<std::vector<T, A>>();
 
 }
@@ -8,18 +8,22 @@ namespace metav3
 template<typename K, typename V, typename C, typename A>
 struct MetaType::MetaTypeConstructor<std::map<K, V, C, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterMap<std::map<K, V, C, A>>();
+        return type;
+    }
 };
 template<typename K, typename V, typename C, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::map<K, V, C, A>>::type = MetaType::RegisterMap<std::map<K, V, C, A>>();
-template<typename K, typename V, typename C, typename A>
 struct MetaType::MetaTypeConstructor<std::multimap<K, V, C, A>>
 {
-    static const MetaType type;
+    static const MetaType & Get()
+    {
+        static const MetaType type = MetaType::RegisterMap<std::multimap<K, V, C, A>>();
+        return type;
+    }
 };
 template<typename K, typename V, typename C, typename A>
-const MetaType MetaType::MetaTypeConstructor<std::multimap<K, V, C, A>>::type = MetaType::RegisterMap<std::multimap<K, V, C, A>>();
-template<typename K, typename V, typename C, typename A>
 struct MetaType::MapInfo::Creator<std::multimap<K, V, C, A>>
 {
     static MapInfo Create()
@@ -44,7 +48,9 @@ struct MetaType::MapInfo::Creator<std::multimap<K, V, C, A>>
             [](ConstMetaReference object) -> MapIterator
             {
                 return const_cast<Self &>(object.Get<Self>()).end();
-            }
+            },
+            &Find<Self>,
+            &EraseOne<Self>
         };
     }
 };
@@ -0,0 +1,615 @@
+#include "metav3/parallel_traversal.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace metav3
+{
+// the workers sleep until a traversal starts. then every one of them calls
+// the work function once, with its own index. index 0 is the calling thread
+struct ParallelTraversal::ThreadPool
+{
+    explicit ThreadPool(size_t num_threads)
+    {
+        threads.reserve(num_threads - 1);
+        for (size_t i = 1; i < num_threads; ++i)
+            threads.emplace_back([this, i]{ WorkerLoop(i); });
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wakeup.notify_all();
+        for (std::thread & thread : threads)
+            thread.join();
+    }
+
+    // work must not throw
+    void RunOnAll(const std::function<void (size_t worker)> & work)
+    {
+        std::lock_guard<std::mutex> one_at_a_time(run_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = &work;
+            num_running = threads.size();
+            ++generation;
+        }
+        wakeup.notify_all();
+        work(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]{ return num_running == 0; });
+        current = nullptr;
+    }
+
+private:
+    void WorkerLoop(size_t worker)
+    {
+        size_t seen_generation = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;)
+        {
+            wakeup.wait(lock, [&]{ return stop || generation != seen_generation; });
+            if (stop)
+                return;
+            seen_generation = generation;
+            const std::function<void (size_t)> & work = *current;
+            lock.unlock();
+            work(worker);
+            lock.lock();
+            if (--num_running == 0)
+                finished.notify_one();
+        }
+    }
+
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::condition_variable finished;
+    const std::function<void (size_t)> * current = nullptr;
+    size_t num_running = 0;
+    size_t generation = 0;
+    bool stop = false;
+    std::vector<std::thread> threads;
+};
+
+ParallelTraversal::ParallelTraversal(size_t num_threads, size_t grain_size)
+    : num_threads(num_threads ? num_threads : std::max(1u, std::thread::hardware_concurrency()))
+    , grain_size(std::max(size_t(1), grain_size))
+    , pool(std::make_shared<ThreadPool>(this->num_threads))
+{
+}
+
+size_t ParallelTraversal::GetChunkSize(const MetaType & value_type) const
+{
+    switch (value_type.category)
+    {
+    case MetaType::String:
+        return grain_size;
+    case MetaType::List:
+    case MetaType::Set:
+    case MetaType::Map:
+    case MetaType::PointerToStruct:
+    case MetaType::TypeErasure:
+        return std::max(size_t(1), grain_size / 64);
+    default:
+        return value_type.IsMemcpySafe() ? grain_size : std::max(size_t(1), grain_size / 64);
+    }
+}
+
+namespace
+{
+typedef detail::TraversalAccumulator Accumulator;
+
+// the results of one task, in traversal order. a piece is either something
+// that the task visited itself or the results of a task that it spawned
+struct ResultNode
+{
+    struct Piece
+    {
+        std::unique_ptr<Accumulator> local;
+        std::unique_ptr<ResultNode> child;
+    };
+    std::vector<Piece> pieces;
+};
+void AppendInOrder(ResultNode & node, Accumulator & result)
+{
+    for (ResultNode::Piece & piece : node.pieces)
+    {
+        if (piece.local) result.Append(std::move(*piece.local));
+        else AppendInOrder(*piece.child, result);
+    }
+}
+
+struct TraversalRun
+{
+    struct TaskState
+    {
+        size_t worker;
+        ResultNode * node;
+        Accumulator * current;
+    };
+    typedef std::function<void (TaskState &)> TaskFunction;
+    struct Task
+    {
+        ResultNode * node;
+        TaskFunction run;
+    };
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    TraversalRun(const ParallelTraversal & settings, const Accumulator & prototype)
+        : settings(settings), prototype(prototype), queues(settings.GetNumThreads())
+    {
+    }
+
+    template<typename RunOnAll>
+    void Run(ConstMetaReference object, ResultNode & root, RunOnAll && run_on_all)
+    {
+        Spawn(0, { &root, [object, this](TaskState & state)
+        {
+            Walk(object, state);
+        }});
+        run_on_all([this](size_t worker){ Work(worker); });
+        if (first_exception)
+            std::rethrow_exception(first_exception);
+    }
+
+private:
+    const ParallelTraversal & settings;
+    const Accumulator & prototype;
+    std::vector<WorkQueue> queues;
+    std::atomic<size_t> pending{0};
+    std::atomic<bool> failed{false};
+    std::mutex exception_mutex;
+    std::exception_ptr first_exception;
+    // workers that have nothing to do sleep on this until a task gets
+    // spawned or the traversal is done. num_queued only goes up while
+    // holding idle_mutex, so a sleeper can't miss a new task
+    std::mutex idle_mutex;
+    std::condition_variable work_available;
+    std::atomic<size_t> num_queued{0};
+
+    void Spawn(size_t worker, Task task)
+    {
+        ++pending;
+        {
+            WorkQueue & queue = queues[worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            ++num_queued;
+        }
+        work_available.notify_one();
+    }
+    void FinishTask()
+    {
+        if (--pending == 0)
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            work_available.notify_all();
+        }
+    }
+    // the owner takes the newest task, which is depth first and still in the
+    // cache. thieves take the oldest, which is the biggest piece of work
+    bool Pop(size_t worker, Task & task)
+    {
+        WorkQueue & own = queues[worker];
+        {
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                --num_queued;
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            WorkQueue & other = queues[(worker + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.tasks.empty())
+            {
+                task = std::move(other.tasks.front());
+                other.tasks.pop_front();
+                --num_queued;
+                return true;
+            }
+        }
+        return false;
+    }
+    void Work(size_t worker)
+    {
+        while (pending)
+        {
+            Task task;
+            if (!Pop(worker, task))
+            {
+                std::unique_lock<std::mutex> lock(idle_mutex);
+                work_available.wait(lock, [&]{ return num_queued > 0 || pending == 0; });
+                continue;
+            }
+            // once something threw, the remaining tasks only get counted down
+            if (!failed)
+            {
+                try
+                {
+                    Execute(worker, task);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(exception_mutex);
+                    if (!first_exception)
+                        first_exception = std::current_exception();
+                    failed = true;
+                }
+            }
+            FinishTask();
+        }
+    }
+    void Execute(size_t worker, const Task & task)
+    {
+        task.node->pieces.push_back({ prototype.CreateEmpty(), nullptr });
+        TaskState state{ worker, task.node, task.node->pieces.back().local.get() };
+        task.run(state);
+    }
+
+    // the chunks become children of the current task, in order. the first
+    // one gets run right away, the others wait for this thread or a thief.
+    // after that the current task continues with a new piece, so that the
+    // things it visits next end up behind the chunks
+    void SplitIntoChunks(TaskState & state, size_t size, size_t chunk_size, const std::function<TaskFunction (size_t begin, size_t end)> & make_chunk)
+    {
+        std::vector<Task> chunks;
+        for (size_t begin = 0; begin < size; begin += chunk_size)
+        {
+            state.node->pieces.push_back({ nullptr, std::unique_ptr<ResultNode>(new ResultNode()) });
+            chunks.push_back({ state.node->pieces.back().child.get(), make_chunk(begin, std::min(size, begin + chunk_size)) });
+        }
+        state.node->pieces.push_back({ prototype.CreateEmpty(), nullptr });
+        Accumulator * continue_with = state.node->pieces.back().local.get();
+        for (size_t i = chunks.size(); i-- > 1;)
+            Spawn(state.worker, std::move(chunks[i]));
+        Execute(state.worker, chunks.front());
+        state.current = continue_with;
+    }
+    bool ShouldSplit(size_t size, size_t chunk_size) const
+    {
+        return queues.size() > 1 && size > chunk_size;
+    }
+
+    template<typename Info>
+    void WalkRandomAccess(const Info & info, ConstMetaReference container, TaskState & state)
+    {
+        const MetaReference & container_ref = container;
+        size_t size = info.size(container);
+        size_t chunk_size = settings.GetChunkSize(info.value_type);
+        auto walk_range = [this, &info, container_ref](size_t begin, size_t end) -> TaskFunction
+        {
+            return [this, &info, container_ref, begin, end](TaskState & state)
+            {
+                if (info.IsContiguous())
+                {
+                    MetaContiguousRange range = info.GetContiguousRange(container_ref);
+                    for (size_t i = begin; i < end; ++i)
+                        Walk(range[i], state);
+                }
+                else
+                {
+                    MetaRandomAccessIterator it = info.begin(container_ref);
+                    for (size_t i = begin; i < end; ++i)
+                        Walk(it[i], state);
+                }
+            };
+        };
+        if (ShouldSplit(size, chunk_size)) SplitIntoChunks(state, size, chunk_size, walk_range);
+        else walk_range(0, size)(state);
+    }
+    // sets and maps can only be walked forwards, so remember where each chunk
+    // starts on the way through
+    template<typename It, typename WalkElement>
+    void WalkForward(It it, It end, size_t size, size_t chunk_size, const WalkElement & walk_element, TaskState & state)
+    {
+        if (!ShouldSplit(size, chunk_size))
+        {
+            for (; it != end; ++it)
+                walk_element(it, state);
+            return;
+        }
+        std::vector<It> chunk_begins;
+        for (size_t i = 0; it != end; ++it, ++i)
+        {
+            if (i % chunk_size == 0)
+                chunk_begins.push_back(it);
+        }
+        SplitIntoChunks(state, size, chunk_size, [&](size_t begin, size_t end) -> TaskFunction
+        {
+            It chunk_begin = chunk_begins[begin / chunk_size];
+            size_t count = end - begin;
+            return [chunk_begin, count, walk_element](TaskState & state)
+            {
+                It it = chunk_begin;
+                for (size_t i = 0; i < count; ++i, ++it)
+                    walk_element(it, state);
+            };
+        });
+    }
+
+    void Walk(ConstMetaReference value, TaskState & state)
+    {
+        if (!state.current->Visit(value))
+            return;
+        const MetaType & type = value.GetType();
+        const MetaReference & value_ref = value;
+        switch (type.category)
+        {
+        case MetaType::List:
+            return WalkRandomAccess(*type.GetListInfo(), value, state);
+        case MetaType::Array:
+            return WalkRandomAccess(*type.GetArrayInfo(), value, state);
+        case MetaType::Set:
+        {
+            const MetaType::SetInfo & info = *type.GetSetInfo();
+            auto walk_element = [this](const MetaType::SetInfo::SetIterator & it, TaskState & state)
+            {
+                Walk(*it, state);
+            };
+            return WalkForward(info.begin(value), info.end(value), info.size(value), settings.GetChunkSize(info.value_type), walk_element, state);
+        }
+        case MetaType::Map:
+        {
+            const MetaType::MapInfo & info = *type.GetMapInfo();
+            auto walk_element = [this](const MetaType::MapInfo::MapIterator & it, TaskState & state)
+            {
+                Walk(it->first, state);
+                Walk(it->second, state);
+            };
+            size_t chunk_size = std::min(settings.GetChunkSize(info.key_type), settings.GetChunkSize(info.mapped_type));
+            return WalkForward(info.begin(value), info.end(value), info.size(value), chunk_size, walk_element, state);
+        }
+        case MetaType::Struct:
+        {
+            const MetaType::StructInfo & info = *type.GetStructInfo();
+            for (const MetaType::StructInfo::FlatMemberPlan::Step & step : info.GetFlatMemberPlan(info.GetCurrentHeaders()).members)
+            {
+                if (step.ObjectHasMember(value))
+                    Walk(step.GetReference(value), state);
+            }
+            return;
+        }
+        case MetaType::PointerToStruct:
+        {
+            MetaPointer pointer = type.GetPointerToStructInfo()->GetAsPointer(value);
+            if (pointer)
+                Walk(*pointer, state);
+            return;
+        }
+        case MetaType::TypeErasure:
+        {
+            const MetaType::TypeErasureInfo & info = *type.GetTypeErasureInfo();
+            if (info.TargetType(value))
+                Walk(info.Target(value_ref), state);
+            return;
+        }
+        default:
+            return;
+        }
+    }
+};
+
+struct ForEachAccumulator : Accumulator
+{
+    explicit ForEachAccumulator(const ParallelTraversal::VisitFunction & visit)
+        : visit(visit)
+    {
+    }
+    bool Visit(ConstMetaReference value) override
+    {
+        return visit(value);
+    }
+    std::unique_ptr<Accumulator> CreateEmpty() const override
+    {
+        return std::unique_ptr<Accumulator>(new ForEachAccumulator(visit));
+    }
+    void Append(Accumulator &&) override
+    {
+    }
+
+    const ParallelTraversal::VisitFunction & visit;
+};
+}
+
+void ParallelTraversal::Run(ConstMetaReference object, detail::TraversalAccumulator & result) const
+{
+    ResultNode root;
+    TraversalRun(*this, result).Run(object, root, [this](const std::function<void (size_t)> & work)
+    {
+        pool->RunOnAll(work);
+    });
+    AppendInOrder(root, result);
+}
+
+void ParallelTraversal::ForEach(ConstMetaReference object, const VisitFunction & visit) const
+{
+    ForEachAccumulator accumulator(visit);
+    Run(object, accumulator);
+}
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+#include "metafast/metafast.hpp"
+#include "metav3/metav3_stl.hpp"
+#include "metav3/metav3_stl_map.hpp"
+
+namespace traversaltest
+{
+struct leaf
+{
+    int id = 0;
+    std::string name;
+    std::vector<int> numbers;
+};
+struct root
+{
+    std::vector<leaf> leaves;
+    std::map<int, std::vector<int>> by_id;
+    std::set<int> ids;
+    std::deque<float> floats;
+};
+}
+REFLECT_CLASS_START(traversaltest::leaf, 0)
+    REFLECT_MEMBER(id);
+    REFLECT_MEMBER(name);
+    REFLECT_MEMBER(numbers);
+REFLECT_CLASS_END()
+REFLECT_CLASS_START(traversaltest::root, 0)
+    REFLECT_MEMBER(leaves);
+    REFLECT_MEMBER(by_id);
+    REFLECT_MEMBER(ids);
+    REFLECT_MEMBER(floats);
+REFLECT_CLASS_END()
+
+namespace
+{
+using namespace metav3;
+
+traversaltest::root make_traversal_test_data()
+{
+    traversaltest::root result;
+    for (int i = 0; i < 1000; ++i)
+    {
+        traversaltest::leaf leaf;
+        leaf.id = i;
+        leaf.name = std::to_string(i);
+        leaf.numbers.assign(size_t(i % 50), i);
+        result.leaves.push_back(std::move(leaf));
+        result.by_id[i] = std::vector<int>(size_t(i % 3), -i);
+        result.ids.insert(i * 7);
+        result.floats.push_back(float(i));
+    }
+    return result;
+}
+
+// collects the ints in the order in which they were visited
+std::vector<int> collect_ints(const ParallelTraversal & traversal, const traversaltest::root & object)
+{
+    const MetaType & int_type = GetMetaType<int>();
+    return traversal.Reduce(object, std::vector<int>(), [&](std::vector<int> & result, ConstMetaReference value)
+    {
+        if (&value.GetType() == &int_type)
+            result.push_back(value.Get<int>());
+        return true;
+    },
+    [](std::vector<int> lhs, std::vector<int> rhs)
+    {
+        lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+        return lhs;
+    });
+}
+
+TEST(parallel_traversal, same_result_as_single_threaded)
+{
+    traversaltest::root object = make_traversal_test_data();
+    std::vector<int> single_threaded = collect_ints(ParallelTraversal(1), object);
+    // a tiny grain size, so that everything gets split into lots of tasks
+    std::vector<int> multi_threaded = collect_ints(ParallelTraversal(4, 2), object);
+    ASSERT_EQ(single_threaded, multi_threaded);
+    ASSERT_EQ(object.leaves[0].id, single_threaded[0]);
+
+    std::atomic<size_t> num_visited(0);
+    std::atomic<size_t> num_floats(0);
+    const MetaType & float_type = GetMetaType<float>();
+    ParallelTraversal(4, 2).ForEach(object, [&](ConstMetaReference value)
+    {
+        ++num_visited;
+        if (&value.GetType() == &float_type)
+            ++num_floats;
+        return true;
+    });
+    ASSERT_EQ(object.floats.size(), num_floats.load());
+    size_t expected_visited = 1 + 4; // the root and its members
+    for (const traversaltest::leaf & leaf : object.leaves)
+        expected_visited += 1 + 3 + leaf.numbers.size();
+    for (const auto & entry : object.by_id)
+        expected_visited += 2 + entry.second.size();
+    expected_visited += object.ids.size() + object.floats.size();
+    ASSERT_EQ(expected_visited, num_visited.load());
+}
+
+TEST(parallel_traversal, skip_children)
+{
+    traversaltest::root object = make_traversal_test_data();
+    const MetaType & leaf_type = GetMetaType<traversaltest::leaf>();
+    std::atomic<size_t> num_visited(0);
+    ParallelTraversal(4, 2).ForEach(object, [&](ConstMetaReference value)
+    {
+        ++num_visited;
+        return &value.GetType() != &leaf_type;
+    });
+    size_t expected_visited = 1 + 4 + object.leaves.size();
+    for (const auto & entry : object.by_id)
+        expected_visited += 2 + entry.second.size();
+    expected_visited += object.ids.size() + object.floats.size();
+    ASSERT_EQ(expected_visited, num_visited.load());
+}
+
+TEST(parallel_traversal, exceptions)
+{
+    traversaltest::root object = make_traversal_test_data();
+    const MetaType & string_type = GetMetaType<std::string>();
+    ParallelTraversal traversal(4, 2);
+    ASSERT_THROW(traversal.ForEach(object, [&](ConstMetaReference value)
+    {
+        if (&value.GetType() == &string_type && value.Get<std::string>() == "500")
+            throw std::runtime_error("found it");
+        return true;
+    }), std::runtime_error);
+    // the threads are still usable after that
+    ASSERT_EQ(collect_ints(ParallelTraversal(1), object), collect_ints(traversal, object));
+}
+
+TEST(parallel_traversal, reuse_threads)
+{
+    traversaltest::root object = make_traversal_test_data();
+    std::vector<int> expected = collect_ints(ParallelTraversal(1), object);
+    ParallelTraversal traversal(4, 2);
+    ParallelTraversal copy = traversal;
+    for (int i = 0; i < 20; ++i)
+    {
+        ASSERT_EQ(expected, collect_ints(traversal, object));
+        ASSERT_EQ(expected, collect_ints(copy, object));
+    }
+    // the copies share the threads, so these take turns
+    std::vector<std::thread> callers;
+    std::atomic<int> num_wrong(0);
+    for (int i = 0; i < 3; ++i)
+    {
+        callers.emplace_back([&]
+        {
+            for (int j = 0; j < 5; ++j)
+            {
+                if (collect_ints(copy, object) != expected)
+                    ++num_wrong;
+            }
+        });
+    }
+    for (std::thread & caller : callers)
+        caller.join();
+    ASSERT_EQ(0, num_wrong.load());
+}
+}
+
+#endif
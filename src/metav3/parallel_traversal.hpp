@@ -0,0 +1,110 @@
+#pragma once
+
+#include "metav3/metav3.hpp"
+#include <functional>
+#include <memory>
+
+namespace metav3
+{
+namespace detail
+{
+// what ParallelTraversal calls for every value. every task gets its own
+// accumulator, and they get appended to each other in traversal order at
+// the end
+struct TraversalAccumulator
+{
+    virtual ~TraversalAccumulator() = default;
+    // return false to skip the children of the value
+    virtual bool Visit(ConstMetaReference value) = 0;
+    virtual std::unique_ptr<TraversalAccumulator> CreateEmpty() const = 0;
+    // later is what got visited after everything in this one
+    virtual void Append(TraversalAccumulator && later) = 0;
+};
+}
+
+// walks everything that can be reached from a reflected object: members,
+// elements, keys, values and the targets of pointers, on several threads.
+// the work gets split at container boundaries: a list, array, set or map
+// with more elements than fit into one chunk gets cut into chunks, and each
+// chunk becomes a task. a thread works through its own tasks depth first and
+// steals the oldest (and usually biggest) task from another thread when it
+// runs out. struct members don't need their own tasks, because a member that
+// is expensive to visit is a big container, and that gets split anyway.
+//
+// the chunk size is grain_size elements for containers of numbers, strings
+// and other memcpy safe values, and grain_size / 64 elements for containers
+// of values that have children of their own.
+struct ParallelTraversal
+{
+    static constexpr size_t default_grain_size = 4096;
+
+    // num_threads = 0 means one per core. the threads get started here and
+    // are reused by every traversal, so keep this object around instead of
+    // creating one per call. copies share the threads. calls from several
+    // threads at the same time run one after the other
+    explicit ParallelTraversal(size_t num_threads = 0, size_t grain_size = default_grain_size);
+
+    // calls visit for the object and everything in it, from several threads
+    // at the same time. a value is always visited before its children, but
+    // otherwise the order is random. if visit returns false, the children of
+    // that value are skipped. if visit throws, the traversal stops and the
+    // first exception gets rethrown
+    typedef std::function<bool (ConstMetaReference value)> VisitFunction;
+    void ForEach(ConstMetaReference object, const VisitFunction & visit) const;
+
+    // visit(T & result, ConstMetaReference value) gets called like in ForEach,
+    // but every task visits into its own result, starting from identity.
+    // then the results are combined with combine(T lhs, T rhs) in the order
+    // in which a single thread would have visited the values. so if combine
+    // is associative the result is the same as that of a single threaded
+    // walk, no matter how the work got split up
+    template<typename T, typename VisitFunc, typename CombineFunc>
+    T Reduce(ConstMetaReference object, const T & identity, const VisitFunc & visit, const CombineFunc & combine) const
+    {
+        ReduceAccumulator<T, VisitFunc, CombineFunc> result(identity, visit, combine);
+        Run(object, result);
+        return std::move(result.value);
+    }
+
+    size_t GetNumThreads() const
+    {
+        return num_threads;
+    }
+    // how many elements of a container with this value type go into a task
+    size_t GetChunkSize(const MetaType & value_type) const;
+
+private:
+    template<typename T, typename VisitFunc, typename CombineFunc>
+    struct ReduceAccumulator : detail::TraversalAccumulator
+    {
+        ReduceAccumulator(const T & identity, const VisitFunc & visit, const CombineFunc & combine)
+            : value(identity), identity(identity), visit(visit), combine(combine)
+        {
+        }
+        bool Visit(ConstMetaReference to_visit) override
+        {
+            return visit(value, to_visit);
+        }
+        std::unique_ptr<detail::TraversalAccumulator> CreateEmpty() const override
+        {
+            return std::unique_ptr<detail::TraversalAccumulator>(new ReduceAccumulator(identity, visit, combine));
+        }
+        void Append(detail::TraversalAccumulator && later) override
+        {
+            value = combine(std::move(value), std::move(static_cast<ReduceAccumulator &>(later).value));
+        }
+
+        T value;
+        const T & identity;
+        const VisitFunc & visit;
+        const CombineFunc & combine;
+    };
+
+    void Run(ConstMetaReference object, detail::TraversalAccumulator & result) const;
+
+    struct ThreadPool;
+    size_t num_threads;
+    size_t grain_size;
+    std::shared_ptr<ThreadPool> pool;
+};
+}
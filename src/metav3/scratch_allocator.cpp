@@ -0,0 +1,128 @@
+#include "metav3/scratch_allocator.hpp"
+#include "os/memoryManager.hpp"
+#include <algorithm>
+
+namespace metav3
+{
+MetaScratchAllocator::Buffer::Buffer(MetaScratchAllocator & owner, int size_class, ArrayView<unsigned char> memory)
+    : owner(&owner), size_class(size_class), memory(memory)
+{
+}
+MetaScratchAllocator::Buffer::Buffer(Buffer && other)
+    : owner(other.owner), size_class(other.size_class), memory(other.memory)
+{
+    other.owner = nullptr;
+}
+MetaScratchAllocator::Buffer::~Buffer()
+{
+    if (owner) owner->Free(size_class, memory.begin());
+}
+
+MetaScratchAllocator::~MetaScratchAllocator()
+{
+    Reset();
+}
+
+MetaScratchAllocator::Buffer MetaScratchAllocator::Allocate(const MetaType & type)
+{
+    size_t size = type.GetSize();
+    int size_class = 0;
+    size_t class_size = smallest_size;
+    for (; class_size < size && size_class < num_size_classes; class_size *= 2)
+        ++size_class;
+    if (size_class == num_size_classes || type.GetAlignment() > max_alignment)
+    {
+        ++num_heap_allocations;
+        unsigned char * memory = static_cast<unsigned char *>(mem::AllocAligned(size, std::max<size_t>(type.GetAlignment(), sizeof(void *))));
+        return Buffer(*this, -1, { memory, memory + size });
+    }
+    std::vector<unsigned char *> & free_list = free_lists[size_class];
+    unsigned char * memory;
+    if (free_list.empty())
+    {
+        ++num_heap_allocations;
+        // the size of a type is a multiple of its alignment, so aligning to
+        // the class size is always enough
+        memory = static_cast<unsigned char *>(mem::AllocAligned(class_size, std::min(class_size, max_alignment)));
+    }
+    else
+    {
+        memory = free_list.back();
+        free_list.pop_back();
+    }
+    return Buffer(*this, size_class, { memory, memory + size });
+}
+
+void MetaScratchAllocator::Free(int size_class, unsigned char * memory)
+{
+    if (size_class < 0) mem::FreeAligned(memory);
+    else free_lists[size_class].push_back(memory);
+}
+
+void MetaScratchAllocator::Reset()
+{
+    for (std::vector<unsigned char *> & free_list : free_lists)
+    {
+        for (unsigned char * memory : free_list)
+            mem::FreeAligned(memory);
+        free_list.clear();
+    }
+}
+
+MetaScratchAllocator & MetaScratchAllocator::ForThisThread()
+{
+    static thread_local MetaScratchAllocator allocator;
+    return allocator;
+}
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+#include "metav3/metav3_stl.hpp"
+
+namespace
+{
+using namespace metav3;
+
+TEST(scratch_allocator, reuses_memory)
+{
+    MetaScratchAllocator allocator;
+    const MetaType & int_type = GetMetaType<int>();
+    const MetaType & string_type = GetMetaType<std::string>();
+    unsigned char * first = nullptr;
+    {
+        MetaScratchAllocator::Buffer buffer = allocator.Allocate(string_type);
+        ASSERT_EQ(string_type.GetSize(), buffer.GetMemory().size());
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(buffer.GetMemory().begin()) % string_type.GetAlignment());
+        first = buffer.GetMemory().begin();
+    }
+    {
+        MetaScratchAllocator::Buffer buffer = allocator.Allocate(string_type);
+        ASSERT_EQ(first, buffer.GetMemory().begin());
+        // a different size gets its own memory
+        MetaScratchAllocator::Buffer small = allocator.Allocate(int_type);
+        ASSERT_NE(first, small.GetMemory().begin());
+        MetaScratchAllocator::Buffer nested = allocator.Allocate(string_type);
+        ASSERT_NE(first, nested.GetMemory().begin());
+    }
+    ASSERT_EQ(3u, allocator.GetNumHeapAllocations());
+    for (int i = 0; i < 10; ++i)
+    {
+        MetaScratchAllocator::Buffer buffer = allocator.Allocate(string_type);
+        MetaOwningMemory object(string_type, buffer.GetMemory());
+        object.Get<std::string>() = "a string that is long enough to not fit in the small buffer";
+    }
+    ASSERT_EQ(3u, allocator.GetNumHeapAllocations());
+    allocator.Reset();
+    allocator.Allocate(string_type);
+    ASSERT_EQ(4u, allocator.GetNumHeapAllocations());
+
+    // too big for the pool
+    const MetaType & big_type = GetMetaType<std::array<char, 100000>>();
+    allocator.Allocate(big_type);
+    allocator.Allocate(big_type);
+    ASSERT_EQ(6u, allocator.GetNumHeapAllocations());
+}
+}
+
+#endif
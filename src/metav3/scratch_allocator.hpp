@@ -0,0 +1,72 @@
+#pragma once
+
+#include "metav3/metav3.hpp"
+#include <vector>
+
+namespace metav3
+{
+// memory for the temporary objects that the readers need, like the elements
+// of a set that get read before they are moved into the set. memory that
+// comes back goes into a free list for its size and gets handed out again,
+// so reading lots of small sets and maps doesn't go to the heap for every
+// one of them. the readers only ever hold a few buffers at the same time
+// (one per level of nesting) so the pool stays small and is kept around
+// until Reset() or the destructor.
+//
+// this is only for scratch memory. objects that end up owned by the result,
+// like the targets of pointers, still come from MetaType::Allocate.
+//
+// not thread safe. the readers use ForThisThread() unless you pass one in
+struct MetaScratchAllocator
+{
+    struct Buffer
+    {
+        Buffer(Buffer && other);
+        ~Buffer();
+
+        ArrayView<unsigned char> GetMemory() const
+        {
+            return memory;
+        }
+
+    private:
+        friend struct MetaScratchAllocator;
+        Buffer(MetaScratchAllocator & owner, int size_class, ArrayView<unsigned char> memory);
+
+        MetaScratchAllocator * owner;
+        // -1 for memory that is too big or too aligned for the pool
+        int size_class;
+        ArrayView<unsigned char> memory;
+    };
+
+    MetaScratchAllocator() = default;
+    MetaScratchAllocator(const MetaScratchAllocator &) = delete;
+    MetaScratchAllocator & operator=(const MetaScratchAllocator &) = delete;
+    // all buffers have to be back by now
+    ~MetaScratchAllocator();
+
+    // enough memory for one object of the type. the object is not constructed
+    Buffer Allocate(const MetaType & type);
+    // frees the memory in the pool
+    void Reset();
+
+    // how often Allocate had to go to the heap
+    size_t GetNumHeapAllocations() const
+    {
+        return num_heap_allocations;
+    }
+
+    static MetaScratchAllocator & ForThisThread();
+
+private:
+    // 16 bytes up to 32 kilobytes, in powers of two
+    static constexpr int num_size_classes = 12;
+    static constexpr size_t smallest_size = 16;
+    static constexpr size_t max_alignment = 64;
+
+    void Free(int size_class, unsigned char * memory);
+
+    std::vector<unsigned char *> free_lists[num_size_classes];
+    size_t num_heap_allocations = 0;
+};
+}
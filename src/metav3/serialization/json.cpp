@@ -227,7 +227,29 @@ struct JsonWriter
     {
         const MetaType::ListInfo * info = object.GetType().GetListInfo();
         if (!info) RAW_THROW(std::runtime_error("invalid argument to list_to_json"));
-        return write_json_list(info->begin(const_cast<MetaReference &>(object)), info->end(const_cast<MetaReference &>(object)), out);
+        MetaReference & list = const_cast<MetaReference &>(object);
+        if (info->IsContiguous())
+        {
+            MetaContiguousRange range = info->GetContiguousRange(list);
+            return write_json_list(range.begin(), range.end(), out);
+        }
+        return write_json_list(info->begin(list), info->end(list), out);
+    }
+
+    // arrays of numbers go on one line
+    template<typename In, typename Out>
+    Out write_inline_json_list(In begin, In end, Out out)
+    {
+        *out++ = '[';
+        bool first = true;
+        out = std::accumulate(begin, end, out, [&](Out out, const MetaReference & child)
+        {
+            if (first) first = false;
+            else out = copy_string(", ", out);
+            return to_json(child, out);
+        });
+        *out++ = ']';
+        return out;
     }
 
     template<typename It>
@@ -235,6 +257,7 @@ struct JsonWriter
     {
         const MetaType::ArrayInfo * info = object.GetType().GetArrayInfo();
         if (!info) RAW_THROW(std::runtime_error("invalid argument to array_to_json"));
+        MetaReference & array = const_cast<MetaReference &>(object);
         switch (info->value_type.category)
         {
         case MetaType::Bool:
@@ -249,20 +272,19 @@ struct JsonWriter
         case MetaType::Uint64:
         case MetaType::Float:
         case MetaType::Double:
-        {
-            *out++ = '[';
-            bool first = true;
-            out = std::accumulate(info->begin(const_cast<MetaReference &>(object)), info->end(const_cast<MetaReference &>(object)), out, [&](It out, const MetaReference & child)
+            if (info->IsContiguous())
             {
-                if (first) first = false;
-                else out = copy_string(", ", out);
-                return to_json(child, out);
-            });
-            *out++ = ']';
-            return out;
-        }
+                MetaContiguousRange range = info->GetContiguousRange(array);
+                return write_inline_json_list(range.begin(), range.end(), out);
+            }
+            return write_inline_json_list(info->begin(array), info->end(array), out);
         default:
-            return write_json_list(info->begin(const_cast<MetaReference &>(object)), info->end(const_cast<MetaReference &>(object)), out);
+            if (info->IsContiguous())
+            {
+                MetaContiguousRange range = info->GetContiguousRange(array);
+                return write_json_list(range.begin(), range.end(), out);
+            }
+            return write_json_list(info->begin(array), info->end(array), out);
         }
     }
 
@@ -316,24 +338,6 @@ struct JsonWriter
         JsonWriter & writer;
     };
 
-    struct ConditionalMemberPrinter
-    {
-        ConditionalMemberPrinter(const MetaReference & object, JsonWriter & writer)
-            : object(object), writer(writer)
-        {
-        }
-
-        template<typename It, typename T>
-        void operator()(It & lhs, const T & rhs) const
-        {
-            if (rhs.ObjectHasMember(object)) MemberPrinter(object, writer)(lhs, rhs.GetMember());
-        }
-
-    private:
-        const MetaReference & object;
-        JsonWriter & writer;
-    };
-
     template<typename It>
     It struct_to_json(const MetaReference & object, It out)
     {
@@ -351,13 +355,11 @@ struct JsonWriter
             out = to_decimal(int64_t(header.GetVersion()), out);
         }
 
-        const MetaType::StructInfo::AllMemberCollection & all_members = info->GetAllMembers(info->GetCurrentHeaders());
         MemberPrinter printer(object, *this);
-        ConditionalMemberPrinter conditional_printer(object, *this);
-        out = foldl(all_members.base_members.members, out, printer);
-        out = foldl(all_members.base_members.conditional_members, out, conditional_printer);
-        out = foldl(all_members.direct_members.members, out, printer);
-        out = foldl(all_members.direct_members.conditional_members, out, conditional_printer);
+        for (const MetaType::StructInfo::FlatMemberPlan::Step & step : info->GetFlatMemberPlan(info->GetCurrentHeaders()).members)
+        {
+            if (step.ObjectHasMember(object)) printer(out, step);
+        }
         return end_scope('}', out);
     }
 
@@ -578,6 +580,11 @@ struct ConditionalMemberComparer : MemberComparer
 
 struct JsonParser
 {
+    explicit JsonParser(MetaScratchAllocator & allocator)
+        : allocator(allocator)
+    {
+    }
+
     template<typename T>
     ParseResult<void> simple_from_json(T & to_fill, ParseState state)
     {
@@ -658,24 +665,37 @@ struct JsonParser
     {
         const MetaType::ListInfo * info = object.GetType().GetListInfo();
         if (!info) RAW_THROW(std::runtime_error("invalid argument to list_from_json"));
-        MetaType::allocate_pointer buffer = info->value_type.Allocate();
-        return parse_json_list(state, [&](ParseState state) -> ParseResult<void>
+        // parse every element in place at the end of the list. if an element
+        // fails to parse, it gets removed again below
+        size_t size = info->size(object);
+        ParseResult<void> result = parse_json_list(state, [&](ParseState state) -> ParseResult<void>
         {
-            MetaOwningMemory to_read(info->value_type, { buffer.get(), buffer.get() + info->value_type.GetSize() });
-            return from_json(to_read, state) >>= [&](ParseSuccess<void> success) -> ParseResult<void>
+            info->resize(object, size + 1);
+            MetaReference element = info->GetElement(object, size);
+            return from_json(element, state) >>= [&](ParseSuccess<void> success) -> ParseResult<void>
             {
-                info->push_back(object, std::move(to_read));
+                ++size;
                 return std::move(success);
             };
         });
+        if (info->size(object) != size) info->resize(object, size);
+        return result;
     }
 
     ParseResult<void> array_from_json(MetaReference & object, ParseState state)
     {
         const MetaType::ArrayInfo * info = object.GetType().GetArrayInfo();
         if (!info) RAW_THROW(std::runtime_error("invalid argument to list_from_json"));
-        auto it = info->begin(object);
-        auto end = info->end(object);
+        if (info->IsContiguous())
+        {
+            MetaContiguousRange range = info->GetContiguousRange(object);
+            return array_elements_from_json(range.begin(), range.end(), state);
+        }
+        return array_elements_from_json(info->begin(object), info->end(object), state);
+    }
+    template<typename It>
+    ParseResult<void> array_elements_from_json(It it, It end, ParseState state)
+    {
         ParseResult<void> result = parse_json_list(state, [&](ParseState state) -> ParseResult<void>
         {
             if (it == end) return ParseErrorMessage("expected end of array", state);
@@ -693,10 +713,10 @@ struct JsonParser
     {
         const MetaType::SetInfo * info = object.GetType().GetSetInfo();
         if (!info) RAW_THROW(std::runtime_error("invalid argument to set_from_json"));
-        MetaType::allocate_pointer buffer = info->value_type.Allocate();
+        MetaScratchAllocator::Buffer buffer = allocator.Allocate(info->value_type);
         return parse_json_list(state, [&](ParseState state) -> ParseResult<void>
         {
-            MetaOwningMemory to_read(info->value_type, { buffer.get(), buffer.get() + info->value_type.GetSize() });
+            MetaOwningMemory to_read(info->value_type, buffer.GetMemory());
             return from_json(to_read, state) >>= [&](ParseSuccess<void> success) -> ParseResult<void>
             {
                 info->insert(object, std::move(to_read));
@@ -744,9 +764,9 @@ struct JsonParser
     {
         const MetaType::MapInfo * info = object.GetType().GetMapInfo();
         if (!info) RAW_THROW(std::runtime_error("invalid argument to set_from_json"));
-        MetaType::allocate_pointer key_buffer = info->key_type.Allocate();
-        MetaOwningMemory key(info->key_type, { key_buffer.get(), key_buffer.get() + info->key_type.GetSize() });
-        MetaType::allocate_pointer value_buffer = info->mapped_type.Allocate();
+        MetaScratchAllocator::Buffer key_buffer = allocator.Allocate(info->key_type);
+        MetaOwningMemory key(info->key_type, key_buffer.GetMemory());
+        MetaScratchAllocator::Buffer value_buffer = allocator.Allocate(info->mapped_type);
         return parse_json_map(state, [&](ParseState state) -> ParseResult<MetaReference>
         {
             return from_json(key, state) >>= [&](ParseSuccess<void> success) -> ParseResult<MetaReference>
@@ -756,7 +776,7 @@ struct JsonParser
         },
         [&](ParseState state, ParseSuccess<MetaReference> key_success) -> ParseResult<void>
         {
-            MetaOwningMemory value(info->mapped_type, { value_buffer.get(), value_buffer.get() + info->mapped_type.GetSize() });
+            MetaOwningMemory value(info->mapped_type, value_buffer.GetMemory());
             return from_json(value, state) >>= [&](ParseSuccess<void> success) -> ParseResult<void>
             {
                 info->insert(object, std::move(key_success.result), std::move(value));
@@ -921,13 +941,20 @@ struct JsonParser
         }
         RAW_THROW(std::runtime_error("unhandled case in the switch above"));
     }
+
+private:
+    MetaScratchAllocator & allocator;
 };
 
 bool JsonSerializer::deserialize(MetaReference to_fill, StringView<const char> json_text) const
+{
+    return deserialize(to_fill, json_text, MetaScratchAllocator::ForThisThread());
+}
+bool JsonSerializer::deserialize(MetaReference to_fill, StringView<const char> json_text, MetaScratchAllocator & allocator) const
 {
     ReusableStorage<std::string> storage;
     ParseState state(json_text, storage);
-    ParseResult<void> result = JsonParser().from_json(to_fill, state);
+    ParseResult<void> result = JsonParser(allocator).from_json(to_fill, state);
     if (result.GetResult().IsFailure() || !result.GetResult().GetSuccess().new_state.text.empty()) return false;
     else return true;
 }
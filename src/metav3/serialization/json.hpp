@@ -1,6 +1,7 @@
 #pragma once
 
 #include "metav3/metav3fwd.hpp"
+#include "metav3/scratch_allocator.hpp"
 #include <string>
 #include "util/view.hpp"
 
@@ -8,4 +9,7 @@ struct JsonSerializer
 {
     std::string serialize(metav3::ConstMetaReference object) const;
     bool deserialize(metav3::MetaReference to_fill, StringView<const char> json_text) const;
+    // the allocator is for scratch memory while parsing. the overload above
+    // uses the one from MetaScratchAllocator::ForThisThread()
+    bool deserialize(metav3::MetaReference to_fill, StringView<const char> json_text, metav3::MetaScratchAllocator & allocator) const;
 };
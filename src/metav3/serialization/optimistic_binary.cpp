@@ -4,7 +4,9 @@
 #include <istream>
 #include <ostream>
 #include "metav3/metav3.hpp"
+#include "metav3/scratch_allocator.hpp"
 #include <sstream>
+#include <cstring>
 
 using namespace metav3;
 
@@ -34,6 +36,11 @@ struct BinaryWriter
     {
         out.write(reinterpret_cast<const char *>(data.begin()), data.size());
     }
+    // without this the template below would write the view itself
+    void simple_to_binary(ArrayView<unsigned char> data, std::ostream & out)
+    {
+        out.write(reinterpret_cast<const char *>(data.begin()), data.size());
+    }
     template<typename T>
     void simple_to_binary(const T & simple, std::ostream & out)
     {
@@ -65,13 +72,26 @@ struct BinaryWriter
         const MetaType::ListInfo * info = object.GetType().GetListInfo();
         if (!info) RAW_THROW(std::runtime_error("wrong argument to list_to_binary()"));
         simple_to_binary(uint32_t(info->size(object)), out);
-        to_binary(info->begin(object), info->end(object), out);
+        if (info->IsContiguous())
+        {
+            MetaContiguousRange range = info->GetContiguousRange(object);
+            if (info->value_type.IsSerializedAsRawBytes()) simple_to_binary(range.GetMemory(), out);
+            else to_binary(range.begin(), range.end(), out);
+        }
+        else to_binary(info->begin(object), info->end(object), out);
     }
     void array_to_binary(MetaReference object, std::ostream & out)
     {
         const MetaType::ArrayInfo * info = object.GetType().GetArrayInfo();
         if (!info) RAW_THROW(std::runtime_error("wrong argument to array_to_binary"));
-        to_binary(info->begin(object), info->end(object), out);
+        if (object.GetType().IsSerializedAsRawBytes())
+            simple_to_binary(object.GetMemory(), out);
+        else if (info->IsContiguous())
+        {
+            MetaContiguousRange range = info->GetContiguousRange(object);
+            to_binary(range.begin(), range.end(), out);
+        }
+        else to_binary(info->begin(object), info->end(object), out);
     }
     void set_to_binary(MetaReference object, std::ostream & out)
     {
@@ -92,17 +112,6 @@ struct BinaryWriter
             to_binary(it->second, out);
         }
     }
-    template<typename T>
-    void member_to_binary(MetaReference object, const T & member, std::ostream & out)
-    {
-        to_binary(member.GetReference(object), out);
-    }
-    template<typename T>
-    void conditional_member_to_binary(MetaReference object, const T & member, std::ostream & out)
-    {
-        if (member.ObjectHasMember(object)) member_to_binary(object, member.GetMember(), out);
-    }
-
     void struct_to_binary(MetaReference object, std::ostream & out)
     {
         const MetaType::StructInfo * info = object.GetType().GetStructInfo();
@@ -114,11 +123,12 @@ struct BinaryWriter
             simple_to_binary(header.GetVersion(), out);
         }
 
-        const MetaType::StructInfo::AllMemberCollection & all_members = info->GetAllMembers(headers);
-        for (const auto & member : all_members.base_members.members) member_to_binary(object, member, out);
-        for (const auto & member : all_members.base_members.conditional_members) conditional_member_to_binary(object, member, out);
-        for (const auto & member : all_members.direct_members.members) member_to_binary(object, member, out);
-        for (const auto & member : all_members.direct_members.conditional_members) conditional_member_to_binary(object, member, out);
+        ConstMetaReference const_object = object;
+        for (const MetaType::StructInfo::FlatMemberPlan::Step & step : info->GetFlatMemberPlan(headers).binary_steps)
+        {
+            if (step.kind == MetaType::StructInfo::FlatMemberPlan::Step::RawBytes) simple_to_binary(step.GetBytes(const_object), out);
+            else if (step.ObjectHasMember(const_object)) to_binary(step.GetReference(const_object), out);
+        }
     }
     void pointer_to_struct_to_binary(MetaReference object, std::ostream & out)
     {
@@ -215,24 +225,44 @@ In copy_to(In in, Out out_begin, Out out_end)
     return in;
 }
 
+// the optimistic reader trusts the sizes in the input. with Checked it
+// makes sure that it never reads past the end and never allocates more
+// elements than the input could hold, for input that may be broken
+template<bool Checked>
 struct BinaryReader
 {
+    explicit BinaryReader(MetaScratchAllocator & allocator)
+        : allocator(allocator)
+    {
+    }
+
+    static void check_remaining(size_t needed, const ArrayView<const unsigned char> & in)
+    {
+        if (Checked && needed > in.size()) RAW_THROW(std::runtime_error("the input ends in the middle of a value"));
+    }
+
     template<typename T>
     static void simple_from_binary(T & object, ArrayView<const unsigned char> & in)
     {
+        check_remaining(sizeof(T), in);
         auto begin = reinterpret_cast<unsigned char *>(std::addressof(object));
         auto end = begin + sizeof(T);
         in = { copy_to(in.begin(), begin, end), in.end() };
     }
     static void simple_from_binary(ArrayView<unsigned char> object, ArrayView<const unsigned char> & in)
     {
-        in = { copy_to(in.begin(), object.begin(), object.end()), in.end() };
+        // this gets called for whole lists of numbers, so make sure that it's
+        // a memcpy and not a byte by byte loop
+        check_remaining(object.size(), in);
+        memcpy(object.begin(), in.begin(), object.size());
+        in = { in.begin() + object.size(), in.end() };
     }
 
     void string_from_binary(std::string & str, ArrayView<const unsigned char> & in)
     {
         uint32_t size = 0;
         simple_from_binary(size, in);
+        check_remaining(size, in);
         str.resize(size);
         std::copy_n(in.begin(), size, str.begin());
         in = in.subview(size);
@@ -253,12 +283,33 @@ struct BinaryReader
         uint32_t size = 0;
         simple_from_binary(size, in);
         if (!size) return;
-        MetaType::allocate_pointer buffer = info->value_type.Allocate();
-        for (; size > 0; --size)
+        bool raw_bytes = info->IsContiguous() && info->value_type.IsSerializedAsRawBytes();
+        // every element takes at least one byte
+        check_remaining(raw_bytes ? size * info->value_type.GetSize() : size, in);
+        // grow the list once and read straight into the new elements instead
+        // of reading into a temporary and pushing that
+        size_t old_size = info->size(object);
+        info->resize(object, old_size + size);
+        if (raw_bytes)
         {
-            MetaOwningMemory to_read(info->value_type, { buffer.get(), buffer.get() + info->value_type.GetSize() });
-            from_binary(static_cast<MetaReference &>(to_read), in);
-            info->push_back(object, std::move(to_read));
+            ArrayView<unsigned char> memory = info->GetContiguousRange(object).GetMemory();
+            simple_from_binary(memory.subview(old_size * info->value_type.GetSize()), in);
+        }
+        else if (info->IsContiguous())
+        {
+            MetaContiguousRange range = info->GetContiguousRange(object);
+            for (size_t i = old_size; i < range.size(); ++i)
+            {
+                from_binary(range[i], in);
+            }
+        }
+        else
+        {
+            for (auto it = info->begin(object) + old_size; size > 0; --size, ++it)
+            {
+                MetaReference ref = *it;
+                from_binary(ref, in);
+            }
         }
     }
 
@@ -266,6 +317,19 @@ struct BinaryReader
     {
         const MetaType::ArrayInfo * info = object.GetType().GetArrayInfo();
         if (!info) RAW_THROW(std::runtime_error("wrong argument for array_from_binary"));
+        if (object.GetType().IsSerializedAsRawBytes())
+        {
+            simple_from_binary(object.GetMemory(), in);
+            return;
+        }
+        if (info->IsContiguous())
+        {
+            for (MetaReference element : info->GetContiguousRange(object))
+            {
+                from_binary(element, in);
+            }
+            return;
+        }
         auto end = info->end(object);
         for (auto it = info->begin(object); it != end; ++it)
         {
@@ -281,10 +345,11 @@ struct BinaryReader
         uint32_t size = 0;
         simple_from_binary(size, in);
         if (!size) return;
-        MetaType::allocate_pointer buffer = info->value_type.Allocate();
+        check_remaining(size, in);
+        MetaScratchAllocator::Buffer buffer = allocator.Allocate(info->value_type);
         for (; size > 0; --size)
         {
-            MetaOwningMemory to_read(info->value_type, { buffer.get(), buffer.get() + info->value_type.GetSize() });
+            MetaOwningMemory to_read(info->value_type, buffer.GetMemory());
             from_binary(static_cast<MetaReference &>(to_read), in);
             info->insert(object, std::move(to_read));
         }
@@ -297,18 +362,20 @@ struct BinaryReader
         uint32_t size = 0;
         simple_from_binary(size, in);
         if (!size) return;
-        MetaType::allocate_pointer key_buffer = info->key_type.Allocate();
-        MetaType::allocate_pointer value_buffer = info->mapped_type.Allocate();
+        check_remaining(size, in);
+        MetaScratchAllocator::Buffer key_buffer = allocator.Allocate(info->key_type);
+        MetaScratchAllocator::Buffer value_buffer = allocator.Allocate(info->mapped_type);
         for (; size > 0; --size)
         {
-            MetaOwningMemory key_to_read(info->key_type, { key_buffer.get(), key_buffer.get() + info->key_type.GetSize() });
-            MetaOwningMemory value_to_read(info->mapped_type, { value_buffer.get(), value_buffer.get() + info->mapped_type.GetSize() });
+            MetaOwningMemory key_to_read(info->key_type, key_buffer.GetMemory());
+            MetaOwningMemory value_to_read(info->mapped_type, value_buffer.GetMemory());
             from_binary(static_cast<MetaReference &>(key_to_read), in);
             from_binary(static_cast<MetaReference &>(value_to_read), in);
             info->insert(object, std::move(key_to_read), std::move(value_to_read));
         }
     }
 
+    MetaScratchAllocator & allocator;
     ReusableStorage<ClassHeaderList> header_storage;
 
     ReusableStorage<ClassHeaderList>::Reusable struct_headers_from_binary(ArrayView<const unsigned char> & in, const MetaType * struct_type)
@@ -336,6 +403,7 @@ struct BinaryReader
         simple_from_binary(most_derived, in);
         if (struct_type)
         {
+            if (Checked && struct_type->GetStructInfo()->GetName().get_hash() != most_derived) RAW_THROW(std::runtime_error("the input has a different struct than expected"));
             RAW_ASSERT(struct_type->GetStructInfo()->GetName().get_hash() == most_derived);
         }
         else
@@ -346,27 +414,15 @@ struct BinaryReader
         return result;
     }
 
-    template<typename T>
-    void member_from_binary(const T & member, MetaReference object, ArrayView<const unsigned char> & in)
-    {
-        from_binary(member.GetReference(object), in);
-    }
-
-    template<typename T>
-    void conditional_member_from_binary(const T & member, MetaReference object, ArrayView<const unsigned char> & in)
-    {
-        if (member.ObjectHasMember(object)) member_from_binary(member.GetMember(), object, in);
-    }
-
     void struct_members_from_binary(MetaReference object, const ClassHeaderList & headers, ArrayView<const unsigned char> & in)
     {
         const MetaType::StructInfo * info = object.GetType().GetStructInfo();
         if (!info) RAW_THROW(std::runtime_error("wrong argument for struct_from_binary"));
-        const MetaType::StructInfo::AllMemberCollection & all_members = info->GetAllMembers(headers);
-        for (const auto & member : all_members.base_members.members) member_from_binary(member, object, in);
-        for (const auto & conditional_member : all_members.base_members.conditional_members) conditional_member_from_binary(conditional_member, object, in);
-        for (const auto & member : all_members.direct_members.members) member_from_binary(member, object, in);
-        for (const auto & conditional_member : all_members.direct_members.conditional_members) conditional_member_from_binary(conditional_member, object, in);
+        for (const MetaType::StructInfo::FlatMemberPlan::Step & step : info->GetFlatMemberPlan(headers).binary_steps)
+        {
+            if (step.kind == MetaType::StructInfo::FlatMemberPlan::Step::RawBytes) simple_from_binary(step.GetBytes(object), in);
+            else if (step.ObjectHasMember(object)) from_binary(step.GetReference(object), in);
+        }
     }
 
     void struct_from_binary(MetaReference object, ArrayView<const unsigned char> & in)
@@ -445,7 +501,16 @@ struct BinaryReader
 
 void read_optimistic_binary(metav3::MetaReference object, ArrayView<const unsigned char> in)
 {
-    BinaryReader().from_binary(object, in);
+    read_optimistic_binary(object, in, MetaScratchAllocator::ForThisThread());
+}
+void read_optimistic_binary(metav3::MetaReference object, ArrayView<const unsigned char> in, metav3::MetaScratchAllocator & allocator)
+{
+    BinaryReader<false>(allocator).from_binary(object, in);
+}
+void read_optimistic_binary_checked(metav3::MetaReference object, ArrayView<const unsigned char> in)
+{
+    BinaryReader<true>(MetaScratchAllocator::ForThisThread()).from_binary(object, in);
+    if (!in.empty()) RAW_THROW(std::runtime_error("the input is longer than the value"));
 }
 
 std::string OptimisticBinarySerializer::serialize(metav3::ConstMetaReference object) const
@@ -2,6 +2,7 @@
 
 #include <iosfwd>
 #include "metav3/metav3.hpp"
+#include "metav3/scratch_allocator.hpp"
 #include <string>
 
 struct OptimisticBinarySerializer
@@ -11,4 +12,10 @@ struct OptimisticBinarySerializer
 };
 void write_optimistic_binary(metav3::ConstMetaReference object, std::ostream & out);
 void read_optimistic_binary(metav3::MetaReference object, ArrayView<const unsigned char> in);
+// the allocator is for scratch memory while reading. the overload above uses
+// the one from MetaScratchAllocator::ForThisThread()
+void read_optimistic_binary(metav3::MetaReference object, ArrayView<const unsigned char> in, metav3::MetaScratchAllocator & allocator);
+// slower, for input that may be broken: throws std::runtime_error instead of
+// reading past the end of in, and if the value doesn't use all of in
+void read_optimistic_binary_checked(metav3::MetaReference object, ArrayView<const unsigned char> in);
 
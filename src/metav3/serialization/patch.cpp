@@ -0,0 +1,691 @@
+#include "metav3/serialization/patch.hpp"
+
+#include "metav3/serialization/optimistic_binary.hpp"
+#include <algorithm>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace metav3;
+
+namespace
+{
+// every value in the patch starts with one of these
+enum PatchOperation : unsigned char
+{
+    Unchanged,
+    // followed by the new value, see write_value
+    Replace,
+    // followed by changes to the parts of the value. what those look like
+    // depends on the category of the type
+    Modify
+};
+
+void write_varint(uint64_t value, std::ostream & out)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.put(char(value | 0x80));
+    out.put(char(value));
+}
+uint64_t read_varint(ArrayView<const unsigned char> & in)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (in.empty()) RAW_THROW(std::runtime_error("the patch ends in the middle of a number"));
+        unsigned char byte = in.front();
+        in = in.subview(1);
+        result |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return result;
+    }
+    RAW_THROW(std::runtime_error("a number in the patch is too long"));
+}
+
+// pairs up the elements of two sets or maps that have equal keys. this works
+// the same way as MetaType::Equals does for unordered containers
+template<typename It>
+struct KeyMatching
+{
+    std::vector<It> only_in_from;
+    std::vector<std::pair<It, It>> in_both;
+    std::vector<It> only_in_to;
+    // if a key is in there twice, there is no way to tell which of the two
+    // a change belongs to. only multimaps and multisets can have this
+    bool has_duplicate_keys = false;
+};
+template<typename It, typename GetKey>
+KeyMatching<It> match_keys(It from, It from_end, It to, It to_end, const MetaType & key_type, const GetKey & get_key)
+{
+    KeyMatching<It> result;
+    std::vector<std::pair<uint64_t, It>> candidates;
+    for (; to != to_end; ++to)
+        candidates.emplace_back(key_type.Hash(get_key(to)), to);
+    std::sort(candidates.begin(), candidates.end(), [](const std::pair<uint64_t, It> & a, const std::pair<uint64_t, It> & b)
+    {
+        return a.first < b.first;
+    });
+    for (size_t i = 1; i < candidates.size() && !result.has_duplicate_keys; ++i)
+    {
+        for (size_t j = i; j-- > 0 && candidates[j].first == candidates[i].first;)
+        {
+            if (key_type.Equals(get_key(candidates[i].second), get_key(candidates[j].second)))
+            {
+                result.has_duplicate_keys = true;
+                break;
+            }
+        }
+    }
+    std::vector<bool> used(candidates.size(), false);
+    for (; from != from_end; ++from)
+    {
+        uint64_t hash = key_type.Hash(get_key(from));
+        auto found = std::lower_bound(candidates.begin(), candidates.end(), hash, [](const std::pair<uint64_t, It> & a, uint64_t hash)
+        {
+            return a.first < hash;
+        });
+        bool matched = false;
+        for (; found != candidates.end() && found->first == hash; ++found)
+        {
+            if (!key_type.Equals(get_key(from), get_key(found->second)))
+                continue;
+            size_t index = found - candidates.begin();
+            if (used[index])
+            {
+                result.has_duplicate_keys = true;
+                continue;
+            }
+            used[index] = true;
+            result.in_both.emplace_back(from, found->second);
+            matched = true;
+            break;
+        }
+        if (!matched)
+            result.only_in_from.push_back(from);
+    }
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (!used[i])
+            result.only_in_to.push_back(candidates[i].second);
+    }
+    return result;
+}
+
+struct PatchWriter
+{
+    void write(ConstMetaReference from, ConstMetaReference to, std::ostream & out)
+    {
+        if (from.GetType().Equals(from, to)) out.put(Unchanged);
+        else write_change(from, to, out);
+    }
+
+private:
+    // the size, followed by the value in the optimistic binary format
+    void write_value(ConstMetaReference value, std::ostream & out)
+    {
+        buffer.str(std::string());
+        write_optimistic_binary(value, buffer);
+        const std::string & bytes = buffer.str();
+        write_varint(bytes.size(), out);
+        out.write(bytes.data(), bytes.size());
+    }
+    void write_replace(ConstMetaReference to, std::ostream & out)
+    {
+        out.put(Replace);
+        write_value(to, out);
+    }
+
+    // the changes for the elements in changed, followed by the elements
+    // from common_size to to_size, which are new. the indices are stored as
+    // the distance to the previous change plus one, and a zero ends the list
+    template<typename GetElement>
+    void write_element_changes(const std::vector<size_t> & changed, size_t common_size, size_t to_size, const GetElement & get_element, std::ostream & out)
+    {
+        size_t next = 0;
+        for (size_t index : changed)
+        {
+            write_varint(index - next + 1, out);
+            write_change(get_element(0, index), get_element(1, index), out);
+            next = index + 1;
+        }
+        for (size_t index = common_size; index < to_size; ++index)
+        {
+            write_varint(index - next + 1, out);
+            write_replace(get_element(1, index), out);
+            next = index + 1;
+        }
+        write_varint(0, out);
+    }
+
+    void list_change(const MetaReference & from, const MetaReference & to, std::ostream & out)
+    {
+        const MetaType::ListInfo & info = *from.GetType().GetListInfo();
+        size_t from_size = info.size(from);
+        size_t to_size = info.size(to);
+        size_t common_size = std::min(from_size, to_size);
+        std::vector<size_t> changed;
+        for (size_t i = 0; i < common_size; ++i)
+        {
+            if (!info.value_type.Equals(info.GetElement(from, i), info.GetElement(to, i)))
+                changed.push_back(i);
+        }
+        // if most of the list is different, it's smaller to send all of it
+        if ((changed.size() + to_size - common_size) * 2 > to_size)
+            return write_replace(to, out);
+        out.put(Modify);
+        write_varint(to_size, out);
+        write_element_changes(changed, common_size, to_size, [&](int which, size_t index)
+        {
+            return info.GetElement(which ? to : from, index);
+        }, out);
+    }
+    void array_change(const MetaReference & from, const MetaReference & to, std::ostream & out)
+    {
+        const MetaType::ArrayInfo & info = *from.GetType().GetArrayInfo();
+        MetaRandomAccessIterator from_begin = info.begin(from);
+        MetaRandomAccessIterator to_begin = info.begin(to);
+        std::vector<size_t> changed;
+        for (size_t i = 0; i < info.array_size; ++i)
+        {
+            if (!info.value_type.Equals(from_begin[i], to_begin[i]))
+                changed.push_back(i);
+        }
+        if (changed.size() * 2 > info.array_size)
+            return write_replace(to, out);
+        out.put(Modify);
+        write_element_changes(changed, info.array_size, info.array_size, [&](int which, size_t index)
+        {
+            return which ? to_begin[index] : from_begin[index];
+        }, out);
+    }
+    void set_change(ConstMetaReference from, ConstMetaReference to, std::ostream & out)
+    {
+        const MetaType::SetInfo & info = *from.GetType().GetSetInfo();
+        typedef MetaType::SetInfo::SetIterator It;
+        KeyMatching<It> matching = match_keys(info.begin(from), info.end(from), info.begin(to), info.end(to), info.value_type, [](const It & it)
+        {
+            return *it;
+        });
+        if (matching.only_in_from.size() + matching.only_in_to.size() > info.size(to))
+            return write_replace(to, out);
+        out.put(Modify);
+        write_varint(matching.only_in_from.size(), out);
+        for (const It & removed : matching.only_in_from)
+            write_value(*removed, out);
+        write_varint(matching.only_in_to.size(), out);
+        for (const It & added : matching.only_in_to)
+            write_value(*added, out);
+    }
+    void map_change(ConstMetaReference from, ConstMetaReference to, std::ostream & out)
+    {
+        const MetaType::MapInfo & info = *from.GetType().GetMapInfo();
+        typedef MetaType::MapInfo::MapIterator It;
+        KeyMatching<It> matching = match_keys(info.begin(from), info.end(from), info.begin(to), info.end(to), info.key_type, [](const It & it)
+        {
+            return it->first;
+        });
+        std::vector<std::pair<It, It>> changed;
+        for (const std::pair<It, It> & both : matching.in_both)
+        {
+            if (!info.mapped_type.Equals(both.first->second, both.second->second))
+                changed.push_back(both);
+        }
+        if (matching.has_duplicate_keys || matching.only_in_from.size() + changed.size() + matching.only_in_to.size() > info.size(to))
+            return write_replace(to, out);
+        out.put(Modify);
+        write_varint(matching.only_in_from.size(), out);
+        for (const It & removed : matching.only_in_from)
+            write_value(removed->first, out);
+        write_varint(changed.size(), out);
+        for (const std::pair<It, It> & both : changed)
+        {
+            write_value(both.first->first, out);
+            write_change(both.first->second, both.second->second, out);
+        }
+        write_varint(matching.only_in_to.size(), out);
+        for (const It & added : matching.only_in_to)
+        {
+            write_value(added->first, out);
+            write_value(added->second, out);
+        }
+    }
+    void struct_change(ConstMetaReference from, ConstMetaReference to, std::ostream & out)
+    {
+        const MetaType::StructInfo & info = *from.GetType().GetStructInfo();
+        const MetaType::StructInfo::FlatMemberPlan & plan = info.GetFlatMemberPlan(info.GetCurrentHeaders());
+        for (const MetaType::StructInfo::FlatMemberPlan::Step & step : plan.members)
+        {
+            // a conditional member that comes or goes changes the meaning of
+            // the member indices, so don't try to be clever about it
+            if (step.ObjectHasMember(from) != step.ObjectHasMember(to))
+                return write_replace(to, out);
+        }
+        out.put(Modify);
+        size_t next = 0;
+        for (size_t i = 0; i < plan.members.size(); ++i)
+        {
+            const MetaType::StructInfo::FlatMemberPlan::Step & step = plan.members[i];
+            if (!step.ObjectHasMember(to))
+                continue;
+            ConstMetaReference from_member = step.GetReference(from);
+            ConstMetaReference to_member = step.GetReference(to);
+            if (step.type->Equals(from_member, to_member))
+                continue;
+            write_varint(i - next + 1, out);
+            write_change(from_member, to_member, out);
+            next = i + 1;
+        }
+        write_varint(0, out);
+    }
+    void pointer_to_struct_change(ConstMetaReference from, ConstMetaReference to, std::ostream & out)
+    {
+        const MetaType::PointerToStructInfo & info = *from.GetType().GetPointerToStructInfo();
+        MetaPointer from_pointer = info.GetAsPointer(from);
+        MetaPointer to_pointer = info.GetAsPointer(to);
+        if (!from_pointer || !to_pointer || &from_pointer->GetType() != &to_pointer->GetType())
+            return write_replace(to, out);
+        out.put(Modify);
+        write_change(*from_pointer, *to_pointer, out);
+    }
+    void type_erasure_change(const MetaReference & from, const MetaReference & to, std::ostream & out)
+    {
+        const MetaType::TypeErasureInfo & info = *from.GetType().GetTypeErasureInfo();
+        const MetaType * target_type = info.TargetType(from);
+        if (!target_type || target_type != info.TargetType(to))
+            return write_replace(to, out);
+        out.put(Modify);
+        write_change(info.Target(from), info.Target(to), out);
+    }
+
+    // from and to have to be different
+    void write_change(ConstMetaReference from, ConstMetaReference to, std::ostream & out)
+    {
+        switch (from.GetType().category)
+        {
+        case MetaType::Bool:
+        case MetaType::Char:
+        case MetaType::Int8:
+        case MetaType::Uint8:
+        case MetaType::Int16:
+        case MetaType::Uint16:
+        case MetaType::Int32:
+        case MetaType::Uint32:
+        case MetaType::Int64:
+        case MetaType::Uint64:
+        case MetaType::Float:
+        case MetaType::Double:
+        case MetaType::Enum:
+        case MetaType::String:
+            return write_replace(to, out);
+        case MetaType::List:
+            return list_change(from, to, out);
+        case MetaType::Array:
+            return array_change(from, to, out);
+        case MetaType::Set:
+            return set_change(from, to, out);
+        case MetaType::Map:
+            return map_change(from, to, out);
+        case MetaType::Struct:
+            return struct_change(from, to, out);
+        case MetaType::PointerToStruct:
+            return pointer_to_struct_change(from, to, out);
+        case MetaType::TypeErasure:
+            return type_erasure_change(from, to, out);
+        }
+        RAW_THROW(std::runtime_error("unhandled case in the switch above"));
+    }
+
+    std::stringstream buffer;
+};
+
+struct PatchReader
+{
+    void apply(MetaReference target, ArrayView<const unsigned char> & in)
+    {
+        if (in.empty()) RAW_THROW(std::runtime_error("the patch ends too early"));
+        unsigned char operation = in.front();
+        in = in.subview(1);
+        switch (operation)
+        {
+        case Unchanged:
+            return;
+        case Replace:
+            target.GetType().Destroy(target.GetMemory());
+            target.GetType().Construct(target.GetMemory());
+            return read_value(target, in);
+        case Modify:
+            return apply_modification(target, in);
+        }
+        RAW_THROW(std::runtime_error("unknown operation in the patch"));
+    }
+
+private:
+    static void read_value(MetaReference target, ArrayView<const unsigned char> & in)
+    {
+        uint64_t size = read_varint(in);
+        if (size > in.size()) RAW_THROW(std::runtime_error("the patch ends in the middle of a value"));
+        read_optimistic_binary_checked(target, in.subview(0, size));
+        in = in.subview(size);
+    }
+
+    template<typename GetElement>
+    void apply_element_changes(size_t size, const GetElement & get_element, ArrayView<const unsigned char> & in)
+    {
+        for (size_t next = 0;;)
+        {
+            uint64_t distance = read_varint(in);
+            if (!distance)
+                return;
+            size_t index = next + distance - 1;
+            if (index >= size) RAW_THROW(std::runtime_error("the patch changes an element past the end"));
+            apply(get_element(index), in);
+            next = index + 1;
+        }
+    }
+
+    void list_modification(MetaReference target, ArrayView<const unsigned char> & in)
+    {
+        const MetaType::ListInfo & info = *target.GetType().GetListInfo();
+        uint64_t size = read_varint(in);
+        // every element past the current end comes with at least one byte
+        // in the patch. without this check a broken patch could make us
+        // allocate any amount of memory
+        if (size > info.size(target) + in.size()) RAW_THROW(std::runtime_error("the patch grows a list past what it has data for"));
+        info.resize(target, size);
+        apply_element_changes(size, [&](size_t index)
+        {
+            return info.GetElement(target, index);
+        }, in);
+    }
+    void array_modification(MetaReference target, ArrayView<const unsigned char> & in)
+    {
+        const MetaType::ArrayInfo & info = *target.GetType().GetArrayInfo();
+        MetaRandomAccessIterator begin = info.begin(target);
+        apply_element_changes(info.array_size, [&](size_t index)
+        {
+            return begin[index];
+        }, in);
+    }
+    void set_modification(MetaReference target, ArrayView<const unsigned char> & in)
+    {
+        const MetaType::SetInfo & info = *target.GetType().GetSetInfo();
+        MetaScratchAllocator::Buffer buffer = MetaScratchAllocator::ForThisThread().Allocate(info.value_type);
+        for (uint64_t num_removed = read_varint(in); num_removed > 0; --num_removed)
+        {
+            MetaOwningMemory value(info.value_type, buffer.GetMemory());
+            read_value(static_cast<MetaReference &>(value), in);
+            if (!info.erase_one(target, static_cast<MetaReference &>(value))) RAW_THROW(std::runtime_error("the patch removes an element that isn't in the set"));
+        }
+        for (uint64_t num_added = read_varint(in); num_added > 0; --num_added)
+        {
+            MetaOwningMemory value(info.value_type, buffer.GetMemory());
+            read_value(static_cast<MetaReference &>(value), in);
+            info.insert(target, std::move(value));
+        }
+    }
+    void map_modification(MetaReference target, ArrayView<const unsigned char> & in)
+    {
+        const MetaType::MapInfo & info = *target.GetType().GetMapInfo();
+        MetaScratchAllocator & allocator = MetaScratchAllocator::ForThisThread();
+        MetaScratchAllocator::Buffer key_buffer = allocator.Allocate(info.key_type);
+        MetaScratchAllocator::Buffer value_buffer = allocator.Allocate(info.mapped_type);
+        for (uint64_t num_removed = read_varint(in); num_removed > 0; --num_removed)
+        {
+            MetaOwningMemory key(info.key_type, key_buffer.GetMemory());
+            read_value(static_cast<MetaReference &>(key), in);
+            if (!info.erase_one(target, static_cast<MetaReference &>(key))) RAW_THROW(std::runtime_error("the patch removes a key that isn't in the map"));
+        }
+        for (uint64_t num_changed = read_varint(in); num_changed > 0; --num_changed)
+        {
+            MetaOwningMemory key(info.key_type, key_buffer.GetMemory());
+            read_value(static_cast<MetaReference &>(key), in);
+            MetaPointer value = info.find(target, static_cast<MetaReference &>(key));
+            if (!value) RAW_THROW(std::runtime_error("the patch changes a key that isn't in the map"));
+            apply(*value, in);
+        }
+        for (uint64_t num_added = read_varint(in); num_added > 0; --num_added)
+        {
+            MetaOwningMemory key(info.key_type, key_buffer.GetMemory());
+            MetaOwningMemory value(info.mapped_type, value_buffer.GetMemory());
+            read_value(static_cast<MetaReference &>(key), in);
+            read_value(static_cast<MetaReference &>(value), in);
+            info.insert(target, std::move(key), std::move(value));
+        }
+    }
+    void struct_modification(MetaReference target, ArrayView<const unsigned char> & in)
+    {
+        const MetaType::StructInfo & info = *target.GetType().GetStructInfo();
+        const MetaType::StructInfo::FlatMemberPlan & plan = info.GetFlatMemberPlan(info.GetCurrentHeaders());
+        apply_element_changes(plan.members.size(), [&](size_t index)
+        {
+            return plan.members[index].GetReference(target);
+        }, in);
+    }
+
+    void apply_modification(MetaReference target, ArrayView<const unsigned char> & in)
+    {
+        const MetaType & type = target.GetType();
+        switch (type.category)
+        {
+        case MetaType::List:
+            return list_modification(target, in);
+        case MetaType::Array:
+            return array_modification(target, in);
+        case MetaType::Set:
+            return set_modification(target, in);
+        case MetaType::Map:
+            return map_modification(target, in);
+        case MetaType::Struct:
+            return struct_modification(target, in);
+        case MetaType::PointerToStruct:
+        {
+            MetaPointer pointer = type.GetPointerToStructInfo()->GetAsPointer(target);
+            if (!pointer) RAW_THROW(std::runtime_error("the patch changes the target of a null pointer"));
+            return apply(*pointer, in);
+        }
+        case MetaType::TypeErasure:
+        {
+            const MetaType::TypeErasureInfo & info = *type.GetTypeErasureInfo();
+            if (!info.TargetType(target)) RAW_THROW(std::runtime_error("the patch changes the target of an empty type erasure"));
+            return apply(info.Target(target), in);
+        }
+        default:
+            RAW_THROW(std::runtime_error("the patch modifies a value that can only be replaced"));
+        }
+    }
+};
+}
+
+void write_patch(ConstMetaReference from, ConstMetaReference to, std::ostream & out)
+{
+    RAW_ASSERT(&from.GetType() == &to.GetType());
+    PatchWriter().write(from, to, out);
+}
+std::string create_patch(ConstMetaReference from, ConstMetaReference to)
+{
+    std::stringstream out;
+    write_patch(from, to, out);
+    return out.str();
+}
+
+void apply_patch(MetaReference target, ArrayView<const unsigned char> patch)
+{
+    PatchReader().apply(target, patch);
+    if (!patch.empty()) RAW_THROW(std::runtime_error("there are bytes left over at the end of the patch"));
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+#include "metafast/metafast.hpp"
+#include "metav3/metav3_stl.hpp"
+#include "metav3/metav3_stl_map.hpp"
+
+namespace patchtest
+{
+struct item
+{
+    int id = 0;
+    std::string name;
+};
+struct state
+{
+    int version = 0;
+    float position[3] = { 0.0f, 0.0f, 0.0f };
+    std::string name;
+    std::vector<item> items;
+    std::deque<int> history;
+    std::map<std::string, int> counts;
+    std::unordered_set<std::string> tags;
+    std::unordered_multiset<int> bag;
+};
+}
+REFLECT_CLASS_START(patchtest::item, 0)
+    REFLECT_MEMBER(id);
+    REFLECT_MEMBER(name);
+REFLECT_CLASS_END()
+REFLECT_CLASS_START(patchtest::state, 0)
+    REFLECT_MEMBER(version);
+    REFLECT_MEMBER(position);
+    REFLECT_MEMBER(name);
+    REFLECT_MEMBER(items);
+    REFLECT_MEMBER(history);
+    REFLECT_MEMBER(counts);
+    REFLECT_MEMBER(tags);
+    REFLECT_MEMBER(bag);
+REFLECT_CLASS_END()
+
+namespace
+{
+patchtest::state make_patch_test_state()
+{
+    patchtest::state result;
+    result.version = 1;
+    result.name = "before";
+    for (int i = 0; i < 100; ++i)
+        result.items.push_back({ i, "item" + std::to_string(i) });
+    result.history = { 1, 2, 3 };
+    result.counts = { { "a", 1 }, { "b", 2 }, { "c", 3 } };
+    result.tags = { "x", "y" };
+    result.bag = { 1, 1, 2 };
+    return result;
+}
+ArrayView<const unsigned char> as_bytes(const std::string & str)
+{
+    return { reinterpret_cast<const unsigned char *>(str.data()), reinterpret_cast<const unsigned char *>(str.data() + str.size()) };
+}
+void check_patch(const patchtest::state & from, const patchtest::state & to)
+{
+    const MetaType & type = GetMetaType<patchtest::state>();
+    std::string patch = create_patch(from, to);
+    patchtest::state target = make_patch_test_state();
+    ASSERT_TRUE(type.Equals(from, target));
+    apply_patch(target, as_bytes(patch));
+    ASSERT_TRUE(type.Equals(to, target));
+}
+
+TEST(patch, unchanged)
+{
+    patchtest::state state = make_patch_test_state();
+    std::string patch = create_patch(state, state);
+    ASSERT_EQ(1u, patch.size());
+    check_patch(state, state);
+}
+
+TEST(patch, small_changes_make_small_patches)
+{
+    patchtest::state from = make_patch_test_state();
+    patchtest::state to = from;
+    to.items[50].name = "changed";
+    std::string patch = create_patch(from, to);
+    ASSERT_LT(patch.size(), 32u);
+    ASSERT_LT(patch.size() * 10, OptimisticBinarySerializer().serialize(to).size());
+    check_patch(from, to);
+}
+
+TEST(patch, everything_changes)
+{
+    patchtest::state from = make_patch_test_state();
+    patchtest::state to = from;
+    to.version = 2;
+    to.position[1] = 5.0f;
+    to.name = "after";
+    to.items.resize(120);
+    to.items[3].id = -3;
+    to.items[110].name = "new";
+    to.history.pop_back();
+    to.history[0] = 10;
+    to.counts.erase("a");
+    to.counts["b"] = 20;
+    to.counts["d"] = 4;
+    to.tags.erase("x");
+    to.tags.insert("z");
+    to.bag.erase(to.bag.find(1));
+    to.bag.insert(3);
+    check_patch(from, to);
+
+    patchtest::state shorter = from;
+    shorter.items.resize(10);
+    check_patch(from, shorter);
+}
+
+TEST(patch, broken_patches_throw)
+{
+    patchtest::state from = make_patch_test_state();
+    patchtest::state to = from;
+    to.counts.erase("a");
+    to.items[3].id = -3;
+    std::string patch = create_patch(from, to);
+    patchtest::state target = make_patch_test_state();
+    ASSERT_THROW(apply_patch(target, as_bytes(patch.substr(0, patch.size() - 1))), std::runtime_error);
+    ASSERT_THROW(apply_patch(target, as_bytes(patch + "x")), std::runtime_error);
+    // the key that the patch wants to remove isn't there any more
+    patchtest::state already_patched = to;
+    ASSERT_THROW(apply_patch(already_patched, as_bytes(patch)), std::runtime_error);
+}
+
+TEST(patch, huge_list_size_throws)
+{
+    std::stringstream patch;
+    patch.put(Modify);
+    write_varint(uint64_t(1) << 40, patch);
+    write_varint(0, patch);
+    std::vector<int> target = { 1, 2, 3 };
+    ASSERT_THROW(apply_patch(target, as_bytes(patch.str())), std::runtime_error);
+    ASSERT_EQ(3u, target.size());
+}
+
+TEST(patch, huge_size_in_replaced_value_throws)
+{
+    // a list of 0xffffff ints in a value that is four bytes long
+    std::string patch = { char(Replace), 4, char(0xff), char(0xff), char(0xff), 0 };
+    std::vector<int> target = { 1, 2, 3 };
+    ASSERT_THROW(apply_patch(target, as_bytes(patch)), std::runtime_error);
+}
+
+TEST(patch, corrupt_replaced_value_throws)
+{
+    std::vector<std::string> from = { "a", "b" };
+    std::vector<std::string> to = { "c", "d", "e" };
+    std::string patch = create_patch(from, to);
+    ASSERT_EQ(char(Replace), patch[0]);
+    std::vector<std::string> target = from;
+    apply_patch(target, as_bytes(patch));
+    ASSERT_EQ(to, target);
+    // the value claims to be one byte shorter or longer than its contents
+    std::string shorter = patch;
+    --shorter[1];
+    target = from;
+    ASSERT_THROW(apply_patch(target, as_bytes(shorter.substr(0, shorter.size() - 1))), std::runtime_error);
+    std::string longer = patch + "x";
+    ++longer[1];
+    target = from;
+    ASSERT_THROW(apply_patch(target, as_bytes(longer)), std::runtime_error);
+    // the size of the last string is too big for what's left
+    std::string bigger_string = patch;
+    bigger_string[bigger_string.size() - 5] = 100;
+    target = from;
+    ASSERT_THROW(apply_patch(target, as_bytes(bigger_string)), std::runtime_error);
+}
+}
+
+#endif
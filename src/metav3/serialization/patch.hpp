@@ -0,0 +1,19 @@
+#pragma once
+
+#include <iosfwd>
+#include "metav3/metav3.hpp"
+#include <string>
+
+// a patch is what changed between two objects of the same type. applying it
+// to an object that is equal to from turns that object into to. structs are
+// compared member by member, lists and arrays element by element and sets
+// and maps by key, and only what changed ends up in the patch. a value that
+// changed is stored in the optimistic binary format.
+//
+// the patch refers to struct members by their position, so both sides need
+// the same versions of the structs. a patch between two equal objects is a
+// single byte
+void write_patch(metav3::ConstMetaReference from, metav3::ConstMetaReference to, std::ostream & out);
+std::string create_patch(metav3::ConstMetaReference from, metav3::ConstMetaReference to);
+// throws if the patch is broken or doesn't fit the target
+void apply_patch(metav3::MetaReference target, ArrayView<const unsigned char> patch);
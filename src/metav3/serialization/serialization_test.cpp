@@ -66,7 +66,12 @@ static MetaType::StructInfo::MemberCollection get_conditional_member_members(int
     };
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<srlztest::conditional_member>::type = MetaType::RegisterStruct<srlztest::conditional_member>("srlz_conditional_member", 0, &get_conditional_member_members);
+const MetaType & MetaType::MetaTypeConstructor<srlztest::conditional_member>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<srlztest::conditional_member>("srlz_conditional_member", 0, &get_conditional_member_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_conditional_member(&MetaType::MetaTypeConstructor<srlztest::conditional_member>::Get);
 #endif
 #ifdef META_SUPPORTS_TYPE_ERASURE
 static MetaType::StructInfo::MemberCollection get_type_erasure_member_members(int8_t)
@@ -80,13 +85,26 @@ static MetaType::StructInfo::MemberCollection get_type_erasure_member_members(in
     };
 }
 template<>
-const MetaType MetaType::MetaTypeConstructor<srlztest::type_erasure>::type = MetaType::RegisterTypeErasure<srlztest::type_erasure>();
+const MetaType & MetaType::MetaTypeConstructor<srlztest::type_erasure>::Get()
+{
+    static const MetaType type = MetaType::RegisterTypeErasure<srlztest::type_erasure>();
+    return type;
+}
 template<>
-const MetaType MetaType::MetaTypeConstructor<srlztest::type_erasure_member>::type = MetaType::RegisterStruct<srlztest::type_erasure_member>("srlz_type_erasure", 0, &get_type_erasure_member_members);
+const MetaType & MetaType::MetaTypeConstructor<srlztest::type_erasure_member>::Get()
+{
+    static const MetaType type = MetaType::RegisterStruct<srlztest::type_erasure_member>("srlz_type_erasure", 0, &get_type_erasure_member_members);
+    return type;
+}
+static const MetaType::LazyStructRegistration register_type_erasure_member(&MetaType::MetaTypeConstructor<srlztest::type_erasure_member>::Get);
 static MetaType::TypeErasureInfo::SupportedType<srlztest::type_erasure, srlztest::type_erasure_member> support_type_erasure;
 #endif
 
 template<>
-const MetaType MetaType::MetaTypeConstructor<srlztest::an_enum>::type = MetaType::RegisterEnum<srlztest::an_enum>({ { srlztest::EnumValueOne, "EnumValueOne" }, { srlztest::EnumValueTwo, "EnumValueTwo" } });
+const MetaType & MetaType::MetaTypeConstructor<srlztest::an_enum>::Get()
+{
+    static const MetaType type = MetaType::RegisterEnum<srlztest::an_enum>({ { srlztest::EnumValueOne, "EnumValueOne" }, { srlztest::EnumValueTwo, "EnumValueTwo" } });
+    return type;
+}
 }
 #endif
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <type_traits>
+#include <utility>
 
 namespace metav3
 {
@@ -13,4 +15,71 @@ struct remove_pointer<std::unique_ptr<T>>
 {
     typedef T type;
 };
+
+namespace detail
+{
+template<typename...>
+struct make_void
+{
+    typedef void type;
+};
+template<typename T, typename = void>
+struct is_container : std::false_type
+{
+};
+template<typename T>
+struct is_container<T, typename make_void<typename T::value_type, typename T::allocator_type>::type> : std::true_type
+{
+};
+template<typename T, bool = is_container<T>::value>
+struct is_copy_constructible_helper;
+}
+
+// the standard containers say that they are copy constructible even if their
+// elements aren't, because their copy constructors aren't constrained. this
+// looks into the elements of anything that has an allocator, and into arrays.
+// the same goes for structs: the implicit copy constructor of a struct with a
+// std::vector<std::unique_ptr<int>> member exists, it just doesn't compile.
+// there is no way to look into the members of a struct at compile time, so
+// other classes only count as copy constructible if that is trivial. the
+// others can still be copied with MetaType::Clone
+template<typename T>
+struct is_copy_constructible : detail::is_copy_constructible_helper<T>
+{
+};
+template<typename F, typename S>
+struct is_copy_constructible<std::pair<F, S>>
+    : std::integral_constant<bool, is_copy_constructible<F>::value && is_copy_constructible<S>::value>
+{
+};
+template<typename T, size_t Size>
+struct is_copy_constructible<T[Size]> : is_copy_constructible<T>
+{
+};
+template<typename T, size_t Size>
+struct is_copy_constructible<std::array<T, Size>> : is_copy_constructible<T>
+{
+};
+namespace detail
+{
+template<typename T>
+struct is_copy_constructible_helper<T, false>
+    : std::integral_constant<bool, std::is_class<T>::value ? std::is_trivially_copy_constructible<T>::value : std::is_copy_constructible<T>::value>
+{
+};
+template<typename T>
+struct is_copy_constructible_helper<T, true>
+    : std::integral_constant<bool, std::is_copy_constructible<T>::value && metav3::is_copy_constructible<typename std::remove_const<typename T::value_type>::type>::value>
+{
+};
+}
+
+template<typename T>
+struct is_move_constructible : std::is_move_constructible<T>
+{
+};
+template<typename T, size_t Size>
+struct is_move_constructible<T[Size]> : is_move_constructible<T>
+{
+};
 }
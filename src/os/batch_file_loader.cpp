@@ -0,0 +1,553 @@
+#include "os/batch_file_loader.hpp"
+#include "os/mmapped_file.hpp"
+#include "debug/assert.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// the file operations were added in linux 5.6, together with this flag
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(STATX_SIZE)
+#define HAS_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+namespace
+{
+size_t choose_num_threads(size_t num_threads)
+{
+    if (!num_threads)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    return num_threads;
+}
+
+// runs the process function on worker threads for files that are already in
+// memory. push() blocks if too many files are waiting, so that the loading
+// can't run away from the processing
+struct ProcessingPool
+{
+    ProcessingPool(const BatchFileLoader::ProcessFunction & process, size_t num_threads, size_t max_waiting)
+        : process(process), max_waiting(max_waiting)
+    {
+        for (size_t i = 0; i < num_threads; ++i)
+            threads.emplace_back([this]{ work(); });
+    }
+    ~ProcessingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        job_added.notify_all();
+        for (std::thread & thread : threads)
+            thread.join();
+    }
+
+    void push(size_t index, std::unique_ptr<unsigned char[]> bytes, size_t size)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_taken.wait(lock, [&]{ return jobs.size() < max_waiting; });
+            jobs.push_back(Job{ index, std::move(bytes), size });
+        }
+        job_added.notify_one();
+    }
+
+private:
+    struct Job
+    {
+        size_t index;
+        std::unique_ptr<unsigned char[]> bytes;
+        size_t size;
+    };
+
+    void work()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_added.wait(lock, [&]{ return finished || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job_taken.notify_one();
+            process(job.index, { job.bytes.get(), job.bytes.get() + job.size });
+        }
+    }
+
+    const BatchFileLoader::ProcessFunction & process;
+    size_t max_waiting;
+    std::mutex mutex;
+    std::condition_variable job_added;
+    std::condition_variable job_taken;
+    std::deque<Job> jobs;
+    bool finished = false;
+    std::vector<std::thread> threads;
+};
+
+#ifdef HAS_IO_URING
+// the minimum needed to use io_uring without liburing: set up the rings, hand
+// out submission entries and walk the completions
+struct IoUring
+{
+    IoUring(unsigned num_entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd = int(syscall(__NR_io_uring_setup, num_entries, &params));
+        if (ring_fd < 0)
+            return;
+        sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+            sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+        void * sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        if (sq_map == MAP_FAILED)
+        {
+            close_ring();
+            return;
+        }
+        sq_ring = static_cast<unsigned char *>(sq_map);
+        if (single_mmap)
+            cq_ring = sq_ring;
+        else
+        {
+            void * cq_map = mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq_map == MAP_FAILED)
+            {
+                close_ring();
+                return;
+            }
+            cq_ring = static_cast<unsigned char *>(cq_map);
+        }
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        void * sqes_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sqes_map == MAP_FAILED)
+        {
+            close_ring();
+            return;
+        }
+        sqes = static_cast<io_uring_sqe *>(sqes_map);
+
+        sq_head = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(sq_ring + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq_ring + params.sq_off.array);
+        num_sq_entries = params.sq_entries;
+        cq_head = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq_ring + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(cq_ring + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq_ring + params.cq_off.cqes);
+        num_cq_entries = params.cq_entries;
+        local_sq_tail = *sq_tail;
+        if (!supports_file_operations())
+            close_ring();
+    }
+    ~IoUring()
+    {
+        close_ring();
+    }
+
+    bool is_valid() const
+    {
+        return ring_fd >= 0;
+    }
+
+    // returns nullptr if the submission queue is full
+    io_uring_sqe * get_sqe()
+    {
+        if (local_sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= num_sq_entries)
+            return nullptr;
+        unsigned index = local_sq_tail & sq_mask;
+        io_uring_sqe * sqe = sqes + index;
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        ++local_sq_tail;
+        return sqe;
+    }
+    // submits everything from get_sqe() and waits for at least one completion
+    void submit_and_wait()
+    {
+        __atomic_store_n(sq_tail, local_sq_tail, __ATOMIC_RELEASE);
+        for (;;)
+        {
+            unsigned to_submit = local_sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+            if (syscall(__NR_io_uring_enter, ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0)
+                return;
+            // the kernel is out of memory for requests or the completion
+            // queue is full. both go away once some requests complete
+            if (errno == EAGAIN || errno == EBUSY)
+                return;
+            // the other errors mean that the arguments are wrong. the kernel
+            // might still be writing into the buffers, so there is no way to
+            // recover from this
+            RAW_ASSERT(errno == EINTR, "io_uring_enter failed");
+        }
+    }
+    template<typename Func>
+    void for_each_completion(Func && func)
+    {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+            func(cqes[head & cq_mask]);
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    unsigned num_sq_entries = 0;
+    unsigned num_cq_entries = 0;
+
+private:
+    bool supports_file_operations()
+    {
+        size_t num_ops = 256;
+        std::unique_ptr<unsigned char[]> storage(new unsigned char[sizeof(io_uring_probe) + num_ops * sizeof(io_uring_probe_op)]());
+        io_uring_probe * probe = reinterpret_cast<io_uring_probe *>(storage.get());
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, num_ops) < 0)
+            return false;
+        for (int op : { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE })
+        {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                return false;
+        }
+        return true;
+    }
+    void close_ring()
+    {
+        if (sqes)
+            munmap(sqes, sqes_size);
+        if (cq_ring && cq_ring != sq_ring)
+            munmap(cq_ring, cq_map_size);
+        if (sq_ring)
+            munmap(sq_ring, sq_map_size);
+        sqes = nullptr;
+        cq_ring = sq_ring = nullptr;
+        if (ring_fd >= 0)
+            close(ring_fd);
+        ring_fd = -1;
+    }
+
+    int ring_fd = -1;
+    unsigned char * sq_ring = nullptr;
+    unsigned char * cq_ring = nullptr;
+    io_uring_sqe * sqes = nullptr;
+    size_t sq_map_size = 0;
+    size_t cq_map_size = 0;
+    size_t sqes_size = 0;
+    unsigned * sq_head = nullptr;
+    unsigned * sq_tail = nullptr;
+    unsigned * sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned local_sq_tail = 0;
+    unsigned * cq_head = nullptr;
+    unsigned * cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe * cqes = nullptr;
+};
+#endif
+}
+
+BatchFileLoader::BatchFileLoader(Backend backend, size_t num_threads, size_t queue_depth)
+    : backend(backend), num_threads(choose_num_threads(num_threads)), queue_depth(std::max(queue_depth, size_t(1)))
+{
+#ifdef HAS_IO_URING
+    if (backend != ThreadPoolBackend)
+        this->backend = IoUring(1).is_valid() ? IoUringBackend : ThreadPoolBackend;
+#else
+    this->backend = ThreadPoolBackend;
+#endif
+}
+
+size_t BatchFileLoader::load(ArrayView<const std::string> filenames, const ProcessFunction & process)
+{
+    if (backend == IoUringBackend)
+        return load_io_uring(filenames, process);
+    else
+        return load_thread_pool(filenames, process);
+}
+
+size_t BatchFileLoader::load_thread_pool(ArrayView<const std::string> filenames, const ProcessFunction & process)
+{
+    // with blocking syscalls every file in flight needs its own thread. that
+    // would mean creating queue_depth threads on every call, which costs more
+    // than the syscalls that it would overlap for small files. so this uses
+    // num_threads threads and the processing happens on the same threads
+    std::atomic<size_t> next_file(0);
+    std::atomic<size_t> num_failed(0);
+    auto work = [&]
+    {
+        std::unique_ptr<unsigned char[]> buffer;
+        size_t capacity = 0;
+        for (size_t i = next_file++; i < filenames.size(); i = next_file++)
+        {
+            UnixFile file(filenames[i], UnixFile::RDONLY);
+            struct stat file_info;
+            if (!file.is_valid() || fstat(file.file_descriptor, &file_info) != 0)
+            {
+                ++num_failed;
+                continue;
+            }
+            size_t size = file_info.st_size;
+            if (size > capacity)
+            {
+                buffer.reset(new unsigned char[size]);
+                capacity = size;
+            }
+            size_t bytes_read = 0;
+            while (bytes_read < size)
+            {
+                ssize_t result = pread(file.file_descriptor, buffer.get() + bytes_read, size - bytes_read, bytes_read);
+                if (result <= 0)
+                    break;
+                bytes_read += result;
+            }
+            if (bytes_read != size)
+            {
+                ++num_failed;
+                continue;
+            }
+            process(i, { buffer.get(), buffer.get() + size });
+        }
+    };
+    std::vector<std::thread> threads;
+    size_t total_threads = std::min(num_threads, filenames.size());
+    for (size_t i = 1; i < total_threads; ++i)
+        threads.emplace_back(work);
+    work();
+    for (std::thread & thread : threads)
+        thread.join();
+    return num_failed;
+}
+
+#ifdef HAS_IO_URING
+size_t BatchFileLoader::load_io_uring(ArrayView<const std::string> filenames, const ProcessFunction & process)
+{
+    // every file goes through open and statx at the same time, then one or
+    // more reads, then close. the operation is stored in the low bits of the
+    // user_data of every request, the index of the file in the rest
+    enum Operation : uint64_t
+    {
+        Open,
+        Stat,
+        Read,
+        Close
+    };
+    static constexpr uint64_t operation_bits = 2;
+    static constexpr uint64_t operation_mask = (1 << operation_bits) - 1;
+    struct FileState
+    {
+        int fd = -1;
+        int num_pending = 0;
+        bool failed = false;
+        bool stat_done = false;
+        struct statx stat_result;
+        std::unique_ptr<unsigned char[]> bytes;
+        size_t size = 0;
+        size_t bytes_read = 0;
+    };
+    // every file in flight has at most two requests in the kernel. with a
+    // submission queue that can hold all of them, the completion queue (which
+    // is twice as big) can never overflow
+    size_t max_in_flight = std::min(queue_depth, size_t(2048));
+    IoUring ring(unsigned(max_in_flight * 2));
+    if (!ring.is_valid())
+        return load_thread_pool(filenames, process);
+    std::vector<FileState> files(filenames.size());
+    std::deque<uint64_t> waiting_for_sqe;
+    size_t num_failed = 0;
+    size_t next_file = 0;
+    size_t num_in_flight = 0;
+    size_t num_submitted_not_completed = 0;
+    ProcessingPool pool(process, num_threads, queue_depth);
+
+    auto fill_sqe = [&](uint64_t request)
+    {
+        io_uring_sqe * sqe = ring.get_sqe();
+        if (!sqe)
+            return false;
+        size_t index = request >> operation_bits;
+        FileState & file = files[index];
+        switch (request & operation_mask)
+        {
+        case Open:
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uint64_t>(filenames[index].c_str());
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            break;
+        case Stat:
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = reinterpret_cast<uint64_t>(filenames[index].c_str());
+            sqe->len = STATX_SIZE;
+            sqe->off = reinterpret_cast<uint64_t>(&file.stat_result);
+            break;
+        case Read:
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = file.fd;
+            sqe->addr = reinterpret_cast<uint64_t>(file.bytes.get() + file.bytes_read);
+            sqe->len = unsigned(file.size - file.bytes_read);
+            sqe->off = file.bytes_read;
+            break;
+        case Close:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = file.fd;
+            break;
+        }
+        sqe->user_data = request;
+        ++num_submitted_not_completed;
+        return true;
+    };
+    auto request = [&](size_t index, Operation operation)
+    {
+        ++files[index].num_pending;
+        waiting_for_sqe.push_back((uint64_t(index) << operation_bits) | operation);
+    };
+    auto finish_file = [&](size_t index)
+    {
+        FileState & file = files[index];
+        if (file.failed)
+            ++num_failed;
+        else
+            pool.push(index, std::move(file.bytes), file.size);
+        if (file.fd >= 0)
+            request(index, Close);
+        else
+            --num_in_flight;
+    };
+    auto start_reading_if_ready = [&](size_t index)
+    {
+        FileState & file = files[index];
+        if (file.num_pending || file.fd < 0 || !file.stat_done)
+            return;
+        file.size = file.stat_result.stx_size;
+        file.bytes.reset(new unsigned char[std::max(file.size, size_t(1))]);
+        if (file.size)
+            request(index, Read);
+        else
+            finish_file(index);
+    };
+
+    while (next_file < files.size() || num_in_flight)
+    {
+        while (next_file < files.size() && num_in_flight < max_in_flight)
+        {
+            request(next_file, Open);
+            request(next_file, Stat);
+            ++next_file;
+            ++num_in_flight;
+        }
+        while (!waiting_for_sqe.empty() && fill_sqe(waiting_for_sqe.front()))
+            waiting_for_sqe.pop_front();
+        if (!num_submitted_not_completed)
+            continue;
+        ring.submit_and_wait();
+        ring.for_each_completion([&](const io_uring_cqe & completion)
+        {
+            --num_submitted_not_completed;
+            size_t index = completion.user_data >> operation_bits;
+            FileState & file = files[index];
+            --file.num_pending;
+            switch (completion.user_data & operation_mask)
+            {
+            case Open:
+                if (completion.res < 0)
+                    file.failed = true;
+                else
+                    file.fd = completion.res;
+                break;
+            case Stat:
+                if (completion.res < 0)
+                    file.failed = true;
+                else
+                    file.stat_done = true;
+                break;
+            case Read:
+                if (completion.res <= 0)
+                    file.failed = true;
+                else
+                {
+                    file.bytes_read += completion.res;
+                    if (file.bytes_read < file.size)
+                    {
+                        request(index, Read);
+                        return;
+                    }
+                }
+                finish_file(index);
+                return;
+            case Close:
+                file.fd = -1;
+                --num_in_flight;
+                return;
+            }
+            // both the open and the stat have to be done before reading
+            if (file.num_pending)
+                return;
+            if (file.failed)
+                finish_file(index);
+            else
+                start_reading_if_ready(index);
+        });
+    }
+    return num_failed;
+}
+#else
+size_t BatchFileLoader::load_io_uring(ArrayView<const std::string> filenames, const ProcessFunction & process)
+{
+    return load_thread_pool(filenames, process);
+}
+#endif
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+
+TEST(batch_file_loader, load_files)
+{
+    std::vector<std::string> filenames;
+    std::vector<std::string> contents;
+    for (int i = 0; i < 300; ++i)
+    {
+        filenames.push_back("/tmp/batch_file_loader_test_" + std::to_string(i));
+        // a few empty files and a few bigger ones
+        contents.push_back(std::string(size_t(i % 7 == 0 ? 0 : i * 37), char('a' + i % 26)));
+        MMappedFileWrite file(filenames.back());
+        ASSERT_TRUE(file.write({ reinterpret_cast<const unsigned char *>(contents.back().data()), reinterpret_cast<const unsigned char *>(contents.back().data() + contents.back().size()) }));
+    }
+    filenames.push_back("/tmp/this_file_does_not_exist_hopefully");
+    for (BatchFileLoader::Backend backend : { BatchFileLoader::AutomaticBackend, BatchFileLoader::ThreadPoolBackend })
+    {
+        std::vector<std::string> loaded(filenames.size(), "not loaded");
+        BatchFileLoader loader(backend, 3, 16);
+        size_t num_failed = loader.load({ filenames.data(), filenames.data() + filenames.size() }, [&](size_t index, ArrayView<const unsigned char> bytes)
+        {
+            loaded[index].assign(bytes.begin(), bytes.end());
+        });
+        ASSERT_EQ(1u, num_failed);
+        ASSERT_EQ("not loaded", loaded.back());
+        loaded.pop_back();
+        ASSERT_EQ(contents, loaded);
+    }
+}
+
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "util/view.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// loads lots of small files at once. opening and mapping files one by one
+// costs several syscalls per file, and for small files that is more expensive
+// than reading the bytes. with io_uring the opens, size lookups and reads of
+// many files are all submitted together and the kernel works on them in
+// parallel. where io_uring isn't available (old kernels, or it's disabled) a
+// pool of threads does the same thing with normal syscalls.
+// the contents are handed to a pool of worker threads, so deserialization
+// happens in parallel to the loading
+struct BatchFileLoader
+{
+    enum Backend
+    {
+        AutomaticBackend,
+        IoUringBackend,
+        ThreadPoolBackend
+    };
+    static constexpr size_t default_queue_depth = 128;
+
+    // num_threads = 0 means one per core. queue_depth is the number of files
+    // that io_uring loads at the same time. the thread pool fallback loads
+    // num_threads files at a time
+    BatchFileLoader(Backend backend = AutomaticBackend, size_t num_threads = 0, size_t queue_depth = default_queue_depth);
+
+    // io_uring if it was asked for and the kernel supports it
+    Backend get_backend() const
+    {
+        return backend;
+    }
+
+    // calls process with the index into filenames and the contents of the
+    // file, in no particular order and from several threads at the same time.
+    // the bytes are only valid during the call. process must not throw.
+    // returns the number of files that couldn't be loaded
+    typedef std::function<void (size_t index, ArrayView<const unsigned char> bytes)> ProcessFunction;
+    size_t load(ArrayView<const std::string> filenames, const ProcessFunction & process);
+
+private:
+    size_t load_io_uring(ArrayView<const std::string> filenames, const ProcessFunction & process);
+    size_t load_thread_pool(ArrayView<const std::string> filenames, const ProcessFunction & process);
+
+    Backend backend;
+    size_t num_threads;
+    size_t queue_depth;
+};
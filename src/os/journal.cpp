@@ -0,0 +1,382 @@
+#include "os/journal.hpp"
+#include "debug/assert.hpp"
+#include "util/crc32.hpp"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+static const char segment_extension[] = ".journal";
+
+std::string segment_filename(const std::string & directory, uint64_t number)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%020llu", static_cast<unsigned long long>(number));
+    return directory + '/' + name + segment_extension;
+}
+
+// all segments in the directory, sorted from oldest to newest
+std::vector<std::pair<uint64_t, std::string>> list_segments(const std::string & directory)
+{
+    std::vector<std::pair<uint64_t, std::string>> result;
+    DIR * dir = opendir(directory.c_str());
+    if (!dir)
+        return result;
+    size_t extension_size = sizeof(segment_extension) - 1;
+    while (dirent * entry = readdir(dir))
+    {
+        StringView<const char> name(entry->d_name, entry->d_name + strlen(entry->d_name));
+        if (name.size() <= extension_size || !std::equal(name.end() - extension_size, name.end(), segment_extension))
+            continue;
+        if (!std::all_of(name.begin(), name.end() - extension_size, [](char c){ return c >= '0' && c <= '9'; }))
+            continue;
+        result.emplace_back(strtoull(name.begin(), nullptr, 10), directory + '/' + entry->d_name);
+    }
+    closedir(dir);
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+uint32_t record_checksum(uint32_t size, ArrayView<const unsigned char> payload)
+{
+    const unsigned char * size_bytes = reinterpret_cast<const unsigned char *>(&size);
+    return crc32c(payload, crc32c({ size_bytes, size_bytes + sizeof(size) }));
+}
+
+// false if there is no complete and intact record at offset. that includes
+// a header that got cut off, a size that goes past the end and zeros that the
+// file system left behind after a crash
+bool parse_record(ArrayView<const unsigned char> bytes, size_t offset, ArrayView<const unsigned char> & payload)
+{
+    JournalRecordHeader header;
+    if (bytes.size() - offset < sizeof(header))
+        return false;
+    memcpy(&header, bytes.begin() + offset, sizeof(header));
+    offset += sizeof(header);
+    if (bytes.size() - offset < header.size)
+        return false;
+    payload = { bytes.begin() + offset, bytes.begin() + offset + header.size };
+    return record_checksum(header.size, payload) == header.checksum;
+}
+
+bool sync_directory(const std::string & directory)
+{
+    UnixFile dir(directory, O_RDONLY | O_DIRECTORY);
+    return dir.is_valid() && fsync(dir.file_descriptor) == 0;
+}
+}
+
+JournalWriter::PendingBuffer::PendingBuffer()
+{
+    set_size(0);
+}
+void JournalWriter::PendingBuffer::set_size(size_t size)
+{
+    setp(&storage[0], &storage[0] + storage.size());
+    // pbump only takes an int
+    for (size_t step = std::numeric_limits<int>::max(); size > 0; size -= std::min(size, step))
+        pbump(int(std::min(size, step)));
+}
+void JournalWriter::PendingBuffer::reserve(size_t min_space)
+{
+    if (size_t(epptr() - pptr()) >= min_space)
+        return;
+    size_t used = size();
+    storage.resize(std::max({ used + min_space, 2 * storage.size(), size_t(4096) }));
+    set_size(used);
+}
+void JournalWriter::PendingBuffer::append_zeros(size_t count)
+{
+    reserve(count);
+    memset(pptr(), 0, count);
+    set_size(size() + count);
+}
+void JournalWriter::PendingBuffer::erase_front(size_t count)
+{
+    size_t remaining = size() - count;
+    memmove(pbase(), pbase() + count, remaining);
+    set_size(remaining);
+}
+
+JournalWriter::PendingBuffer::int_type JournalWriter::PendingBuffer::overflow(int_type c)
+{
+    reserve(1);
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+std::streamsize JournalWriter::PendingBuffer::xsputn(const char * bytes, std::streamsize count)
+{
+    reserve(count);
+    memcpy(pptr(), bytes, count);
+    set_size(size() + count);
+    return count;
+}
+
+JournalWriter::JournalWriter(StringView<const char> directory_, FsyncPolicy fsync_policy, size_t group_commit_size, size_t max_segment_size)
+    : directory(directory_.begin(), directory_.end()), fsync_policy(fsync_policy), group_commit_size(group_commit_size), max_segment_size(max_segment_size), pending_stream(&pending)
+{
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        failed = true;
+        return;
+    }
+    std::vector<std::pair<uint64_t, std::string>> segments = list_segments(directory);
+    if (segments.empty())
+        return;
+    // the previous writer may have died in the middle of a write. cut off
+    // what it left behind so that the torn record isn't in the middle of the
+    // journal once there are newer segments
+    const std::string & newest = segments.back().second;
+    size_t valid_size = 0;
+    size_t file_size = 0;
+    {
+        MMappedFileRead file(newest);
+        ArrayView<const unsigned char> bytes = file.get_bytes();
+        file_size = bytes.size();
+        ArrayView<const unsigned char> payload;
+        while (parse_record(bytes, valid_size, payload))
+            valid_size += sizeof(JournalRecordHeader) + payload.size();
+    }
+    if (valid_size != file_size && truncate(newest.c_str(), valid_size) != 0)
+        failed = true;
+    segment_number = segments.back().first + 1;
+}
+
+JournalWriter::~JournalWriter()
+{
+    commit();
+    close_segment();
+}
+
+void JournalWriter::append_bytes(ArrayView<const unsigned char> bytes)
+{
+    begin_record().write(reinterpret_cast<const char *>(bytes.begin()), bytes.size());
+    end_record();
+}
+
+std::ostream & JournalWriter::begin_record()
+{
+    record_start = pending.size();
+    pending.append_zeros(sizeof(JournalRecordHeader));
+    return pending_stream;
+}
+
+void JournalWriter::end_record()
+{
+    size_t payload_start = record_start + sizeof(JournalRecordHeader);
+    size_t payload_size = pending.size() - payload_start;
+    if (payload_size > std::numeric_limits<uint32_t>::max()) RAW_THROW(std::runtime_error("journal records have to be smaller than 4 GiB"));
+    const unsigned char * payload = reinterpret_cast<const unsigned char *>(pending.data()) + payload_start;
+    JournalRecordHeader header;
+    header.size = uint32_t(payload_size);
+    header.checksum = record_checksum(header.size, { payload, payload + payload_size });
+    memcpy(pending.data() + record_start, &header, sizeof(header));
+
+    // records never get split across segments, so if this one doesn't fit
+    // any more, everything before it finishes the current segment. a record
+    // that is bigger than a whole segment gets a segment of its own
+    if (segment_size + pending.size() > max_segment_size && segment_size + record_start > 0)
+    {
+        write_to_segment(record_start);
+        close_segment();
+        pending.erase_front(record_start);
+    }
+    record_start = pending.size();
+    if (pending.size() >= group_commit_size)
+        commit();
+}
+
+bool JournalWriter::commit()
+{
+    if (write_to_segment(pending.size()) && fsync_policy == FsyncOnCommit)
+        sync_segment();
+    pending.clear();
+    record_start = 0;
+    return !failed;
+}
+
+bool JournalWriter::write_to_segment(size_t num_bytes)
+{
+    if (failed)
+        return false;
+    if (!num_bytes)
+        return true;
+    if (!segment)
+    {
+        std::string filename = segment_filename(directory, segment_number);
+        segment.reset(new UnixFile(filename, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644));
+        // the new file only survives a crash if the directory entry does
+        if (!segment->is_valid() || (fsync_policy != NoFsync && !sync_directory(directory)))
+        {
+            failed = true;
+            return false;
+        }
+    }
+    const unsigned char * bytes = reinterpret_cast<const unsigned char *>(pending.data());
+    size_t written = segment->write({ bytes, bytes + num_bytes });
+    segment_size += written;
+    if (written != num_bytes)
+        failed = true;
+    return !failed;
+}
+
+bool JournalWriter::sync_segment()
+{
+    if (segment && fdatasync(segment->file_descriptor) != 0)
+        failed = true;
+    return !failed;
+}
+
+void JournalWriter::close_segment()
+{
+    if (!segment)
+        return;
+    if (fsync_policy == FsyncOnRotate)
+        sync_segment();
+    segment.reset();
+    ++segment_number;
+    segment_size = 0;
+}
+
+JournalReader::JournalReader(StringView<const char> directory, int read_strategy)
+    : read_strategy(read_strategy)
+{
+    for (std::pair<uint64_t, std::string> & segment : list_segments(std::string(directory.begin(), directory.end())))
+        segments.push_back(std::move(segment.second));
+}
+JournalReader::~JournalReader() = default;
+
+bool JournalReader::open_next_segment()
+{
+    if (next_segment == segments.size())
+        return false;
+    file.reset(new MMappedFileRead(segments[next_segment], read_strategy));
+    ++next_segment;
+    offset = 0;
+    return true;
+}
+
+bool JournalReader::next()
+{
+    for (;;)
+    {
+        if (!file && !open_next_segment())
+            return false;
+        ArrayView<const unsigned char> bytes = file->get_bytes();
+        if (offset == bytes.size())
+        {
+            file.reset();
+            continue;
+        }
+        if (parse_record(bytes, offset, current_record))
+        {
+            offset += sizeof(JournalRecordHeader) + current_record.size();
+            return true;
+        }
+        current_record = {};
+        if (next_segment != segments.size()) RAW_THROW(std::runtime_error("corrupt record in the middle of the journal, in " + segments[next_segment - 1]));
+        torn_tail = true;
+        return false;
+    }
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+
+namespace
+{
+std::string fresh_journal_directory(const char * name)
+{
+    std::string directory = std::string("/tmp/") + name;
+    for (std::pair<uint64_t, std::string> & segment : list_segments(directory))
+        unlink(segment.second.c_str());
+    return directory;
+}
+}
+
+TEST(journal, roundtrip_with_rotation)
+{
+    std::string directory = fresh_journal_directory("journal_test_roundtrip");
+    std::vector<std::vector<int>> records;
+    for (int i = 0; i < 200; ++i)
+        records.emplace_back(size_t(i % 17), i);
+    {
+        // small segments and groups so that both happen a lot
+        JournalWriter writer(directory, JournalWriter::FsyncOnRotate, 100, 500);
+        for (const std::vector<int> & record : records)
+            writer.append(record);
+        ASSERT_TRUE(writer.commit());
+    }
+    ASSERT_LT(5u, list_segments(directory).size());
+    JournalReader reader(directory);
+    size_t index = 0;
+    for (metaf::BinaryInput input : reader)
+    {
+        std::vector<int> record;
+        metaf::read_binary(input, record);
+        ASSERT_LT(index, records.size());
+        ASSERT_EQ(records[index], record);
+        ++index;
+    }
+    ASSERT_EQ(records.size(), index);
+    ASSERT_FALSE(reader.found_torn_tail());
+}
+
+TEST(journal, torn_tail)
+{
+    std::string directory = fresh_journal_directory("journal_test_torn_tail");
+    {
+        JournalWriter writer(directory, JournalWriter::NoFsync);
+        for (int i = 0; i < 10; ++i)
+            writer.append(std::string(10, char('a' + i)));
+    }
+    // cut the last record in half, as if the machine died while writing it
+    std::string segment = list_segments(directory).back().second;
+    struct stat info;
+    ASSERT_EQ(0, stat(segment.c_str(), &info));
+    ASSERT_EQ(0, truncate(segment.c_str(), info.st_size - 5));
+    auto count_records = [&](bool expect_torn_tail)
+    {
+        JournalReader reader(directory);
+        size_t count = 0;
+        while (reader.next())
+        {
+            std::string record;
+            metaf::BinaryInput input = reader.get_record();
+            metaf::read_binary(input, record);
+            EXPECT_EQ(std::string(10, char('a' + count % 10)), record);
+            ++count;
+        }
+        EXPECT_EQ(expect_torn_tail, reader.found_torn_tail());
+        return count;
+    };
+    ASSERT_EQ(9u, count_records(true));
+    {
+        // a new writer cuts off the torn record and continues in a new segment
+        JournalWriter writer(directory, JournalWriter::NoFsync);
+        writer.append(std::string(10, 'j'));
+    }
+    ASSERT_EQ(2u, list_segments(directory).size());
+    ASSERT_EQ(10u, count_records(false));
+
+    // but a broken record in an older segment is an error
+    ASSERT_EQ(0, truncate(list_segments(directory).front().second.c_str(), 20));
+    JournalReader reader(directory);
+    ASSERT_THROW(while (reader.next()) {}, std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "metafast/metafast.hpp"
+#include "os/mmapped_file.hpp"
+#include "util/view.hpp"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+// an append only log of records, stored in a directory as a sequence of
+// segment files. every record starts with this header, followed by size bytes
+// of payload. the checksum is the crc32c of the size and the payload, so a
+// record that was only partially written (because the process died in the
+// middle of a write) can be detected when reading
+struct JournalRecordHeader
+{
+    uint32_t size;
+    uint32_t checksum;
+};
+
+struct JournalWriter
+{
+    enum FsyncPolicy
+    {
+        // leave it to the kernel. a crash of the process loses nothing that
+        // was committed, but a crash of the machine may
+        NoFsync,
+        // every commit waits until the data is on disk
+        FsyncOnCommit,
+        // only wait for the disk when a segment is full and when closing
+        FsyncOnRotate
+    };
+    static constexpr size_t default_group_commit_size = 64 * 1024;
+    static constexpr size_t default_max_segment_size = 64 * 1024 * 1024;
+
+    // starts a new segment after the existing ones. if the newest existing
+    // segment ends in a torn record, that record gets cut off
+    JournalWriter(StringView<const char> directory, FsyncPolicy fsync_policy = FsyncOnCommit, size_t group_commit_size = default_group_commit_size, size_t max_segment_size = default_max_segment_size);
+    // commits whatever is still pending
+    ~JournalWriter();
+
+    template<typename T>
+    void append(const T & record)
+    {
+        metaf::BinaryOutput output(begin_record());
+        metaf::write_binary(output, record);
+        end_record();
+    }
+    void append_bytes(ArrayView<const unsigned char> bytes);
+
+    // for writing a record piece by piece. everything written to the stream
+    // between these two calls becomes one record
+    std::ostream & begin_record();
+    void end_record();
+
+    // records are collected in memory and written in groups of about
+    // group_commit_size bytes, with one write call per group. this writes the
+    // current group right now. returns false if a write failed
+    bool commit();
+    bool is_valid() const
+    {
+        return !failed;
+    }
+
+private:
+    // the records that haven't been written yet. the put area covers all of
+    // the storage, so metaf::BinaryOutput can write into it without a
+    // virtual call per byte
+    struct PendingBuffer : std::streambuf
+    {
+        PendingBuffer();
+
+        size_t size() const
+        {
+            return pptr() - pbase();
+        }
+        char * data()
+        {
+            return pbase();
+        }
+        void append_zeros(size_t count);
+        void erase_front(size_t count);
+        void clear()
+        {
+            setp(pbase(), epptr());
+        }
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char * bytes, std::streamsize count) override;
+
+    private:
+        void reserve(size_t min_space);
+        void set_size(size_t size);
+
+        std::string storage;
+    };
+
+    bool write_to_segment(size_t num_bytes);
+    void close_segment();
+    bool sync_segment();
+
+    std::string directory;
+    FsyncPolicy fsync_policy;
+    size_t group_commit_size;
+    size_t max_segment_size;
+    std::unique_ptr<UnixFile> segment;
+    uint64_t segment_number = 0;
+    size_t segment_size = 0;
+    PendingBuffer pending;
+    std::ostream pending_stream;
+    size_t record_start = 0;
+    bool failed = false;
+};
+
+// replays a journal written by JournalWriter. the segments are mapped into
+// memory one at a time and every record is handed out as a view into the
+// mapping, so nothing gets copied. if the newest segment ends in a torn
+// record, the replay stops before it. a broken record in any other segment
+// means that the journal is corrupt, and next() throws
+struct JournalReader
+{
+    JournalReader(StringView<const char> directory, int read_strategy = MMappedFileRead::Sequential);
+    ~JournalReader();
+
+    // moves to the next record. returns false at the end
+    bool next();
+    ArrayView<const unsigned char> get_record_bytes() const
+    {
+        return current_record;
+    }
+    metaf::BinaryInput get_record() const
+    {
+        return metaf::BinaryInput(current_record);
+    }
+
+    // true if the replay stopped at a torn record at the end
+    bool found_torn_tail() const
+    {
+        return torn_tail;
+    }
+
+    struct iterator
+    {
+        metaf::BinaryInput operator*() const
+        {
+            return reader->get_record();
+        }
+        iterator & operator++()
+        {
+            if (!reader->next())
+                reader = nullptr;
+            return *this;
+        }
+        bool operator==(const iterator & other) const
+        {
+            return reader == other.reader;
+        }
+        bool operator!=(const iterator & other) const
+        {
+            return reader != other.reader;
+        }
+
+        JournalReader * reader;
+    };
+    // the journal can only be walked once
+    iterator begin()
+    {
+        return ++iterator{ this };
+    }
+    iterator end()
+    {
+        return iterator{ nullptr };
+    }
+
+private:
+    bool open_next_segment();
+
+    int read_strategy;
+    std::vector<std::string> segments;
+    size_t next_segment = 0;
+    std::unique_ptr<MMappedFileRead> file;
+    size_t offset = 0;
+    ArrayView<const unsigned char> current_record;
+    bool torn_tail = false;
+};
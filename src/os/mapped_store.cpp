@@ -0,0 +1,160 @@
+#include "os/mapped_store.hpp"
+#include "debug/assert.hpp"
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+void MappedStoreBuilder::add(uint64_t hash, ArrayView<const unsigned char> key, ArrayView<const unsigned char> value)
+{
+    if (key.size() > std::numeric_limits<uint32_t>::max() || value.size() > std::numeric_limits<uint32_t>::max()) RAW_THROW(std::runtime_error("keys and values in a store have to be smaller than 4 GiB"));
+    entries.push_back({ hash, data.size(), uint32_t(key.size()), uint32_t(value.size()) });
+    data.append(reinterpret_cast<const char *>(key.begin()), key.size());
+    data.append(reinterpret_cast<const char *>(value.begin()), value.size());
+}
+
+bool MappedStoreBuilder::write(StringView<const char> filename) const
+{
+    MappedStoreHeader header;
+    header.magic = MappedStoreHeader::expected_magic;
+    header.version = MappedStoreHeader::current_version;
+    header.num_entries = entries.size();
+    // at most half full, so that the probe sequences stay short
+    header.num_slots = 1;
+    while (header.num_slots < 2 * entries.size())
+        header.num_slots *= 2;
+    uint64_t data_offset = sizeof(header) + header.num_slots * sizeof(MappedStoreSlot);
+
+    std::vector<MappedStoreSlot> slots(header.num_slots, MappedStoreSlot{ 0, MappedStoreSlot::empty, 0, 0 });
+    uint64_t slot_mask = header.num_slots - 1;
+    for (const Entry & entry : entries)
+    {
+        uint64_t index = entry.hash & slot_mask;
+        while (slots[index].offset != MappedStoreSlot::empty)
+            index = (index + 1) & slot_mask;
+        slots[index] = { entry.hash, data_offset + entry.offset, entry.key_size, entry.value_size };
+    }
+
+    MMappedFileWrite file(filename, MMappedFileWrite::NoSync, data_offset + data.size());
+    auto as_bytes = [](const void * begin, size_t size)
+    {
+        const unsigned char * bytes = static_cast<const unsigned char *>(begin);
+        return ArrayView<const unsigned char>(bytes, bytes + size);
+    };
+    return file.is_valid()
+        && file.write(as_bytes(&header, sizeof(header)))
+        && file.write(as_bytes(slots.data(), slots.size() * sizeof(MappedStoreSlot)))
+        && file.write(as_bytes(data.data(), data.size()))
+        && file.close();
+}
+
+MappedStore::MappedStore(StringView<const char> filename, int read_strategy)
+    : file(filename, read_strategy)
+{
+    ArrayView<const unsigned char> bytes = file.get_bytes();
+    MappedStoreHeader header;
+    if (bytes.size() < sizeof(header))
+        return;
+    memcpy(&header, bytes.begin(), sizeof(header));
+    if (header.magic != MappedStoreHeader::expected_magic || header.version != MappedStoreHeader::current_version)
+        return;
+    if (!header.num_slots || (header.num_slots & (header.num_slots - 1)) || header.num_entries >= header.num_slots)
+        return;
+    if (header.num_slots > (bytes.size() - sizeof(header)) / sizeof(MappedStoreSlot))
+        return;
+    // mmap returns page aligned memory, so the slots after the 24 byte header
+    // are aligned well enough to be read in place
+    slots = reinterpret_cast<const MappedStoreSlot *>(bytes.begin() + sizeof(header));
+    slot_mask = header.num_slots - 1;
+    num_entries = header.num_entries;
+}
+
+bool MappedStore::find(uint64_t hash, ArrayView<const unsigned char> key, ArrayView<const unsigned char> & value) const
+{
+    if (!slots)
+        return false;
+    ArrayView<const unsigned char> bytes = file.get_bytes();
+    for (uint64_t index = hash & slot_mask;; index = (index + 1) & slot_mask)
+    {
+        const MappedStoreSlot & slot = slots[index];
+        if (slot.offset == MappedStoreSlot::empty)
+            return false;
+        if (slot.hash != hash || slot.key_size != key.size())
+            continue;
+        // the file may be damaged, so don't trust the offsets
+        if (slot.offset > bytes.size() || uint64_t(slot.key_size) + slot.value_size > bytes.size() - slot.offset)
+            return false;
+        const unsigned char * stored_key = bytes.begin() + slot.offset;
+        if (memcmp(stored_key, key.begin(), key.size()) != 0)
+            continue;
+        value = { stored_key + slot.key_size, stored_key + slot.key_size + slot.value_size };
+        return true;
+    }
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+#include "metafast/metafast_store.hpp"
+#include "metafast/metafast_stl.hpp"
+
+TEST(mapped_store, raw_bytes)
+{
+    std::string filename = "/tmp/mapped_store_raw_test";
+    auto view = [](const std::string & str)
+    {
+        return ArrayView<const unsigned char>(reinterpret_cast<const unsigned char *>(str.data()), reinterpret_cast<const unsigned char *>(str.data() + str.size()));
+    };
+    MappedStoreBuilder builder;
+    // the same hash for everything, to test the collision handling
+    builder.add(5, view("a"), view("first"));
+    builder.add(5, view("b"), view(""));
+    builder.add(5, view("cc"), view("third"));
+    ASSERT_TRUE(builder.write(filename));
+
+    MappedStore store(filename);
+    ASSERT_TRUE(store.is_valid());
+    ASSERT_EQ(3u, store.size());
+    ArrayView<const unsigned char> value;
+    ASSERT_TRUE(store.find(5, view("a"), value));
+    ASSERT_EQ("first", std::string(value.begin(), value.end()));
+    ASSERT_TRUE(store.find(5, view("b"), value));
+    ASSERT_TRUE(value.empty());
+    ASSERT_TRUE(store.find(5, view("cc"), value));
+    ASSERT_EQ("third", std::string(value.begin(), value.end()));
+    ASSERT_FALSE(store.find(5, view("d"), value));
+    ASSERT_FALSE(store.find(6, view("a"), value));
+
+    ASSERT_FALSE(MappedStore("/tmp/this_file_does_not_exist_hopefully").is_valid());
+}
+
+TEST(mapped_store, reflected_values)
+{
+    std::string filename = "/tmp/mapped_store_metafast_test";
+    std::map<std::string, std::vector<int>> table;
+    for (int i = 0; i < 1000; ++i)
+        table["key" + std::to_string(i)] = std::vector<int>(size_t(i % 7), i);
+    ASSERT_TRUE(metaf::write_store(filename, table));
+
+    metaf::Store<std::string, std::vector<int>> store(filename);
+    ASSERT_TRUE(store.is_valid());
+    ASSERT_EQ(table.size(), store.size());
+    std::vector<int> value;
+    for (const auto & entry : table)
+    {
+        ASSERT_TRUE(store.find(entry.first, value));
+        ASSERT_EQ(entry.second, value);
+    }
+    ASSERT_TRUE(store.find(HashedString<uint64_t, StableStringHash>("key123"), value));
+    ASSERT_EQ(table["key123"], value);
+    ASSERT_FALSE(store.find(std::string("missing"), value));
+
+    // keys don't have to be strings
+    std::map<int, std::string> by_number = { { 1, "one" }, { 2, "two" }, { -3, "minus three" } };
+    ASSERT_TRUE(metaf::write_store(filename, by_number));
+    metaf::Store<int, std::string> number_store(filename);
+    std::string name;
+    ASSERT_TRUE(number_store.find(-3, name));
+    ASSERT_EQ("minus three", name);
+    ASSERT_FALSE(number_store.find(3, name));
+}
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "os/mmapped_file.hpp"
+#include "util/view.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// a read only key value store in a file that gets mapped into memory. opening
+// it only maps the file and checks the header, no matter how many entries it
+// has, and a lookup only touches the index slots that it probes plus the key
+// and value that it finds. the keys and values are plain bytes, see
+// metafast_store.hpp for storing reflected types.
+//
+// the file starts with a MappedStoreHeader, followed by an open addressing
+// hash table with linear probing, followed by the keys and values. the hash
+// has to be the same in every process that reads the file, so don't use
+// std::hash for it
+struct MappedStoreHeader
+{
+    static constexpr uint32_t expected_magic = 0x5453464d; // "MFST"
+    static constexpr uint32_t current_version = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_entries;
+    // always a power of two, and at least one slot is empty
+    uint64_t num_slots;
+};
+struct MappedStoreSlot
+{
+    static constexpr uint64_t empty = ~uint64_t(0);
+
+    uint64_t hash;
+    // offset of the key from the start of the file, or empty. the value
+    // comes right after the key
+    uint64_t offset;
+    uint32_t key_size;
+    uint32_t value_size;
+};
+
+struct MappedStoreBuilder
+{
+    // the keys have to be unique
+    void add(uint64_t hash, ArrayView<const unsigned char> key, ArrayView<const unsigned char> value);
+    // returns false if the file couldn't be written
+    bool write(StringView<const char> filename) const;
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        uint64_t offset;
+        uint32_t key_size;
+        uint32_t value_size;
+    };
+    std::vector<Entry> entries;
+    std::string data;
+};
+
+struct MappedStore
+{
+    MappedStore(StringView<const char> filename, int read_strategy = MMappedFileRead::DefaultRead);
+
+    // false if the file doesn't exist or isn't a store
+    bool is_valid() const
+    {
+        return slots != nullptr;
+    }
+    size_t size() const
+    {
+        return num_entries;
+    }
+
+    // the value is a view into the mapped file
+    bool find(uint64_t hash, ArrayView<const unsigned char> key, ArrayView<const unsigned char> & value) const;
+
+private:
+    MMappedFileRead file;
+    const MappedStoreSlot * slots = nullptr;
+    uint64_t slot_mask = 0;
+    size_t num_entries = 0;
+};
@@ -1,13 +1,24 @@
 #include "os/mmapped_file.hpp"
+#include "os/memoryManager.hpp"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <algorithm>
+#include <cerrno>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 const int UnixFile::RDONLY = O_RDONLY;
 const int UnixFile::RDWR = O_RDWR;
 const int UnixFile::WRONLY = O_WRONLY;
+const int UnixFile::CREAT = O_CREAT;
+const int UnixFile::TRUNC = O_TRUNC;
 
 UnixFile::UnixFile(StringView<const char> filename, int flags)
     : file_descriptor(open(filename.begin(), flags))
@@ -38,10 +49,22 @@ size_t UnixFile::read(ArrayView<unsigned char> bytes)
 {
     return ::read(file_descriptor, bytes.begin(), bytes.size());
 }
+size_t UnixFile::write(ArrayView<const unsigned char> bytes)
+{
+    size_t written = 0;
+    while (written < bytes.size())
+    {
+        ssize_t result = ::write(file_descriptor, bytes.begin() + written, bytes.size() - written);
+        if (result <= 0)
+            break;
+        written += result;
+    }
+    return written;
+}
 
 struct MMappedFileRead::Internals
 {
-    Internals(StringView<const char> filename)
+    Internals(StringView<const char> filename, int read_strategy)
         : file(filename, O_RDONLY)
     {
         if (!file.is_valid())
@@ -49,28 +72,113 @@ struct MMappedFileRead::Internals
         struct stat file_info;
         if (fstat(file.file_descriptor, &file_info) == -1 || !file_info.st_size)
             return;
-        void * mapped = mmap(nullptr, file_info.st_size, PROT_READ, MAP_PRIVATE, file.file_descriptor, 0);
-        if (!mapped)
+        int flags = MAP_PRIVATE;
+        if (read_strategy & Populate)
+            flags |= MAP_POPULATE;
+        void * mapped = mmap(nullptr, file_info.st_size, PROT_READ, flags, file.file_descriptor, 0);
+        if (mapped == MAP_FAILED)
             return;
-        if (file_info.st_size == 0)
+        file_contents = { static_cast<unsigned char *>(mapped), static_cast<unsigned char *>(mapped) + file_info.st_size };
+        // these are only advice, so it's fine if they fail
+        if (read_strategy & Sequential)
+            madvise(mapped, file_contents.size(), MADV_SEQUENTIAL);
+        if (read_strategy & WillNeed)
+            madvise(mapped, file_contents.size(), MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+        if (read_strategy & HugePages)
+            madvise(mapped, file_contents.size(), MADV_HUGEPAGE);
+#endif
+        if (read_strategy & BackgroundPrefetch)
+            prefetch_thread = std::thread([this]{ prefetch(); });
+    }
+    ~Internals()
+    {
+        unmap();
+    }
+
+    void prefetch()
+    {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        unsigned char sum = 0;
+        size_t window = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(prefetch_mutex);
+                for (;;)
+                {
+                    if (stop_prefetching)
+                    {
+                        prefetch_checksum = sum;
+                        return;
+                    }
+                    // if the reader went past the prefetcher or back before
+                    // it, the windows in between are of no use any more
+                    size_t reader_window = read_position - read_position % prefetch_window_size;
+                    if (window < reader_window || window > read_position + prefetch_distance)
+                        window = reader_window;
+                    if (window < std::min(read_position + prefetch_distance, file_contents.size()))
+                        break;
+                    prefetch_wakeup.wait(lock);
+                }
+            }
+            size_t window_end = std::min(window + prefetch_window_size, file_contents.size());
+            // let the kernel read the window in one go, then touch every page
+            // so that the page faults happen here and not on the reader thread
+            madvise(file_contents.begin() + window, window_end - window, MADV_WILLNEED);
+            for (size_t i = window; i < window_end; i += page_size)
+                sum += *static_cast<volatile const unsigned char *>(file_contents.begin() + i);
+            window = window_end;
+        }
+    }
+    void set_read_position(size_t offset)
+    {
+        if (!prefetch_thread.joinable())
         {
-            munmap(mapped, 0);
+            read_position = offset;
             return;
         }
-        file_contents = { static_cast<unsigned char *>(mapped), static_cast<unsigned char *>(mapped) + file_info.st_size };
+        {
+            std::lock_guard<std::mutex> lock(prefetch_mutex);
+            read_position = offset;
+        }
+        prefetch_wakeup.notify_one();
     }
-    ~Internals()
+
+    void unmap()
     {
+        if (prefetch_thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(prefetch_mutex);
+                stop_prefetching = true;
+            }
+            prefetch_wakeup.notify_one();
+            prefetch_thread.join();
+        }
         if (!file_contents.empty())
+        {
             munmap(file_contents.begin(), file_contents.size());
+            file_contents = {};
+        }
     }
 
     UnixFile file;
     ArrayView<unsigned char> file_contents;
+    std::thread prefetch_thread;
+    // these are protected by the mutex
+    std::mutex prefetch_mutex;
+    std::condition_variable prefetch_wakeup;
+    size_t read_position = 0;
+    bool stop_prefetching = false;
+    // where next_chunk() continues
+    size_t chunk_position = 0;
+    // so that the compiler doesn't optimize away the reads in prefetch()
+    unsigned char prefetch_checksum = 0;
 };
 
-MMappedFileRead::MMappedFileRead(StringView<const char> filename)
-    : internals(new Internals(filename))
+MMappedFileRead::MMappedFileRead(StringView<const char> filename, int read_strategy)
+    : internals(new Internals(filename, read_strategy))
 {
 }
 MMappedFileRead::~MMappedFileRead() = default;
@@ -79,15 +187,425 @@ ArrayView<const unsigned char> MMappedFileRead::get_bytes() const
 {
     return internals->file_contents;
 }
+ArrayView<const unsigned char> MMappedFileRead::next_chunk()
+{
+    size_t begin = std::min(internals->chunk_position, internals->file_contents.size());
+    size_t end = std::min(begin + prefetch_window_size, internals->file_contents.size());
+    internals->chunk_position = end;
+    set_read_position(begin);
+    return { internals->file_contents.begin() + begin, internals->file_contents.begin() + end };
+}
+void MMappedFileRead::set_read_position(size_t offset)
+{
+    internals->set_read_position(offset);
+}
 
 void MMappedFileRead::close_and_evict_from_os_cache()
 {
-    if (!internals->file_contents.empty())
-    {
-        munmap(internals->file_contents.begin(), internals->file_contents.size());
-        internals->file_contents = {};
-    }
+    internals->unmap();
     if (internals->file.is_valid())
         internals->file.evict_from_os_cache();
 }
 
+
+struct DirectFileRead::Internals
+{
+    Internals(StringView<const char> filename, size_t block_size, size_t pipeline_depth)
+        : block_size(round_up(std::max(block_size, alignment)))
+        , pipeline_depth(std::max(pipeline_depth, size_t(1)))
+    {
+        UnixFile direct_file(filename, O_RDONLY | O_DIRECT);
+        if (direct_file.is_valid() && read_file(direct_file))
+        {
+            direct_io = true;
+            return;
+        }
+        UnixFile buffered_file(filename, O_RDONLY);
+        if (buffered_file.is_valid() && read_file(buffered_file))
+            posix_fadvise(buffered_file.file_descriptor, 0, 0, POSIX_FADV_DONTNEED);
+        else
+            size = 0;
+    }
+    ~Internals()
+    {
+        mem::FreeAligned(buffer);
+    }
+
+    static size_t round_up(size_t size)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    bool read_file(UnixFile & file)
+    {
+        struct stat file_info;
+        if (fstat(file.file_descriptor, &file_info) == -1)
+            return false;
+        size = file_info.st_size;
+        if (!size)
+            return true;
+        // the size is checked again for every file that we read. when the
+        // direct read fails and the buffered read runs, the file may have
+        // grown in between
+        if (round_up(size) > buffer_capacity)
+        {
+            mem::FreeAligned(buffer);
+            buffer_capacity = round_up(size);
+            buffer = static_cast<unsigned char *>(mem::AllocAligned(buffer_capacity, alignment));
+        }
+        // every read asks for a full block, even the last one. O_DIRECT
+        // doesn't allow reading an unaligned size, but it's fine to ask for
+        // more than is left, that just returns less. that's why the buffer is
+        // rounded up
+        size_t num_blocks = (size + block_size - 1) / block_size;
+        std::atomic<size_t> next_block(0);
+        std::atomic<bool> failed(false);
+        auto read_blocks = [&]
+        {
+            for (size_t block = next_block++; block < num_blocks && !failed; block = next_block++)
+            {
+                size_t begin = block * block_size;
+                size_t end = std::min(begin + block_size, size);
+                while (begin < end)
+                {
+                    ssize_t result = pread(file.file_descriptor, buffer + begin, round_up(end - begin), begin);
+                    if (result <= 0)
+                    {
+                        failed = true;
+                        break;
+                    }
+                    begin += result;
+                }
+            }
+        };
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < std::min(pipeline_depth, num_blocks); ++i)
+            threads.emplace_back(read_blocks);
+        read_blocks();
+        for (std::thread & thread : threads)
+            thread.join();
+        return !failed;
+    }
+
+    size_t block_size;
+    size_t pipeline_depth;
+    unsigned char * buffer = nullptr;
+    size_t buffer_capacity = 0;
+    size_t size = 0;
+    bool direct_io = false;
+};
+
+DirectFileRead::DirectFileRead(StringView<const char> filename, size_t block_size, size_t pipeline_depth)
+    : internals(new Internals(filename, block_size, pipeline_depth))
+{
+}
+DirectFileRead::~DirectFileRead() = default;
+
+ArrayView<const unsigned char> DirectFileRead::get_bytes() const
+{
+    return { internals->buffer, internals->buffer + internals->size };
+}
+bool DirectFileRead::used_direct_io() const
+{
+    return internals->direct_io;
+}
+
+struct MMappedFileWrite::Internals
+{
+    Internals(StringView<const char> filename, SyncPolicy sync_policy, size_t initial_capacity)
+        : file(filename, O_RDWR | O_CREAT | O_TRUNC, 0644), sync_policy(sync_policy)
+    {
+        valid = file.is_valid() && grow(std::max(initial_capacity, size_t(1)));
+    }
+    ~Internals()
+    {
+        close();
+    }
+
+    bool grow(size_t min_capacity)
+    {
+        size_t new_capacity = std::max(min_capacity, capacity * 2);
+        // fallocate actually reserves the disk space. some file systems don't
+        // support it, in which case the file is sparse. any other error, like
+        // a full disk, has to fail here, or it would be a SIGBUS later
+        if (fallocate(file.file_descriptor, 0, 0, new_capacity) != 0)
+        {
+            if (errno != EOPNOTSUPP && errno != ENOSYS)
+                return false;
+            if (ftruncate(file.file_descriptor, new_capacity) != 0)
+                return false;
+        }
+        void * mapped;
+        if (mapping)
+            mapped = mremap(mapping, capacity, new_capacity, MREMAP_MAYMOVE);
+        else
+            mapped = mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file.file_descriptor, 0);
+        if (mapped == MAP_FAILED)
+            return false;
+        mapping = static_cast<unsigned char *>(mapped);
+        capacity = new_capacity;
+        return true;
+    }
+
+    bool sync_range(size_t begin, size_t end)
+    {
+        // msync wants a page aligned address
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        begin -= begin % page_size;
+        if (begin >= end)
+            return true;
+        return msync(mapping + begin, end - begin, MS_SYNC) == 0;
+    }
+
+    bool close()
+    {
+        if (!file.is_valid())
+            return valid;
+        if (mapping)
+        {
+            if (sync_policy != NoSync && !sync_range(synced_size, size))
+                valid = false;
+            munmap(mapping, capacity);
+            mapping = nullptr;
+        }
+        if (ftruncate(file.file_descriptor, size) != 0)
+            valid = false;
+        if (sync_policy != NoSync && fdatasync(file.file_descriptor) != 0)
+            valid = false;
+        ::close(file.file_descriptor);
+        file.file_descriptor = -1;
+        return valid;
+    }
+
+    UnixFile file;
+    SyncPolicy sync_policy;
+    unsigned char * mapping = nullptr;
+    size_t capacity = 0;
+    size_t size = 0;
+    size_t synced_size = 0;
+    bool valid = false;
+};
+
+MMappedFileWrite::MMappedFileWrite(StringView<const char> filename, SyncPolicy sync_policy, size_t initial_capacity)
+    : internals(new Internals(filename, sync_policy, initial_capacity))
+{
+}
+MMappedFileWrite::~MMappedFileWrite() = default;
+
+bool MMappedFileWrite::is_valid() const
+{
+    return internals->valid;
+}
+ArrayView<unsigned char> MMappedFileWrite::get_writable(size_t num_bytes)
+{
+    Internals & self = *internals;
+    if (!self.valid || !self.mapping)
+        return {};
+    if (self.capacity - self.size < num_bytes && !self.grow(self.size + num_bytes))
+    {
+        self.valid = false;
+        return {};
+    }
+    return { self.mapping + self.size, self.mapping + self.capacity };
+}
+void MMappedFileWrite::commit(size_t num_bytes)
+{
+    internals->size = std::min(internals->size + num_bytes, internals->capacity);
+}
+bool MMappedFileWrite::write(ArrayView<const unsigned char> bytes)
+{
+    ArrayView<unsigned char> writable = get_writable(bytes.size());
+    if (writable.empty() && !bytes.empty())
+        return false;
+    std::memcpy(writable.begin(), bytes.begin(), bytes.size());
+    commit(bytes.size());
+    return true;
+}
+size_t MMappedFileWrite::size() const
+{
+    return internals->size;
+}
+bool MMappedFileWrite::flush()
+{
+    Internals & self = *internals;
+    if (self.sync_policy != SyncOnFlush || !self.mapping)
+        return self.valid;
+    if (!self.sync_range(self.synced_size, self.size))
+        self.valid = false;
+    self.synced_size = self.size;
+    return self.valid;
+}
+bool MMappedFileWrite::close()
+{
+    return internals->close();
+}
+
+MMappedFileWriteStreamBuffer::MMappedFileWriteStreamBuffer(MMappedFileWrite & file)
+    : file(file)
+{
+    reset_put_area(0);
+}
+MMappedFileWriteStreamBuffer::~MMappedFileWriteStreamBuffer()
+{
+    commit_put_area();
+}
+
+void MMappedFileWriteStreamBuffer::commit_put_area()
+{
+    file.commit(pptr() - pbase());
+    setp(pptr(), epptr());
+}
+bool MMappedFileWriteStreamBuffer::reset_put_area(size_t min_space)
+{
+    ArrayView<unsigned char> writable = file.get_writable(min_space);
+    char * begin = reinterpret_cast<char *>(writable.begin());
+    setp(begin, begin + writable.size());
+    return writable.size() >= min_space && !writable.empty();
+}
+
+MMappedFileWriteStreamBuffer::int_type MMappedFileWriteStreamBuffer::overflow(int_type c)
+{
+    // the mapping may move when the file grows, so hand the bytes over first
+    commit_put_area();
+    if (!reset_put_area(1))
+        return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+std::streamsize MMappedFileWriteStreamBuffer::xsputn(const char * bytes, std::streamsize count)
+{
+    if (epptr() - pptr() < count)
+    {
+        commit_put_area();
+        if (!reset_put_area(count))
+            return 0;
+    }
+    std::memcpy(pptr(), bytes, count);
+    // commit right away instead of using pbump, which only takes an int
+    setp(pptr() + count, epptr());
+    file.commit(count);
+    return count;
+}
+int MMappedFileWriteStreamBuffer::sync()
+{
+    commit_put_area();
+    return file.flush() ? 0 : -1;
+}
+
+MMappedFileWriteStream::MMappedFileWriteStream(MMappedFileWrite & file)
+    : std::ostream(&buffer), buffer(file)
+{
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+#include "metafast/metafast.hpp"
+#include "metafast/metafast_stl.hpp"
+
+TEST(mmapped_file_write, metafast_roundtrip)
+{
+    std::string filename = "/tmp/mmapped_file_write_test";
+    std::vector<int> to_write(10000);
+    for (size_t i = 0; i < to_write.size(); ++i)
+        to_write[i] = int(i * i);
+    size_t written_size = 0;
+    {
+        // start small to make sure that the file has to grow a few times
+        MMappedFileWrite file(filename, MMappedFileWrite::SyncOnClose, 100);
+        ASSERT_TRUE(file.is_valid());
+        {
+            MMappedFileWriteStream stream(file);
+            metaf::BinaryOutput output(stream);
+            metaf::write_binary(output, to_write);
+        }
+        written_size = file.size();
+        ASSERT_TRUE(file.close());
+    }
+    MMappedFileRead file(filename);
+    ASSERT_EQ(written_size, file.get_bytes().size());
+    metaf::BinaryInput input(file.get_bytes());
+    std::vector<int> read;
+    metaf::read_binary(input, read);
+    ASSERT_EQ(to_write, read);
+}
+
+TEST(mmapped_file_read, read_strategies)
+{
+    std::string filename = "/tmp/mmapped_file_read_strategies";
+    std::string text(3 * MMappedFileRead::prefetch_window_size + 123, 'x');
+    for (size_t i = 0; i < text.size(); i += 1000)
+        text[i] = char(i / 1000);
+    {
+        MMappedFileWrite file(filename);
+        ASSERT_TRUE(file.write({ reinterpret_cast<const unsigned char *>(text.data()), reinterpret_cast<const unsigned char *>(text.data() + text.size()) }));
+    }
+    int strategies[] =
+    {
+        MMappedFileRead::Populate,
+        MMappedFileRead::Sequential | MMappedFileRead::WillNeed,
+        MMappedFileRead::HugePages,
+        MMappedFileRead::BackgroundPrefetch | MMappedFileRead::Sequential,
+    };
+    for (int strategy : strategies)
+    {
+        MMappedFileRead file(filename, strategy);
+        ASSERT_EQ(text, std::string(file.get_bytes().begin(), file.get_bytes().end()));
+    }
+    {
+        // reading through the chunks moves the prefetcher along
+        MMappedFileRead file(filename, MMappedFileRead::BackgroundPrefetch);
+        std::string chunked;
+        for (ArrayView<const unsigned char> chunk = file.next_chunk(); !chunk.empty(); chunk = file.next_chunk())
+            chunked.append(chunk.begin(), chunk.end());
+        ASSERT_EQ(text, chunked);
+        // jumping around is fine too
+        file.set_read_position(text.size() - 10);
+        file.set_read_position(0);
+        ASSERT_EQ(text, std::string(file.get_bytes().begin(), file.get_bytes().end()));
+    }
+    // closing while the prefetcher may still be running
+    MMappedFileRead file(filename, MMappedFileRead::BackgroundPrefetch);
+    file.close_and_evict_from_os_cache();
+    ASSERT_TRUE(file.get_bytes().empty());
+}
+
+TEST(direct_file_read, unaligned_size)
+{
+    std::string filename = "/tmp/direct_file_read_test";
+    // a few blocks and then an unaligned tail
+    std::string text(5 * DirectFileRead::alignment + 17, 'a');
+    for (size_t i = 0; i < text.size(); ++i)
+        text[i] = char(i * 13);
+    {
+        MMappedFileWrite file(filename);
+        ASSERT_TRUE(file.write({ reinterpret_cast<const unsigned char *>(text.data()), reinterpret_cast<const unsigned char *>(text.data() + text.size()) }));
+    }
+    DirectFileRead file(filename, 2 * DirectFileRead::alignment, 2);
+    ASSERT_EQ(text, std::string(file.get_bytes().begin(), file.get_bytes().end()));
+    ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(file.get_bytes().begin()) % DirectFileRead::alignment);
+    DirectFileRead missing("/tmp/this_file_does_not_exist_hopefully");
+    ASSERT_TRUE(missing.get_bytes().empty());
+}
+
+TEST(mmapped_file_write, write_and_flush)
+{
+    std::string filename = "/tmp/mmapped_file_write_test_flush";
+    std::string text = "hello, mapped world";
+    {
+        MMappedFileWrite file(filename, MMappedFileWrite::SyncOnFlush, 4);
+        for (int i = 0; i < 3; ++i)
+        {
+            ASSERT_TRUE(file.write({ reinterpret_cast<const unsigned char *>(text.data()), reinterpret_cast<const unsigned char *>(text.data() + text.size()) }));
+            ASSERT_TRUE(file.flush());
+        }
+    }
+    MMappedFileRead file(filename);
+    std::string read(file.get_bytes().begin(), file.get_bytes().end());
+    ASSERT_EQ(text + text + text, read);
+}
+
+#endif
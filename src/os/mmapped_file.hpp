@@ -2,12 +2,16 @@
 
 #include "util/view.hpp"
 #include <memory>
+#include <ostream>
+#include <streambuf>
 
 struct UnixFile
 {
     static const int RDONLY;
     static const int RDWR;
     static const int WRONLY;
+    static const int CREAT;
+    static const int TRUNC;
 
     UnixFile(StringView<const char> filename, int flags);
     UnixFile(StringView<const char> filename, int flags, int mode);
@@ -22,16 +26,50 @@ struct UnixFile
 
     size_t size();
     size_t read(ArrayView<unsigned char> bytes);
+    // keeps writing until all bytes are written or until there is an error
+    size_t write(ArrayView<const unsigned char> bytes);
 
     int file_descriptor = -1;
 };
 
 struct MMappedFileRead
 {
-    MMappedFileRead(StringView<const char> filename);
+    // how to get the file into memory. by default every 4 KiB page gets
+    // faulted in when it is first touched, which is slow for cold files.
+    // these can be combined
+    enum ReadStrategy
+    {
+        DefaultRead = 0,
+        // MAP_POPULATE: read the whole file in the constructor
+        Populate = 1 << 0,
+        // MADV_SEQUENTIAL: aggressive read ahead, and pages can be dropped
+        // soon after they were read
+        Sequential = 1 << 1,
+        // MADV_WILLNEED: start reading the whole file in the background
+        WillNeed = 1 << 2,
+        // MADV_HUGEPAGE: fewer page faults and TLB misses. only some file
+        // systems support this, otherwise it is ignored
+        HugePages = 1 << 3,
+        // a helper thread touches the file window by window ahead of the
+        // reader, so the page faults happen on that thread while the reader
+        // is still decoding the previous window. it needs to know where the
+        // reader is, so either read through next_chunk() or call
+        // set_read_position(). it stays at most prefetch_distance ahead
+        BackgroundPrefetch = 1 << 4
+    };
+    static constexpr size_t prefetch_window_size = 2 * 1024 * 1024;
+    static constexpr size_t prefetch_distance = 4 * prefetch_window_size;
+
+    MMappedFileRead(StringView<const char> filename, int read_strategy = DefaultRead);
     ~MMappedFileRead();
 
     ArrayView<const unsigned char> get_bytes() const;
+    // hands out the file in windows of prefetch_window_size, and moves the
+    // read position along. use it with metaf::BinaryInput::FromChunks
+    ArrayView<const unsigned char> next_chunk();
+    // the offset that the reader got to. if it jumps, the prefetch thread
+    // starts over from there instead of reading pages that won't be used
+    void set_read_position(size_t offset);
 
     void close_and_evict_from_os_cache();
 
@@ -39,3 +77,101 @@ private:
     struct Internals;
     std::unique_ptr<Internals> internals;
 };
+
+// reads a whole file with O_DIRECT, for big files that get loaded once. the
+// bytes go from the disk straight into an aligned buffer, so they aren't
+// copied out of the page cache and they don't push other files out of it.
+// a few reads of block_size are in flight at the same time. if the file
+// system doesn't support O_DIRECT this falls back to normal reads and evicts
+// the file from the page cache afterwards
+struct DirectFileRead
+{
+    // O_DIRECT needs the buffer, the file offset and the size of every read
+    // to be aligned to the logical block size of the disk. 4 KiB covers all
+    // common disks
+    static constexpr size_t alignment = 4096;
+    static constexpr size_t default_block_size = 1024 * 1024;
+    static constexpr size_t default_pipeline_depth = 4;
+
+    DirectFileRead(StringView<const char> filename, size_t block_size = default_block_size, size_t pipeline_depth = default_pipeline_depth);
+    ~DirectFileRead();
+
+    // empty if the file couldn't be read. the memory is aligned to alignment
+    ArrayView<const unsigned char> get_bytes() const;
+    bool used_direct_io() const;
+
+private:
+    struct Internals;
+    std::unique_ptr<Internals> internals;
+};
+
+// writes a file through a shared memory mapping, so the bytes go straight into
+// the page cache instead of being copied by a write() call. the file grows in
+// big steps as needed (fallocate, so that a full disk shows up as an error
+// here instead of as a SIGBUS later) and gets truncated to the written size
+// when it's closed. use MMappedFileWriteStream to use this with metaf::BinaryOutput
+struct MMappedFileWrite
+{
+    enum SyncPolicy
+    {
+        // the kernel writes the pages back whenever it wants to
+        NoSync,
+        // close() waits until everything is on disk
+        SyncOnClose,
+        // flush() and close() wait until everything written so far is on disk
+        SyncOnFlush
+    };
+    static constexpr size_t default_initial_capacity = 1024 * 1024;
+
+    // creates the file or truncates it if it already exists
+    MMappedFileWrite(StringView<const char> filename, SyncPolicy sync_policy = NoSync, size_t initial_capacity = default_initial_capacity);
+    ~MMappedFileWrite();
+
+    // false if the file couldn't be opened or if growing it failed
+    bool is_valid() const;
+
+    // returns at least num_bytes of writable memory after the written part of
+    // the file, growing the file if needed. call commit() after writing to
+    // it. the memory is only valid until the next call to this. returns an
+    // empty range if the file couldn't grow
+    ArrayView<unsigned char> get_writable(size_t num_bytes);
+    void commit(size_t num_bytes);
+    bool write(ArrayView<const unsigned char> bytes);
+    size_t size() const;
+
+    bool flush();
+    // truncates the file to the written size, unmaps it and syncs if the sync
+    // policy says so. the destructor calls this, but call it yourself if you
+    // want to know whether it worked
+    bool close();
+
+private:
+    struct Internals;
+    std::unique_ptr<Internals> internals;
+};
+
+// a streambuf that writes into the mapped memory of a MMappedFileWrite
+struct MMappedFileWriteStreamBuffer : std::streambuf
+{
+    MMappedFileWriteStreamBuffer(MMappedFileWrite & file);
+    ~MMappedFileWriteStreamBuffer();
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char * bytes, std::streamsize count) override;
+    int sync() override;
+
+private:
+    void commit_put_area();
+    bool reset_put_area(size_t min_space);
+
+    MMappedFileWrite & file;
+};
+
+struct MMappedFileWriteStream : std::ostream
+{
+    MMappedFileWriteStream(MMappedFileWrite & file);
+
+private:
+    MMappedFileWriteStreamBuffer buffer;
+};
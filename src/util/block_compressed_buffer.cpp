@@ -0,0 +1,205 @@
+#include "util/block_compressed_buffer.hpp"
+#include "debug/assert.hpp"
+#include "lz4.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+// starting a thread costs tens of microseconds, which is about what it takes
+// to decompress a megabyte. so every thread gets at least that much to do,
+// and small buffers are done on the calling thread without starting any
+static constexpr uint64_t min_bytes_per_thread = 1024 * 1024;
+size_t choose_num_threads(size_t num_threads, size_t num_blocks, uint64_t uncompressed_size)
+{
+    if (!num_threads)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min<uint64_t>(num_threads, uncompressed_size / min_bytes_per_thread);
+    return std::max(size_t(1), std::min(num_threads, num_blocks));
+}
+
+// calls process_block(i) for every block. workers grab the next block index
+// from a shared counter, so a slow block doesn't hold up the others. returns
+// false if any call returned false
+template<typename Func>
+bool for_each_block_in_parallel(size_t num_blocks, size_t num_threads, Func process_block)
+{
+    std::atomic<size_t> next_block(0);
+    std::atomic<bool> failed(false);
+    auto worker = [&]
+    {
+        for (size_t i = next_block++; i < num_blocks && !failed; i = next_block++)
+        {
+            if (!process_block(i))
+                failed = true;
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads - 1);
+    for (size_t i = 1; i < num_threads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread & thread : threads)
+        thread.join();
+    return !failed;
+}
+
+struct BlockTable
+{
+    BlockCompressedHeader header;
+    const uint32_t * compressed_sizes;
+    ArrayView<const unsigned char> content;
+};
+BlockTable read_block_table(ArrayView<const unsigned char> compressed_bytes)
+{
+    BlockTable result;
+    if (compressed_bytes.size() < sizeof(result.header)) RAW_THROW(std::runtime_error("compressed data is too small to contain a header"));
+    std::memcpy(&result.header, compressed_bytes.begin(), sizeof(result.header));
+    const BlockCompressedHeader & header = result.header;
+    if (!header.block_size || header.block_size > uint32_t(LZ4_MAX_INPUT_SIZE)) RAW_THROW(std::runtime_error("invalid block size in the header of compressed data"));
+    uint64_t expected_num_blocks = (header.uncompressed_size + header.block_size - 1) / header.block_size;
+    if (header.num_blocks != expected_num_blocks) RAW_THROW(std::runtime_error("invalid block count in the header of compressed data"));
+    ArrayView<const unsigned char> rest = compressed_bytes.subview(sizeof(header));
+    size_t table_size = sizeof(uint32_t) * header.num_blocks;
+    if (rest.size() < table_size) RAW_THROW(std::runtime_error("compressed data is too small to contain the block table"));
+    result.compressed_sizes = reinterpret_cast<const uint32_t *>(rest.begin());
+    result.content = rest.subview(table_size);
+    return result;
+}
+}
+
+BlockCompressedBuffer::BlockCompressedBuffer(ArrayView<const unsigned char> bytes, Lz4Codec codec, size_t block_size, size_t num_threads)
+{
+    if (!block_size || block_size > size_t(LZ4_MAX_INPUT_SIZE)) RAW_THROW(std::runtime_error("invalid block size for lz4"));
+    size_t num_blocks = (bytes.size() + block_size - 1) / block_size;
+    if (num_blocks > std::numeric_limits<uint32_t>::max()) RAW_THROW(std::runtime_error("too many blocks"));
+    BlockCompressedHeader header = { bytes.size(), uint32_t(block_size), uint32_t(num_blocks) };
+
+    // every block gets compressed into its own slot, and the slots are moved
+    // together at the end. that way the workers never have to wait for each other
+    int compressed_bound = LZ4_compressBound(int(block_size));
+    std::unique_ptr<char[]> scratch(new char[compressed_bound * num_blocks]);
+    std::vector<uint32_t> compressed_sizes(num_blocks);
+    bool success = for_each_block_in_parallel(num_blocks, choose_num_threads(num_threads, num_blocks, bytes.size()), [&](size_t i)
+    {
+        ArrayView<const unsigned char> block = bytes.subview(i * block_size, block_size);
+        int compressed_size = codec.compress(reinterpret_cast<const char *>(block.begin()), scratch.get() + i * compressed_bound, int(block.size()), compressed_bound);
+        compressed_sizes[i] = uint32_t(compressed_size);
+        return compressed_size > 0;
+    });
+    if (!success) RAW_THROW(std::runtime_error("lz4 failed to compress a block"));
+
+    size_t table_size = sizeof(uint32_t) * num_blocks;
+    size = sizeof(header) + table_size;
+    for (uint32_t compressed_size : compressed_sizes)
+        size += compressed_size;
+    buffer.reset(new unsigned char[size]);
+    unsigned char * out = buffer.get();
+    std::memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    std::memcpy(out, compressed_sizes.data(), table_size);
+    out += table_size;
+    for (size_t i = 0; i < num_blocks; ++i)
+    {
+        std::memcpy(out, scratch.get() + i * compressed_bound, compressed_sizes[i]);
+        out += compressed_sizes[i];
+    }
+}
+BlockCompressedBuffer::BlockCompressedBuffer(StringView<const char> text, Lz4Codec codec, size_t block_size, size_t num_threads)
+    : BlockCompressedBuffer(ArrayView<const unsigned char>(reinterpret_cast<const unsigned char *>(text.begin()), reinterpret_cast<const unsigned char *>(text.end())), codec, block_size, num_threads)
+{
+}
+
+BlockUncompressedBuffer::BlockUncompressedBuffer(ArrayView<const unsigned char> compressed_bytes, size_t num_threads)
+{
+    uint64_t new_size = uncompressed_size(compressed_bytes);
+    buffer.reset(new unsigned char[new_size]);
+    decompress_into(compressed_bytes, { buffer.get(), buffer.get() + new_size }, num_threads);
+    size = new_size;
+}
+
+uint64_t BlockUncompressedBuffer::uncompressed_size(ArrayView<const unsigned char> compressed_bytes)
+{
+    return read_block_table(compressed_bytes).header.uncompressed_size;
+}
+ArrayView<unsigned char> BlockUncompressedBuffer::decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output, size_t num_threads)
+{
+    BlockTable table = read_block_table(compressed_bytes);
+    const BlockCompressedHeader & header = table.header;
+    if (output.size() < header.uncompressed_size) RAW_THROW(std::runtime_error("the output buffer is too small for the decompressed data"));
+    // the table only has sizes, so first figure out where every block starts
+    std::vector<uint64_t> offsets(header.num_blocks + 1);
+    for (size_t i = 0; i < header.num_blocks; ++i)
+        offsets[i + 1] = offsets[i] + table.compressed_sizes[i];
+    if (offsets.back() != table.content.size()) RAW_THROW(std::runtime_error("the compressed data is corrupt"));
+    bool success = for_each_block_in_parallel(header.num_blocks, choose_num_threads(num_threads, header.num_blocks, header.uncompressed_size), [&](size_t i)
+    {
+        uint64_t block_begin = uint64_t(i) * header.block_size;
+        int block_size = int(std::min<uint64_t>(header.block_size, header.uncompressed_size - block_begin));
+        const char * source = reinterpret_cast<const char *>(table.content.begin() + offsets[i]);
+        int decompressed = LZ4_decompress_safe(source, reinterpret_cast<char *>(output.begin() + block_begin), int(table.compressed_sizes[i]), block_size);
+        return decompressed == block_size;
+    });
+    if (!success) RAW_THROW(std::runtime_error("the compressed data is corrupt"));
+    return output.subview(0, header.uncompressed_size);
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+
+static std::string block_test_text()
+{
+    std::string text;
+    for (int i = 0; i < 10000; ++i)
+        text += std::to_string(i % 77) + ", ";
+    return text;
+}
+
+TEST(block_compressed_buffer, roundtrip)
+{
+    std::string text = block_test_text();
+    // small blocks to make sure the split works. this is too small for more
+    // than one thread, so it also checks that asking for eight is fine
+    BlockCompressedBuffer compressed(text, Lz4Codec::HighCompression(), 1000, 8);
+    BlockUncompressedBuffer uncompressed(compressed.get_bytes(), 3);
+    ASSERT_EQ(text, uncompressed.get_text());
+}
+TEST(block_compressed_buffer, single_thread_matches_parallel)
+{
+    // big enough that several threads get a megabyte each
+    std::string text;
+    for (int i = 0; i < 100; ++i)
+        text += block_test_text();
+    BlockCompressedBuffer single(text, Lz4Codec::Fast(), 4096, 1);
+    BlockCompressedBuffer parallel(text, Lz4Codec::Fast(), 4096, 4);
+    ASSERT_EQ(single.get_bytes(), parallel.get_bytes());
+    BlockUncompressedBuffer uncompressed(parallel.get_bytes(), 4);
+    ASSERT_EQ(text, uncompressed.get_text());
+}
+TEST(block_compressed_buffer, empty)
+{
+    std::string text;
+    BlockCompressedBuffer compressed(text);
+    BlockUncompressedBuffer uncompressed(compressed.get_bytes());
+    ASSERT_EQ(text, uncompressed.get_text());
+}
+TEST(block_compressed_buffer, corrupt_input)
+{
+    std::string text = block_test_text();
+    BlockCompressedBuffer compressed(text, Lz4Codec::Fast(), 1000);
+    std::vector<unsigned char> corrupt(compressed.get_bytes().begin(), compressed.get_bytes().end());
+    corrupt.pop_back();
+    ArrayView<const unsigned char> truncated(corrupt.data(), corrupt.data() + corrupt.size());
+    ASSERT_THROW(BlockUncompressedBuffer{truncated}, std::runtime_error);
+    corrupt.assign(compressed.get_bytes().begin(), compressed.get_bytes().end());
+    std::fill(corrupt.end() - 100, corrupt.end(), 0xff);
+    ArrayView<const unsigned char> garbled(corrupt.data(), corrupt.data() + corrupt.size());
+    ASSERT_THROW(BlockUncompressedBuffer{garbled}, std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include "util/view.hpp"
+#include "util/compressed_buffer.hpp"
+
+// the format written by BlockCompressedBuffer: the input gets split into blocks
+// of block_size bytes (the last one may be smaller) and every block gets
+// compressed on its own. after this header comes a table with num_blocks
+// uint32_t compressed sizes, followed by the compressed blocks in order.
+// since the blocks don't depend on each other they can be compressed and
+// decompressed in parallel. lz4 only looks back 64 KiB anyway, so with blocks
+// of a few megabytes the ratio is almost the same as for a single block
+struct BlockCompressedHeader
+{
+    uint64_t uncompressed_size;
+    uint32_t block_size;
+    uint32_t num_blocks;
+};
+
+struct BlockCompressedBuffer
+{
+    static constexpr size_t default_block_size = 4 * 1024 * 1024;
+
+    // num_threads = 0 means one thread per core. the calling thread is one of
+    // the workers, so num_threads = 1 compresses without starting a thread.
+    // every thread gets at least a megabyte, so small inputs are always
+    // compressed on the calling thread
+    BlockCompressedBuffer(ArrayView<const unsigned char> bytes, Lz4Codec codec = Lz4Codec::HighCompression(), size_t block_size = default_block_size, size_t num_threads = 0);
+    BlockCompressedBuffer(StringView<const char> bytes, Lz4Codec codec = Lz4Codec::HighCompression(), size_t block_size = default_block_size, size_t num_threads = 0);
+
+    ArrayView<const unsigned char> get_bytes() const
+    {
+        return { buffer.get(), buffer.get() + size };
+    }
+
+private:
+    std::unique_ptr<unsigned char[]> buffer;
+    size_t size;
+};
+
+// all of these throw a std::runtime_error if the compressed bytes are corrupt
+struct BlockUncompressedBuffer
+{
+    BlockUncompressedBuffer(ArrayView<const unsigned char> compressed_bytes, size_t num_threads = 0);
+
+    static uint64_t uncompressed_size(ArrayView<const unsigned char> compressed_bytes);
+    // decompresses the blocks in parallel into memory owned by the caller.
+    // output has to be at least uncompressed_size() big
+    static ArrayView<unsigned char> decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output, size_t num_threads = 0);
+
+    ArrayView<const unsigned char> get_bytes() const
+    {
+        return { buffer.get(), buffer.get() + size };
+    }
+    StringView<const char> get_text() const
+    {
+        const char * begin = reinterpret_cast<const char *>(buffer.get());
+        return { begin, begin + size };
+    }
+
+private:
+    std::unique_ptr<unsigned char[]> buffer;
+    uint64_t size = 0;
+};
@@ -1,9 +1,130 @@
 #include "util/compressed_buffer.hpp"
+#include "debug/assert.hpp"
 #include "lz4.h"
 #include "lz4hc.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+int Lz4Codec::compress(const char * source, char * dest, int source_size, int max_dest_size) const
+{
+    if (mode == FastMode)
+        return LZ4_compress_fast(source, dest, source_size, max_dest_size, level);
+    else
+        return LZ4_compress_HC(source, dest, source_size, max_dest_size, level);
+}
+
+Lz4Dictionary::Lz4Dictionary(StringView<const char> text)
+    : bytes(new char[std::max(text.size(), size_t(1))]), size(std::min(text.size(), max_size))
+    , loaded_stream(new long long[LZ4_STREAMSIZE_U64])
+{
+    // only the end of the dictionary is reachable for lz4
+    std::copy(text.end() - size, text.end(), bytes.get());
+    LZ4_stream_t * stream = reinterpret_cast<LZ4_stream_t *>(loaded_stream.get());
+    LZ4_resetStream(stream);
+    LZ4_loadDict(stream, bytes.get(), int(size));
+}
+
+namespace
+{
+// the dictionary builder looks at sequences of this many bytes. lz4 needs at
+// least four matching bytes, and eight fits nicely into an integer
+static constexpr size_t dictionary_gram_size = 8;
+std::vector<uint64_t> distinct_grams(const std::string & sample)
+{
+    std::vector<uint64_t> result;
+    for (size_t i = 0; i + dictionary_gram_size <= sample.size(); ++i)
+    {
+        uint64_t gram;
+        std::memcpy(&gram, sample.data() + i, sizeof(gram));
+        result.push_back(gram);
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+}
+
+Lz4Dictionary Lz4Dictionary::FromSamples(ArrayView<const std::string> samples, size_t dictionary_size)
+{
+    dictionary_size = std::min(dictionary_size, max_size);
+    // count in how many samples every sequence of bytes shows up. then greedily
+    // pick the sample that covers the most common sequences that aren't in the
+    // dictionary yet. scores only go down as sequences get covered, so a sample
+    // only needs to be re-scored when it comes up at the top of the queue
+    std::vector<std::vector<uint64_t>> grams;
+    grams.reserve(samples.size());
+    std::unordered_map<uint64_t, uint32_t> num_samples_with_gram;
+    for (const std::string & sample : samples)
+    {
+        grams.push_back(distinct_grams(sample));
+        for (uint64_t gram : grams.back())
+            ++num_samples_with_gram[gram];
+    }
+    auto score = [&](size_t index)
+    {
+        uint64_t result = 0;
+        for (uint64_t gram : grams[index])
+        {
+            uint32_t count = num_samples_with_gram[gram];
+            // a sequence that only shows up in one sample doesn't help anyone else
+            if (count > 1)
+                result += count;
+        }
+        // per byte, so that long samples don't win just because they are long
+        return double(result) / std::max(samples[index].size(), size_t(1));
+    };
+    std::priority_queue<std::pair<double, size_t>> candidates;
+    for (size_t i = 0; i < samples.size(); ++i)
+    {
+        if (!samples[i].empty() && samples[i].size() <= dictionary_size)
+            candidates.emplace(score(i), i);
+    }
+    std::vector<size_t> chosen;
+    size_t chosen_size = 0;
+    while (!candidates.empty() && chosen_size < dictionary_size)
+    {
+        size_t index = candidates.top().second;
+        candidates.pop();
+        double current_score = score(index);
+        if (current_score <= 0.0)
+            continue;
+        if (!candidates.empty() && current_score < candidates.top().first)
+        {
+            candidates.emplace(current_score, index);
+            continue;
+        }
+        if (chosen_size + samples[index].size() > dictionary_size)
+            continue;
+        chosen.push_back(index);
+        chosen_size += samples[index].size();
+        for (uint64_t gram : grams[index])
+            num_samples_with_gram[gram] = 0;
+    }
+    // lz4 prefers the most recent match, so put the most useful samples at the end
+    std::string result;
+    result.reserve(chosen_size);
+    for (auto it = chosen.rbegin(); it != chosen.rend(); ++it)
+        result += samples[*it];
+    return Lz4Dictionary(result);
+}
 
 CompressedBuffer::CompressedBuffer(ArrayView<const unsigned char> bytes, int lz4_compression_level)
+    : CompressedBuffer(bytes, Lz4Codec::HighCompression(lz4_compression_level))
+{
+}
+CompressedBuffer::CompressedBuffer(StringView<const char> text, int lz4_compression_level)
+    : CompressedBuffer(text, Lz4Codec::HighCompression(lz4_compression_level))
+{
+}
+CompressedBuffer::CompressedBuffer(ArrayView<const unsigned char> bytes, Lz4Codec codec)
 {
+    if (bytes.size() > size_t(LZ4_MAX_INPUT_SIZE)) RAW_THROW(std::runtime_error("too much data for one lz4 block"));
     int compressed_bound = LZ4_compressBound(int(bytes.size()));
     int size_extra_space = sizeof(uint64_t);
 
@@ -11,10 +132,41 @@ CompressedBuffer::CompressedBuffer(ArrayView<const unsigned char> bytes, int lz4
     *reinterpret_cast<uint64_t *>(buffer.get()) = bytes.size();
     size = size_extra_space;
 
-    size += LZ4_compress_HC(reinterpret_cast<const char *>(bytes.begin()), reinterpret_cast<char *>(buffer.get() + size_extra_space), bytes.size(), compressed_bound, lz4_compression_level);
+    int compressed_size = codec.compress(reinterpret_cast<const char *>(bytes.begin()), reinterpret_cast<char *>(buffer.get() + size_extra_space), bytes.size(), compressed_bound);
+    // lz4 writes at least one byte even for empty input, so 0 means it failed
+    if (compressed_size <= 0) RAW_THROW(std::runtime_error("lz4 compression failed"));
+    size += compressed_size;
 }
-CompressedBuffer::CompressedBuffer(StringView<const char> text, int lz4_compression_level)
-    : CompressedBuffer(ArrayView<const unsigned char>(reinterpret_cast<const unsigned char *>(text.begin()), reinterpret_cast<const unsigned char *>(text.end())), lz4_compression_level)
+CompressedBuffer::CompressedBuffer(StringView<const char> text, Lz4Codec codec)
+    : CompressedBuffer(ArrayView<const unsigned char>(reinterpret_cast<const unsigned char *>(text.begin()), reinterpret_cast<const unsigned char *>(text.end())), codec)
+{
+}
+
+CompressedBuffer::CompressedBuffer(ArrayView<const unsigned char> bytes, Lz4Codec codec, ShuffleFilter filter)
+{
+    std::unique_ptr<unsigned char[]> shuffled(new unsigned char[bytes.size()]);
+    ArrayView<unsigned char> shuffled_view(shuffled.get(), shuffled.get() + bytes.size());
+    filter.apply(bytes, shuffled_view);
+    *this = CompressedBuffer(ArrayView<const unsigned char>(shuffled_view.begin(), shuffled_view.end()), codec);
+}
+CompressedBuffer::CompressedBuffer(ArrayView<const unsigned char> bytes, const Lz4Dictionary & dictionary, int acceleration)
+{
+    if (bytes.size() > size_t(LZ4_MAX_INPUT_SIZE)) RAW_THROW(std::runtime_error("too much data for one lz4 block"));
+    int compressed_bound = LZ4_compressBound(int(bytes.size()));
+    int size_extra_space = sizeof(uint64_t);
+
+    buffer.reset(new unsigned char[compressed_bound + size_extra_space]);
+    *reinterpret_cast<uint64_t *>(buffer.get()) = bytes.size();
+    size = size_extra_space;
+
+    LZ4_stream_t stream;
+    std::memcpy(&stream, dictionary.loaded_stream.get(), sizeof(stream));
+    int compressed_size = LZ4_compress_fast_continue(&stream, reinterpret_cast<const char *>(bytes.begin()), reinterpret_cast<char *>(buffer.get() + size_extra_space), bytes.size(), compressed_bound, acceleration);
+    if (compressed_size <= 0) RAW_THROW(std::runtime_error("lz4 compression failed"));
+    size += compressed_size;
+}
+CompressedBuffer::CompressedBuffer(StringView<const char> text, const Lz4Dictionary & dictionary, int acceleration)
+    : CompressedBuffer(ArrayView<const unsigned char>(reinterpret_cast<const unsigned char *>(text.begin()), reinterpret_cast<const unsigned char *>(text.end())), dictionary, acceleration)
 {
 }
 
@@ -30,10 +182,95 @@ size_t CompressedBuffer::shrink_to_fit_savings() const
 }
 
 UncompressedBuffer::UncompressedBuffer(ArrayView<const unsigned char> compressed_bytes)
-    : size(*reinterpret_cast<const uint64_t *>(compressed_bytes.begin()))
 {
-    buffer.reset(new unsigned char[size]);
-    LZ4_decompress_safe(reinterpret_cast<const char *>(compressed_bytes.begin() + sizeof(uint64_t)), reinterpret_cast<char *>(buffer.get()), compressed_bytes.size() - sizeof(uint64_t), size);
+    decompress(compressed_bytes, nullptr);
+}
+UncompressedBuffer::UncompressedBuffer(ArrayView<const unsigned char> compressed_bytes, const Lz4Dictionary & dictionary)
+{
+    decompress(compressed_bytes, &dictionary);
+}
+UncompressedBuffer::UncompressedBuffer(ArrayView<const unsigned char> compressed_bytes, ShuffleFilter filter)
+{
+    decompress(compressed_bytes, filter);
+}
+
+uint64_t UncompressedBuffer::uncompressed_size(ArrayView<const unsigned char> compressed_bytes)
+{
+    if (compressed_bytes.size() < sizeof(uint64_t)) RAW_THROW(std::runtime_error("compressed data is too small to contain a header"));
+    uint64_t result = *reinterpret_cast<const uint64_t *>(compressed_bytes.begin());
+    if (result > uint64_t(std::numeric_limits<int>::max())) RAW_THROW(std::runtime_error("invalid size in the header of compressed data"));
+    return result;
+}
+ArrayView<unsigned char> UncompressedBuffer::decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output)
+{
+    return decompress_into(compressed_bytes, output, nullptr);
+}
+ArrayView<unsigned char> UncompressedBuffer::decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output, const Lz4Dictionary & dictionary)
+{
+    return decompress_into(compressed_bytes, output, &dictionary);
+}
+ArrayView<unsigned char> UncompressedBuffer::decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output, ShuffleFilter filter)
+{
+    if (!filter.is_active())
+        return decompress_into(compressed_bytes, output);
+    uint64_t size = uncompressed_size(compressed_bytes);
+    if (output.size() < size) RAW_THROW(std::runtime_error("the output buffer is too small for the decompressed data"));
+    std::unique_ptr<unsigned char[]> shuffled(new unsigned char[size]);
+    ArrayView<unsigned char> shuffled_view = decompress_into(compressed_bytes, { shuffled.get(), shuffled.get() + size });
+    ArrayView<unsigned char> result = output.subview(0, size);
+    filter.undo(shuffled_view, result);
+    return result;
+}
+ArrayView<unsigned char> UncompressedBuffer::decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output, const Lz4Dictionary * dictionary)
+{
+    uint64_t size = uncompressed_size(compressed_bytes);
+    if (output.size() < size) RAW_THROW(std::runtime_error("the output buffer is too small for the decompressed data"));
+    ArrayView<const unsigned char> content = compressed_bytes.subview(sizeof(uint64_t));
+    const char * source = reinterpret_cast<const char *>(content.begin());
+    char * dest = reinterpret_cast<char *>(output.begin());
+    int decompressed;
+    if (dictionary)
+    {
+        StringView<const char> dictionary_text = dictionary->get_text();
+        decompressed = LZ4_decompress_safe_usingDict(source, dest, int(content.size()), int(size), dictionary_text.begin(), int(dictionary_text.size()));
+    }
+    else
+        decompressed = LZ4_decompress_safe(source, dest, int(content.size()), int(size));
+    if (decompressed < 0 || uint64_t(decompressed) != size) RAW_THROW(std::runtime_error("the compressed data is corrupt"));
+    return output.subview(0, size);
+}
+void UncompressedBuffer::decompress(ArrayView<const unsigned char> compressed_bytes)
+{
+    decompress(compressed_bytes, nullptr);
+}
+void UncompressedBuffer::decompress(ArrayView<const unsigned char> compressed_bytes, const Lz4Dictionary & dictionary)
+{
+    decompress(compressed_bytes, &dictionary);
+}
+void UncompressedBuffer::decompress(ArrayView<const unsigned char> compressed_bytes, ShuffleFilter filter)
+{
+    uint64_t new_size = uncompressed_size(compressed_bytes);
+    reserve(new_size);
+    size = 0;
+    decompress_into(compressed_bytes, { buffer.get(), buffer.get() + capacity }, filter);
+    size = new_size;
+}
+void UncompressedBuffer::decompress(ArrayView<const unsigned char> compressed_bytes, const Lz4Dictionary * dictionary)
+{
+    uint64_t new_size = uncompressed_size(compressed_bytes);
+    reserve(new_size);
+    // set size to 0 first so that we don't claim to hold garbage if this throws
+    size = 0;
+    decompress_into(compressed_bytes, { buffer.get(), buffer.get() + capacity }, dictionary);
+    size = new_size;
+}
+void UncompressedBuffer::reserve(uint64_t new_capacity)
+{
+    if (new_capacity > capacity)
+    {
+        buffer.reset(new unsigned char[new_capacity]);
+        capacity = new_capacity;
+    }
 }
 
 #ifndef DISABLE_GTEST
@@ -63,6 +300,88 @@ TEST(compressed_buffer, shrink_to_fit)
     UncompressedBuffer uncompressed(compressed.get_bytes());
     ASSERT_EQ(as_view, uncompressed.get_bytes());
 }
+TEST(compressed_buffer, fast_roundtrip)
+{
+    std::string text = "hello, hello, hello, world!";
+    CompressedBuffer compressed(text, Lz4Codec::Fast(4));
+    UncompressedBuffer uncompressed(compressed.get_bytes());
+    ASSERT_EQ(text, uncompressed.get_text());
+}
+TEST(compressed_buffer, decompress_into_reused_buffer)
+{
+    std::string first = "first text";
+    std::string second = "second";
+    CompressedBuffer first_compressed(first, Lz4Codec::Fast());
+    CompressedBuffer second_compressed(second, Lz4Codec::Fast());
+    unsigned char storage[16];
+    ArrayView<unsigned char> written = UncompressedBuffer::decompress_into(first_compressed.get_bytes(), storage);
+    ASSERT_EQ(first.size(), written.size());
+    ASSERT_TRUE(std::equal(first.begin(), first.end(), written.begin()));
+
+    UncompressedBuffer reused(first_compressed.get_bytes());
+    const unsigned char * memory_before = reused.get_bytes().begin();
+    reused.decompress(second_compressed.get_bytes());
+    ASSERT_EQ(second, reused.get_text());
+    ASSERT_EQ(memory_before, reused.get_bytes().begin());
+}
+TEST(compressed_buffer, corrupt_input)
+{
+    std::string text = "some text that will get corrupted";
+    CompressedBuffer compressed(text);
+    std::vector<unsigned char> corrupt(compressed.get_bytes().begin(), compressed.get_bytes().end());
+    corrupt.resize(corrupt.size() / 2);
+    ArrayView<const unsigned char> corrupt_view(corrupt.data(), corrupt.data() + corrupt.size());
+    ASSERT_THROW(UncompressedBuffer{corrupt_view}, std::runtime_error);
+    unsigned char too_small[4] = {};
+    ASSERT_THROW(UncompressedBuffer::decompress_into(compressed.get_bytes(), too_small), std::runtime_error);
+    ASSERT_THROW(UncompressedBuffer(ArrayView<const unsigned char>(too_small)), std::runtime_error);
+}
+TEST(compressed_buffer, dictionary)
+{
+    std::vector<std::string> samples;
+    for (int i = 0; i < 100; ++i)
+        samples.push_back("{ \"name\": \"record number " + std::to_string(i) + "\", \"position\": [ 1.0, 2.5, " + std::to_string(i * 3) + " ] }");
+    Lz4Dictionary dictionary = Lz4Dictionary::FromSamples({ samples.data(), samples.data() + samples.size() });
+    ASSERT_FALSE(dictionary.get_text().empty());
+    std::string record = "{ \"name\": \"record number 1234\", \"position\": [ 1.0, 2.5, 17 ] }";
+    CompressedBuffer with_dictionary(record, dictionary);
+    CompressedBuffer without_dictionary(record, Lz4Codec::Fast());
+    ASSERT_LT(with_dictionary.get_bytes().size() * 2, without_dictionary.get_bytes().size());
+    UncompressedBuffer uncompressed(with_dictionary.get_bytes(), dictionary);
+    ASSERT_EQ(record, uncompressed.get_text());
+    // the same dictionary can be used many times
+    CompressedBuffer again(record, dictionary);
+    ASSERT_EQ(with_dictionary.get_bytes(), again.get_bytes());
+    // without the dictionary the references into the dictionary are invalid
+    ASSERT_THROW(UncompressedBuffer{with_dictionary.get_bytes()}, std::runtime_error);
+}
+TEST(compressed_buffer, shuffle_filter)
+{
+    // slowly changing floats. the exponent bytes barely change, but they are
+    // spread out between the noisy mantissa bytes
+    std::vector<float> floats(10000);
+    for (size_t i = 0; i < floats.size(); ++i)
+        floats[i] = 100.0f + float(i % 1000) * 0.37f;
+    const unsigned char * begin = reinterpret_cast<const unsigned char *>(floats.data());
+    ArrayView<const unsigned char> bytes(begin, begin + floats.size() * sizeof(float));
+    CompressedBuffer plain(bytes, Lz4Codec::Fast());
+    for (ShuffleFilter filter : { ShuffleFilter::Bytes(sizeof(float)), ShuffleFilter::Bits(sizeof(float)) })
+    {
+        CompressedBuffer shuffled(bytes, Lz4Codec::Fast(), filter);
+        ASSERT_LT(shuffled.get_bytes().size(), plain.get_bytes().size());
+        UncompressedBuffer uncompressed(shuffled.get_bytes(), filter);
+        ASSERT_EQ(bytes, uncompressed.get_bytes());
+    }
+}
+TEST(compressed_buffer, dictionary_size_limit)
+{
+    std::vector<std::string> samples(10, std::string(100, 'a'));
+    for (int i = 0; i < 10; ++i)
+        samples[i] += std::to_string(i);
+    Lz4Dictionary dictionary = Lz4Dictionary::FromSamples({ samples.data(), samples.data() + samples.size() }, 250);
+    ASSERT_LE(dictionary.get_text().size(), 250u);
+    ASSERT_FALSE(dictionary.get_text().empty());
+}
 
 #endif
 
@@ -3,6 +3,70 @@
 #include <memory>
 #include "util/view.hpp"
 #include "util/stl_container_forward.hpp"
+#include "util/shuffle.hpp"
+
+// chooses between the two compressors that lz4 offers
+struct Lz4Codec
+{
+    enum Mode
+    {
+        FastMode,
+        HighCompressionMode
+    };
+
+    // LZ4_compress_fast. acceleration 1 is the same as LZ4_compress_default.
+    // every increase makes compression faster and the output bigger.
+    // this is the one to use if you write more than you read
+    static Lz4Codec Fast(int acceleration = 1)
+    {
+        return { FastMode, acceleration };
+    }
+    // LZ4_compress_HC. see CompressedBuffer for what the level means. this
+    // is much slower to compress, but decompresses just as fast as the fast
+    // mode. so use this for data that is written once and read often
+    static Lz4Codec HighCompression(int lz4_compression_level = 0)
+    {
+        return { HighCompressionMode, lz4_compression_level };
+    }
+
+    // returns the number of bytes written to dest, or 0 on failure
+    int compress(const char * source, char * dest, int source_size, int max_dest_size) const;
+
+    Mode mode;
+    int level;
+};
+
+// a shared dictionary for compressing lots of small buffers that look alike.
+// on its own a record of a few hundred bytes barely compresses because lz4 has
+// nothing to refer back to. with a dictionary it can refer back into the
+// dictionary instead, and every record can still be decompressed on its own.
+// you need the exact same dictionary to decompress, so store it next to the
+// records
+struct Lz4Dictionary
+{
+    // lz4 only looks back 64 KiB, so anything bigger than this is wasted
+    static constexpr size_t max_size = 64 * 1024;
+
+    explicit Lz4Dictionary(StringView<const char> bytes);
+    // picks the samples that share the most content with the other samples
+    // until dictionary_size is reached. the samples should look like the data
+    // that you want to compress
+    static Lz4Dictionary FromSamples(ArrayView<const std::string> samples, size_t dictionary_size = max_size);
+
+    StringView<const char> get_text() const
+    {
+        return { bytes.get(), bytes.get() + size };
+    }
+
+private:
+    friend struct CompressedBuffer;
+
+    std::unique_ptr<char[]> bytes;
+    size_t size;
+    // the lz4 state right after LZ4_loadDict. copying this is much cheaper
+    // than loading the dictionary again for every record
+    std::unique_ptr<long long[]> loaded_stream;
+};
 
 struct CompressedBuffer
 {
@@ -15,6 +79,14 @@ struct CompressedBuffer
     // lz4 recommends values between 4 and 9, and currently 0 makes it default to 9
     CompressedBuffer(ArrayView<const unsigned char> bytes, int lz4_compression_level = 0);
     CompressedBuffer(StringView<const char> bytes, int lz4_compression_level = 0);
+    CompressedBuffer(ArrayView<const unsigned char> bytes, Lz4Codec codec);
+    CompressedBuffer(StringView<const char> bytes, Lz4Codec codec);
+    // runs the filter over the bytes before compressing. you have to pass the
+    // same filter to UncompressedBuffer to get the original bytes back
+    CompressedBuffer(ArrayView<const unsigned char> bytes, Lz4Codec codec, ShuffleFilter filter);
+    // always uses the fast mode of lz4
+    CompressedBuffer(ArrayView<const unsigned char> bytes, const Lz4Dictionary & dictionary, int acceleration = 1);
+    CompressedBuffer(StringView<const char> bytes, const Lz4Dictionary & dictionary, int acceleration = 1);
 
     // the above functions will allocate too much. this function
     // will reallocate the buffer to the size that will be returned by get_bytes()
@@ -33,9 +105,28 @@ private:
     size_t size;
 };
 
+// all of these throw a std::runtime_error if the compressed bytes are corrupt
 struct UncompressedBuffer
 {
+    UncompressedBuffer() = default;
     UncompressedBuffer(ArrayView<const unsigned char> compressed_bytes);
+    // for data that was compressed with a dictionary
+    UncompressedBuffer(ArrayView<const unsigned char> compressed_bytes, const Lz4Dictionary & dictionary);
+    // for data that was compressed with a shuffle filter
+    UncompressedBuffer(ArrayView<const unsigned char> compressed_bytes, ShuffleFilter filter);
+
+    // reads the size from the header that CompressedBuffer writes
+    static uint64_t uncompressed_size(ArrayView<const unsigned char> compressed_bytes);
+    // decompresses into memory owned by the caller. output has to be at least
+    // uncompressed_size() big. returns the part of output that was written to
+    static ArrayView<unsigned char> decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output);
+    static ArrayView<unsigned char> decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output, const Lz4Dictionary & dictionary);
+    static ArrayView<unsigned char> decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output, ShuffleFilter filter);
+    // replaces the content of this buffer. only allocates if the new content
+    // doesn't fit, so keep one of these around if you load repeatedly
+    void decompress(ArrayView<const unsigned char> compressed_bytes);
+    void decompress(ArrayView<const unsigned char> compressed_bytes, const Lz4Dictionary & dictionary);
+    void decompress(ArrayView<const unsigned char> compressed_bytes, ShuffleFilter filter);
 
     ArrayView<const unsigned char> get_bytes() const
     {
@@ -57,6 +148,11 @@ struct UncompressedBuffer
     }
 
 private:
+    static ArrayView<unsigned char> decompress_into(ArrayView<const unsigned char> compressed_bytes, ArrayView<unsigned char> output, const Lz4Dictionary * dictionary);
+    void decompress(ArrayView<const unsigned char> compressed_bytes, const Lz4Dictionary * dictionary);
+    void reserve(uint64_t new_capacity);
+
     std::unique_ptr<unsigned char[]> buffer;
-    uint64_t size;
+    uint64_t size = 0;
+    uint64_t capacity = 0;
 };
@@ -0,0 +1,459 @@
+#include "util/compressed_stream.hpp"
+#include "os/mmapped_file.hpp"
+#include "debug/assert.hpp"
+#include "lz4.h"
+#include <cstring>
+#include <stdexcept>
+
+CompressedOutputStreamBuffer::CompressedOutputStreamBuffer(UnixFile & file, size_t frame_size, Lz4Codec codec)
+    : file(file), frame_size(frame_size), codec(codec)
+    , frame(new char[frame_size])
+    , compressed(new char[sizeof(CompressedFrameHeader) + LZ4_compressBound(int(frame_size))])
+{
+    setp(frame.get(), frame.get() + frame_size);
+}
+CompressedOutputStreamBuffer::~CompressedOutputStreamBuffer()
+{
+    finish();
+}
+
+bool CompressedOutputStreamBuffer::finish()
+{
+    compress_frame();
+    return !write_failed;
+}
+
+bool CompressedOutputStreamBuffer::compress_frame()
+{
+    int uncompressed_size = int(pptr() - pbase());
+    if (!uncompressed_size)
+        return !write_failed;
+    char * compressed_begin = compressed.get() + sizeof(CompressedFrameHeader);
+    int compressed_size = codec.compress(pbase(), compressed_begin, uncompressed_size, LZ4_compressBound(int(frame_size)));
+    CompressedFrameHeader header = { uint32_t(uncompressed_size), uint32_t(compressed_size) };
+    std::memcpy(compressed.get(), &header, sizeof(header));
+    size_t to_write = sizeof(header) + compressed_size;
+    auto as_bytes = reinterpret_cast<const unsigned char *>(compressed.get());
+    if (!compressed_size || file.write({ as_bytes, as_bytes + to_write }) != to_write)
+        write_failed = true;
+    setp(frame.get(), frame.get() + frame_size);
+    return !write_failed;
+}
+
+CompressedOutputStreamBuffer::int_type CompressedOutputStreamBuffer::overflow(int_type c)
+{
+    if (!compress_frame())
+        return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+std::streamsize CompressedOutputStreamBuffer::xsputn(const char * bytes, std::streamsize count)
+{
+    std::streamsize written = 0;
+    while (written < count)
+    {
+        if (pptr() == epptr() && !compress_frame())
+            break;
+        std::streamsize to_copy = std::min<std::streamsize>(count - written, epptr() - pptr());
+        std::memcpy(pptr(), bytes + written, to_copy);
+        pbump(int(to_copy));
+        written += to_copy;
+    }
+    return written;
+}
+int CompressedOutputStreamBuffer::sync()
+{
+    return compress_frame() ? 0 : -1;
+}
+
+CompressedOutputStream::CompressedOutputStream(UnixFile & file, size_t frame_size, Lz4Codec codec)
+    : std::ostream(&buffer), buffer(file, frame_size, codec)
+{
+}
+
+StreamingDecompressor::StreamingDecompressor(ArrayView<const unsigned char> compressed_bytes, size_t num_buffers)
+    : compressed_bytes(compressed_bytes), buffers(std::max(num_buffers, size_t(1)))
+    , decompress_thread([this]{ decompress_all(); })
+{
+}
+StreamingDecompressor::~StreamingDecompressor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    buffer_freed.notify_one();
+    decompress_thread.join();
+}
+
+void StreamingDecompressor::decompress_all()
+{
+    size_t write_index = 0;
+    ArrayView<const unsigned char> remaining = compressed_bytes;
+    bool corrupt = false;
+    while (!remaining.empty())
+    {
+        CompressedFrameHeader header;
+        if (remaining.size() < sizeof(header))
+        {
+            corrupt = true;
+            break;
+        }
+        std::memcpy(&header, remaining.begin(), sizeof(header));
+        remaining = remaining.subview(sizeof(header));
+        if (remaining.size() < header.compressed_size)
+        {
+            corrupt = true;
+            break;
+        }
+        ArrayView<const unsigned char> frame = remaining.subview(0, header.compressed_size);
+        remaining = remaining.subview(header.compressed_size);
+        if (!header.uncompressed_size)
+            continue;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            buffer_freed.wait(lock, [&]{ return stop || num_filled < buffers.size(); });
+            if (stop)
+                return;
+        }
+        // nobody else touches this buffer until it's marked as filled
+        Buffer & buffer = buffers[write_index];
+        if (buffer.capacity < header.uncompressed_size)
+        {
+            buffer.bytes.reset(new unsigned char[header.uncompressed_size]);
+            buffer.capacity = header.uncompressed_size;
+        }
+        int decompressed = LZ4_decompress_safe(reinterpret_cast<const char *>(frame.begin()), reinterpret_cast<char *>(buffer.bytes.get()), int(frame.size()), int(header.uncompressed_size));
+        if (decompressed != int(header.uncompressed_size))
+        {
+            corrupt = true;
+            break;
+        }
+        buffer.size = header.uncompressed_size;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++num_filled;
+        }
+        buffer_filled.notify_one();
+        write_index = (write_index + 1) % buffers.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+        found_corrupt_data = corrupt;
+    }
+    buffer_filled.notify_one();
+}
+
+ArrayView<const unsigned char> StreamingDecompressor::next_chunk()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (holding_buffer)
+    {
+        holding_buffer = false;
+        --num_filled;
+        read_index = (read_index + 1) % buffers.size();
+        buffer_freed.notify_one();
+    }
+    buffer_filled.wait(lock, [&]{ return finished || num_filled > 0; });
+    if (!num_filled)
+    {
+        if (found_corrupt_data)
+            RAW_THROW(std::runtime_error("the compressed data is corrupt"));
+        return {};
+    }
+    holding_buffer = true;
+    const Buffer & buffer = buffers[read_index];
+    return { buffer.bytes.get(), buffer.bytes.get() + buffer.size };
+}
+
+PipelinedFileLoader::PipelinedFileLoader(StringView<const char> filename, size_t num_decompress_threads, size_t max_frames_in_flight)
+    : file(new UnixFile(filename, UnixFile::RDONLY)), frames(std::max(max_frames_in_flight, size_t(1)))
+{
+    if (!num_decompress_threads)
+        num_decompress_threads = std::max(1u, std::thread::hardware_concurrency());
+    read_thread = std::thread([this]{ read_all(); });
+    for (size_t i = 0; i < num_decompress_threads; ++i)
+        decompress_threads.emplace_back([this]{ decompress_frames(); });
+}
+PipelinedFileLoader::~PipelinedFileLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    frame_freed.notify_all();
+    frame_read.notify_all();
+    read_thread.join();
+    for (std::thread & thread : decompress_threads)
+        thread.join();
+}
+
+static bool read_exactly(UnixFile & file, unsigned char * bytes, size_t size)
+{
+    while (size)
+    {
+        ssize_t result = ssize_t(file.read({ bytes, bytes + size }));
+        if (result <= 0)
+            return false;
+        bytes += result;
+        size -= result;
+    }
+    return true;
+}
+
+void PipelinedFileLoader::read_all()
+{
+    bool failed = !file->is_valid();
+    for (size_t frame_index = 0; !failed; ++frame_index)
+    {
+        CompressedFrameHeader header;
+        ssize_t header_read = ssize_t(file->read({ reinterpret_cast<unsigned char *>(&header), reinterpret_cast<unsigned char *>(&header) + sizeof(header) }));
+        // the end of the file is only allowed between frames
+        if (header_read == 0)
+            break;
+        if (header_read < 0 || (size_t(header_read) < sizeof(header) && !read_exactly(*file, reinterpret_cast<unsigned char *>(&header) + header_read, sizeof(header) - header_read)))
+        {
+            failed = true;
+            break;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frame_freed.wait(lock, [&]{ return stop || frame_index - num_consumed < frames.size(); });
+            if (stop)
+                return;
+        }
+        // this frame is empty, so nobody else looks at it until it's marked as compressed
+        Frame & frame = frames[frame_index % frames.size()];
+        if (frame.compressed_capacity < header.compressed_size)
+        {
+            frame.compressed.reset(new unsigned char[header.compressed_size]);
+            frame.compressed_capacity = header.compressed_size;
+        }
+        if (frame.decompressed_capacity < header.uncompressed_size)
+        {
+            frame.decompressed.reset(new unsigned char[header.uncompressed_size]);
+            frame.decompressed_capacity = header.uncompressed_size;
+        }
+        frame.compressed_size = header.compressed_size;
+        frame.decompressed_size = header.uncompressed_size;
+        if (!read_exactly(*file, frame.compressed.get(), header.compressed_size))
+        {
+            failed = true;
+            break;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frame.state = Frame::Compressed;
+            to_decompress.push_back(frame_index);
+            ++num_read;
+        }
+        frame_read.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished_reading = true;
+        read_failed = failed;
+    }
+    frame_read.notify_all();
+    frame_decompressed.notify_all();
+}
+
+void PipelinedFileLoader::decompress_frames()
+{
+    for (;;)
+    {
+        Frame * to_process;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            frame_read.wait(lock, [&]{ return stop || finished_reading || !to_decompress.empty(); });
+            if (stop || to_decompress.empty())
+                return;
+            to_process = &frames[to_decompress.front() % frames.size()];
+            to_decompress.pop_front();
+            RAW_ASSERT(to_process->state == Frame::Compressed);
+            // nobody else touches the frame until it's marked as decompressed
+            to_process->state = Frame::Decompressing;
+        }
+        Frame & frame = *to_process;
+        int decompressed = LZ4_decompress_safe(reinterpret_cast<const char *>(frame.compressed.get()), reinterpret_cast<char *>(frame.decompressed.get()), int(frame.compressed_size), int(frame.decompressed_size));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frame.state = decompressed == int(frame.decompressed_size) ? Frame::Decompressed : Frame::Corrupt;
+        }
+        // the reader waits for a specific frame, so wake up everyone
+        frame_decompressed.notify_all();
+    }
+}
+
+ArrayView<const unsigned char> PipelinedFileLoader::next_chunk()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (holding_frame)
+    {
+        holding_frame = false;
+        frames[num_consumed % frames.size()].state = Frame::Empty;
+        ++num_consumed;
+        frame_freed.notify_one();
+    }
+    for (;;)
+    {
+        Frame & frame = frames[num_consumed % frames.size()];
+        frame_decompressed.wait(lock, [&]
+        {
+            return frame.state == Frame::Decompressed || frame.state == Frame::Corrupt || (finished_reading && num_consumed == num_read);
+        });
+        if (frame.state == Frame::Corrupt)
+            RAW_THROW(std::runtime_error("the compressed data is corrupt"));
+        if (frame.state != Frame::Decompressed)
+        {
+            if (read_failed)
+                RAW_THROW(std::runtime_error("couldn't read the compressed file"));
+            return {};
+        }
+        // frames that decompress to nothing would look like the end to the caller
+        if (frame.decompressed_size)
+        {
+            holding_frame = true;
+            return { frame.decompressed.get(), frame.decompressed.get() + frame.decompressed_size };
+        }
+        frame.state = Frame::Empty;
+        ++num_consumed;
+        frame_freed.notify_one();
+    }
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+#include "metafast/metafast.hpp"
+#include "metav3/serialization/optimistic_binary.hpp"
+#include "metav3/metav3_stl.hpp"
+#include "os/mmapped_file.hpp"
+
+static std::vector<unsigned char> decompress_all_frames(ArrayView<const unsigned char> bytes)
+{
+    std::vector<unsigned char> result;
+    while (!bytes.empty())
+    {
+        CompressedFrameHeader header;
+        std::memcpy(&header, bytes.begin(), sizeof(header));
+        bytes = bytes.subview(sizeof(header));
+        size_t old_size = result.size();
+        result.resize(old_size + header.uncompressed_size);
+        int decompressed = LZ4_decompress_safe(reinterpret_cast<const char *>(bytes.begin()), reinterpret_cast<char *>(result.data() + old_size), header.compressed_size, header.uncompressed_size);
+        if (decompressed != int(header.uncompressed_size))
+            return {};
+        bytes = bytes.subview(header.compressed_size);
+    }
+    return result;
+}
+
+TEST(compressed_stream, metafast_roundtrip)
+{
+    std::string filename = "/tmp/compressed_stream_test";
+    std::vector<int> to_write(10000);
+    for (size_t i = 0; i < to_write.size(); ++i)
+        to_write[i] = int(i % 100);
+    {
+        UnixFile file(filename, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        ASSERT_TRUE(file.is_valid());
+        // small frames to make sure that the data gets split up
+        CompressedOutputStream stream(file, 1024);
+        metaf::BinaryOutput output(stream);
+        metaf::write_binary(output, to_write);
+        ASSERT_TRUE(stream.finish());
+    }
+    MMappedFileRead file(filename);
+    std::vector<unsigned char> uncompressed = decompress_all_frames(file.get_bytes());
+    ASSERT_FALSE(uncompressed.empty());
+    metaf::BinaryInput input({ uncompressed.data(), uncompressed.data() + uncompressed.size() });
+    std::vector<int> read;
+    metaf::read_binary(input, read);
+    ASSERT_EQ(to_write, read);
+}
+
+TEST(compressed_stream, optimistic_binary_roundtrip)
+{
+    std::string filename = "/tmp/compressed_stream_test_v3";
+    std::vector<std::string> to_write = { "hello", "compressed", "world" };
+    {
+        UnixFile file(filename, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        CompressedOutputStream stream(file, 16);
+        write_optimistic_binary(to_write, stream);
+    }
+    MMappedFileRead file(filename);
+    std::vector<unsigned char> uncompressed = decompress_all_frames(file.get_bytes());
+    std::vector<std::string> read;
+    read_optimistic_binary(read, { uncompressed.data(), uncompressed.data() + uncompressed.size() });
+    ASSERT_EQ(to_write, read);
+}
+
+TEST(compressed_stream, streaming_decompressor)
+{
+    std::string filename = "/tmp/compressed_stream_test_streaming";
+    std::vector<std::string> to_write;
+    for (int i = 0; i < 1000; ++i)
+        to_write.push_back(std::to_string(i * i));
+    {
+        UnixFile file(filename, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        CompressedOutputStream stream(file, 64);
+        metaf::BinaryOutput output(stream);
+        metaf::write_binary(output, to_write);
+    }
+    MMappedFileRead file(filename);
+    // only two buffers so that the helper thread has to wait for the reader
+    StreamingDecompressor decompressor(file.get_bytes(), 2);
+    metaf::BinaryInput input = metaf::BinaryInput::FromChunks(decompressor);
+    std::vector<std::string> read;
+    metaf::read_binary(input, read);
+    ASSERT_EQ(to_write, read);
+    ASSERT_TRUE(decompressor.next_chunk().empty());
+}
+
+TEST(compressed_stream, streaming_decompressor_corrupt)
+{
+    std::vector<unsigned char> garbage(100, 7);
+    StreamingDecompressor decompressor({ garbage.data(), garbage.data() + garbage.size() });
+    ASSERT_THROW(decompressor.next_chunk(), std::runtime_error);
+}
+
+TEST(compressed_stream, pipelined_file_loader)
+{
+    std::string filename = "/tmp/compressed_stream_test_pipelined";
+    std::vector<std::string> to_write;
+    for (int i = 0; i < 5000; ++i)
+        to_write.push_back(std::to_string(i * 7));
+    {
+        UnixFile file(filename, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        CompressedOutputStream stream(file, 100);
+        metaf::BinaryOutput output(stream);
+        metaf::write_binary(output, to_write);
+    }
+    // fewer frames in flight than threads, so that every stage has to wait
+    PipelinedFileLoader loader(filename, 3, 2);
+    metaf::BinaryInput input = metaf::BinaryInput::FromChunks(loader);
+    std::vector<std::string> read;
+    metaf::read_binary(input, read);
+    ASSERT_EQ(to_write, read);
+    ASSERT_TRUE(loader.next_chunk().empty());
+}
+
+TEST(compressed_stream, pipelined_file_loader_errors)
+{
+    PipelinedFileLoader missing("/tmp/this_file_does_not_exist_hopefully");
+    ASSERT_THROW(missing.next_chunk(), std::runtime_error);
+    std::string filename = "/tmp/compressed_stream_test_pipelined_truncated";
+    {
+        UnixFile file(filename, UnixFile::WRONLY | UnixFile::CREAT | UnixFile::TRUNC, 0644);
+        CompressedFrameHeader header = { 100, 50 };
+        ASSERT_EQ(sizeof(header), file.write({ reinterpret_cast<const unsigned char *>(&header), reinterpret_cast<const unsigned char *>(&header) + sizeof(header) }));
+    }
+    PipelinedFileLoader truncated(filename);
+    ASSERT_THROW(truncated.next_chunk(), std::runtime_error);
+}
+
+#endif
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+#include "util/view.hpp"
+#include "util/compressed_buffer.hpp"
+
+struct UnixFile;
+
+// the format written by CompressedOutputStreamBuffer: the bytes get split into
+// frames and every frame gets compressed on its own. each frame starts with
+// this header, followed by compressed_size bytes of lz4 data. the stream ends
+// at the end of the file
+struct CompressedFrameHeader
+{
+    uint32_t uncompressed_size;
+    uint32_t compressed_size;
+};
+
+// a streambuf that compresses bytes as they arrive. whenever a frame is full it
+// gets compressed and written to the file, so only one frame worth of data is
+// ever held in memory instead of the whole payload. plug it into a std::ostream
+// to use it as the output for metaf::BinaryOutput or write_optimistic_binary.
+// this can not seek
+struct CompressedOutputStreamBuffer : std::streambuf
+{
+    static constexpr size_t default_frame_size = 256 * 1024;
+
+    CompressedOutputStreamBuffer(UnixFile & file, size_t frame_size = default_frame_size, Lz4Codec codec = Lz4Codec::Fast());
+    ~CompressedOutputStreamBuffer();
+
+    // compresses and writes whatever is in the current frame. the destructor
+    // calls this, but call it yourself if you want to know whether all writes
+    // succeeded
+    bool finish();
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char * bytes, std::streamsize count) override;
+    int sync() override;
+
+private:
+    bool compress_frame();
+
+    UnixFile & file;
+    size_t frame_size;
+    Lz4Codec codec;
+    std::unique_ptr<char[]> frame;
+    std::unique_ptr<char[]> compressed;
+    bool write_failed = false;
+};
+
+struct CompressedOutputStream : std::ostream
+{
+    CompressedOutputStream(UnixFile & file, size_t frame_size = CompressedOutputStreamBuffer::default_frame_size, Lz4Codec codec = Lz4Codec::Fast());
+
+    bool finish()
+    {
+        return buffer.finish();
+    }
+
+private:
+    CompressedOutputStreamBuffer buffer;
+};
+
+// reads the frames written by CompressedOutputStreamBuffer. a helper thread
+// decompresses frame by frame into a small ring of buffers while the caller
+// is still deserializing from earlier frames, so decompression and
+// deserialization run in parallel and memory use is bounded by the number of
+// buffers instead of by the uncompressed size. use it with
+// metaf::BinaryInput::FromChunks()
+struct StreamingDecompressor
+{
+    static constexpr size_t default_num_buffers = 4;
+
+    // compressed_bytes have to stay alive until this is destroyed. they can
+    // come from a MMappedFileRead
+    StreamingDecompressor(ArrayView<const unsigned char> compressed_bytes, size_t num_buffers = default_num_buffers);
+    ~StreamingDecompressor();
+
+    // returns the next decompressed frame, or an empty range at the end. the
+    // returned bytes stay valid until the next call. throws if the compressed
+    // data is corrupt
+    ArrayView<const unsigned char> next_chunk();
+
+private:
+    struct Buffer
+    {
+        std::unique_ptr<unsigned char[]> bytes;
+        size_t capacity = 0;
+        size_t size = 0;
+    };
+
+    void decompress_all();
+
+    ArrayView<const unsigned char> compressed_bytes;
+    std::vector<Buffer> buffers;
+    std::mutex mutex;
+    std::condition_variable buffer_filled;
+    std::condition_variable buffer_freed;
+    // the filled buffers start at read_index. if the caller is still holding
+    // on to the last returned chunk, that buffer counts as filled
+    size_t read_index = 0;
+    size_t num_filled = 0;
+    bool holding_buffer = false;
+    bool finished = false;
+    bool found_corrupt_data = false;
+    bool stop = false;
+    std::thread decompress_thread;
+};
+
+// loads a file written by CompressedOutputStreamBuffer in three overlapping
+// stages: one thread reads the compressed frames from the file, a pool of
+// threads decompresses them, and the caller deserializes them in order. at
+// most max_frames_in_flight frames are in memory at once, so if one stage is
+// slower the others wait for it instead of piling up data. the total time is
+// then close to the time of the slowest stage instead of the sum of all of
+// them. use it with metaf::BinaryInput::FromChunks()
+struct PipelinedFileLoader
+{
+    static constexpr size_t default_max_frames_in_flight = 8;
+
+    // num_decompress_threads = 0 means one per core
+    PipelinedFileLoader(StringView<const char> filename, size_t num_decompress_threads = 0, size_t max_frames_in_flight = default_max_frames_in_flight);
+    ~PipelinedFileLoader();
+
+    // same as StreamingDecompressor::next_chunk(). also throws if the file
+    // couldn't be read
+    ArrayView<const unsigned char> next_chunk();
+
+private:
+    struct Frame
+    {
+        enum State
+        {
+            Empty,
+            Compressed,
+            Decompressing,
+            Decompressed,
+            Corrupt
+        };
+        State state = Empty;
+        std::unique_ptr<unsigned char[]> compressed;
+        size_t compressed_capacity = 0;
+        size_t compressed_size = 0;
+        std::unique_ptr<unsigned char[]> decompressed;
+        size_t decompressed_capacity = 0;
+        size_t decompressed_size = 0;
+    };
+
+    void read_all();
+    void decompress_frames();
+
+    std::unique_ptr<UnixFile> file;
+    // frame number i lives in frames[i % frames.size()]
+    std::vector<Frame> frames;
+    std::mutex mutex;
+    std::condition_variable frame_freed;
+    std::condition_variable frame_read;
+    std::condition_variable frame_decompressed;
+    std::deque<size_t> to_decompress;
+    size_t num_read = 0;
+    size_t num_consumed = 0;
+    bool holding_frame = false;
+    bool finished_reading = false;
+    bool read_failed = false;
+    bool stop = false;
+    std::thread read_thread;
+    std::vector<std::thread> decompress_threads;
+};
@@ -0,0 +1,88 @@
+#include "util/crc32.hpp"
+#include <cstring>
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+namespace
+{
+#ifndef __SSE4_2__
+// slicing by eight: table[k][b] is the crc of byte b followed by k zero bytes,
+// so eight bytes can be handled with eight independent lookups
+struct Crc32cTables
+{
+    Crc32cTables()
+    {
+        const uint32_t polynomial = 0x82f63b78;
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+                crc = (crc >> 1) ^ (polynomial & (0 - (crc & 1)));
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            for (int k = 1; k < 8; ++k)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+        }
+    }
+    uint32_t table[8][256];
+};
+static const Crc32cTables crc32c_tables;
+#endif
+}
+
+uint32_t crc32c(ArrayView<const unsigned char> bytes, uint32_t previous)
+{
+    uint32_t crc = ~previous;
+    const unsigned char * it = bytes.begin();
+    const unsigned char * end = bytes.end();
+#ifdef __SSE4_2__
+    uint64_t crc64 = crc;
+    for (; end - it >= 8; it += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, it, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = uint32_t(crc64);
+    for (; it != end; ++it)
+        crc = _mm_crc32_u8(crc, *it);
+#else
+    const auto & table = crc32c_tables.table;
+    for (; end - it >= 8; it += 8)
+    {
+        uint32_t low;
+        uint32_t high;
+        std::memcpy(&low, it, sizeof(low));
+        std::memcpy(&high, it + 4, sizeof(high));
+        low ^= crc;
+        crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+            ^ table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+    }
+    for (; it != end; ++it)
+        crc = (crc >> 8) ^ table[0][(crc ^ *it) & 0xff];
+#endif
+    return ~crc;
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+
+TEST(crc32c, known_values)
+{
+    unsigned char digits[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    ASSERT_EQ(0xe3069283u, crc32c(digits));
+    ASSERT_EQ(0u, crc32c(ArrayView<const unsigned char>()));
+}
+TEST(crc32c, in_pieces)
+{
+    unsigned char bytes[100];
+    for (int i = 0; i < 100; ++i)
+        bytes[i] = static_cast<unsigned char>(i * 31);
+    ArrayView<const unsigned char> all = bytes;
+    ASSERT_EQ(crc32c(all), crc32c(all.subview(37), crc32c(all.subview(0, 37))));
+}
+
+#endif
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include "util/view.hpp"
+
+// CRC-32C (the castagnoli polynomial, the one that SSE 4.2 has an instruction
+// for). pass the result of an earlier call as the second argument to continue
+// a checksum over several pieces
+uint32_t crc32c(ArrayView<const unsigned char> bytes, uint32_t previous = 0);
@@ -102,4 +102,52 @@ TEST(memoizing_map, DISABLED_exception)
 	ASSERT_THROW(std::rethrow_exception(std::move(first_exception)), test_exception);
 }
 
+TEST(concurrent_memoizing_map, every_value_computed_once)
+{
+    concurrent_memoizing_map<int, int> map;
+    std::atomic<int> num_computed(0);
+    std::atomic<int> num_wrong(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&]
+        {
+            // enough keys that the table has to grow a few times while the
+            // other threads are reading from it
+            for (int key = 0; key < 1000; ++key)
+            {
+                int value = map.get(key, [&](int key)
+                {
+                    ++num_computed;
+                    return key * 2;
+                });
+                if (value != key * 2)
+                    ++num_wrong;
+            }
+        });
+    }
+    for (std::thread & thread : threads)
+        thread.join();
+    ASSERT_EQ(0, num_wrong.load());
+    ASSERT_EQ(1000, num_computed.load());
+    const int & first = map.get(5, [](int){ return -1; });
+    ASSERT_EQ(10, first);
+    // references stay valid when the table grows
+    for (int key = 1000; key < 2000; ++key)
+        map.get(key, [](int key){ return key; });
+    ASSERT_EQ(&first, &map.get(5, [](int){ return -1; }));
+}
+
+TEST(concurrent_memoizing_map, aligned_pointer_keys)
+{
+    // these keys are all 64 bytes apart, so the low bits of std::hash are
+    // the same for all of them
+    std::vector<char> storage(64 * 4096);
+    concurrent_memoizing_map<const char *, size_t> map;
+    for (size_t i = 0; i < 4096; ++i)
+        ASSERT_EQ(i, map.get(storage.data() + 64 * i, [&](const char *){ return i; }));
+    for (size_t i = 0; i < 4096; ++i)
+        ASSERT_EQ(i, map.get(storage.data() + 64 * i, [](const char *){ return size_t(-1); }));
+}
+
 #endif
@@ -1,6 +1,12 @@
 #pragma once
 
 #include <map>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "util/copyableMutex.hpp"
 
 
@@ -136,3 +142,132 @@ private:
 	mutable copyable_mutex map_mutex;
 	mutable std::map<K, lazy_initialize<V>, Comp, Allocator> map;
 };
+
+// a memoizing_map for caches that are read far more often than they are
+// written to. looking up a key that's already in there doesn't take a lock:
+// the entries are in an open addressing table of atomic pointers. a new key
+// gets inserted into an empty slot under a mutex, and when the table gets too
+// full a bigger copy is built and published, rcu style. the old tables stay
+// alive until the map dies because a reader may still be probing them.
+// this is only a cache, so copying one gives an empty map. don't copy or
+// assign while other threads use it
+template<typename K, typename V, typename Hash = std::hash<K>, typename Equal = std::equal_to<K> >
+struct concurrent_memoizing_map
+{
+    concurrent_memoizing_map()
+    {
+    }
+    concurrent_memoizing_map(const concurrent_memoizing_map &)
+    {
+    }
+    concurrent_memoizing_map & operator=(const concurrent_memoizing_map &)
+    {
+        table.store(nullptr, std::memory_order_relaxed);
+        tables.clear();
+        entries.clear();
+        return *this;
+    }
+
+    template<typename DefaultFunc>
+    V & get(const K & key, const DefaultFunc & func)
+    {
+        return const_cast<V &>(const_cast<const concurrent_memoizing_map &>(*this).get(key, func));
+    }
+    template<typename DefaultFunc>
+    const V & get(const K & key, const DefaultFunc & func) const
+    {
+        size_t hash = Hash()(key);
+        const Entry * entry = find(table.load(std::memory_order_acquire), hash, key);
+        if (!entry)
+            entry = &insert(hash, key);
+        return entry->value.get([&]() -> decltype(auto)
+        {
+            return func(key);
+        });
+    }
+
+private:
+    struct Entry
+    {
+        Entry(size_t hash, const K & key)
+            : hash(hash), key(key)
+        {
+        }
+
+        size_t hash;
+        K key;
+        lazy_initialize<V> value;
+    };
+    struct Table
+    {
+        explicit Table(int num_bits)
+            : slots(new std::atomic<Entry *>[size_t(1) << num_bits]), mask((size_t(1) << num_bits) - 1), num_bits(num_bits)
+        {
+            for (size_t i = 0; i <= mask; ++i)
+                slots[i].store(nullptr, std::memory_order_relaxed);
+        }
+        // std::hash of a pointer or an integer is the value itself. pointers
+        // are aligned, so the low bits would be the same for all of them and
+        // everything would end up in the same few slots. multiplying with
+        // 2^64 / golden ratio mixes all bits into the top bits, and those are
+        // used as the index
+        size_t first_index(size_t hash) const
+        {
+            return size_t((uint64_t(hash) * 11400714819323198485ull) >> (64 - num_bits));
+        }
+        void place(Entry * entry)
+        {
+            size_t index = first_index(entry->hash);
+            while (slots[index].load(std::memory_order_relaxed))
+                index = (index + 1) & mask;
+            slots[index].store(entry, std::memory_order_release);
+            ++num_entries;
+        }
+
+        std::unique_ptr<std::atomic<Entry *>[]> slots;
+        size_t mask;
+        int num_bits;
+        // only used while holding the mutex
+        size_t num_entries = 0;
+    };
+
+    static const Entry * find(const Table * table, size_t hash, const K & key)
+    {
+        if (!table)
+            return nullptr;
+        for (size_t index = table->first_index(hash);; index = (index + 1) & table->mask)
+        {
+            const Entry * entry = table->slots[index].load(std::memory_order_acquire);
+            if (!entry)
+                return nullptr;
+            if (entry->hash == hash && Equal()(entry->key, key))
+                return entry;
+        }
+    }
+    const Entry & insert(size_t hash, const K & key) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Table * current = table.load(std::memory_order_relaxed);
+        // someone else may have inserted it in the meantime
+        if (const Entry * found = find(current, hash, key))
+            return *found;
+        // at most half full, so that the probe sequences stay short
+        if (!current || 2 * (current->num_entries + 1) > current->mask + 1)
+        {
+            std::unique_ptr<Table> bigger(new Table(current ? current->num_bits + 1 : 3));
+            for (const std::unique_ptr<Entry> & entry : entries)
+                bigger->place(entry.get());
+            tables.push_back(std::move(bigger));
+            current = tables.back().get();
+        }
+        entries.emplace_back(new Entry(hash, key));
+        current->place(entries.back().get());
+        table.store(current, std::memory_order_release);
+        return *entries.back();
+    }
+
+    mutable std::mutex mutex;
+    mutable std::atomic<Table *> table{ nullptr };
+    mutable std::vector<std::unique_ptr<Table>> tables;
+    mutable std::vector<std::unique_ptr<Entry>> entries;
+};
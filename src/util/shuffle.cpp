@@ -0,0 +1,349 @@
+#include "util/shuffle.hpp"
+#include "debug/assert.hpp"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void ShuffleFilter::apply(ArrayView<const unsigned char> input, ArrayView<unsigned char> output) const
+{
+    if (!is_active())
+        std::memcpy(output.begin(), input.begin(), input.size());
+    else if (mode == ByteShuffle)
+        byte_shuffle(input, output, element_size);
+    else
+        bit_shuffle(input, output, element_size);
+}
+void ShuffleFilter::undo(ArrayView<const unsigned char> input, ArrayView<unsigned char> output) const
+{
+    if (!is_active())
+        std::memcpy(output.begin(), input.begin(), input.size());
+    else if (mode == ByteShuffle)
+        byte_unshuffle(input, output, element_size);
+    else
+        bit_unshuffle(input, output, element_size);
+}
+
+namespace
+{
+#ifdef __SSE2__
+// these work on sixteen elements at a time, so that every byte plane fills
+// exactly one register. the shuffle shifts the wanted byte to the bottom of
+// every element, masks out the rest and then narrows with the pack
+// instructions, which keep the order of the elements. the unshuffle
+// interleaves the planes with unpack: first bytes, then pairs of bytes etc.
+void shuffle_2_sse2(const unsigned char * in, unsigned char * out, size_t num_elements)
+{
+    const __m128i low_byte = _mm_set1_epi16(0xff);
+    for (size_t i = 0; i + 16 <= num_elements; i += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 2 + 16));
+        __m128i first = _mm_packus_epi16(_mm_and_si128(a, low_byte), _mm_and_si128(b, low_byte));
+        __m128i second = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), first);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + num_elements + i), second);
+    }
+}
+void shuffle_4_sse2(const unsigned char * in, unsigned char * out, size_t num_elements)
+{
+    const __m128i low_byte = _mm_set1_epi32(0xff);
+    for (size_t i = 0; i + 16 <= num_elements; i += 16)
+    {
+        __m128i v[4];
+        for (int j = 0; j < 4; ++j)
+            v[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 4 + j * 16));
+        for (int byte = 0; byte < 4; ++byte)
+        {
+            __m128i b[4];
+            for (int j = 0; j < 4; ++j)
+                b[j] = _mm_and_si128(_mm_srli_epi32(v[j], byte * 8), low_byte);
+            __m128i plane = _mm_packus_epi16(_mm_packs_epi32(b[0], b[1]), _mm_packs_epi32(b[2], b[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + byte * num_elements + i), plane);
+        }
+    }
+}
+void shuffle_8_sse2(const unsigned char * in, unsigned char * out, size_t num_elements)
+{
+    const __m128i low_byte = _mm_set_epi32(0, 0xff, 0, 0xff);
+    for (size_t i = 0; i + 16 <= num_elements; i += 16)
+    {
+        __m128i v[8];
+        for (int j = 0; j < 8; ++j)
+            v[j] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 8 + j * 16));
+        for (int byte = 0; byte < 8; ++byte)
+        {
+            // there is no pack for 64 bit integers, so move the two values
+            // next to each other first and then combine two registers
+            __m128i b[4];
+            for (int j = 0; j < 4; ++j)
+            {
+                __m128i lo = _mm_shuffle_epi32(_mm_and_si128(_mm_srli_epi64(v[j * 2], byte * 8), low_byte), _MM_SHUFFLE(3, 1, 2, 0));
+                __m128i hi = _mm_shuffle_epi32(_mm_and_si128(_mm_srli_epi64(v[j * 2 + 1], byte * 8), low_byte), _MM_SHUFFLE(3, 1, 2, 0));
+                b[j] = _mm_unpacklo_epi64(lo, hi);
+            }
+            __m128i plane = _mm_packus_epi16(_mm_packs_epi32(b[0], b[1]), _mm_packs_epi32(b[2], b[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + byte * num_elements + i), plane);
+        }
+    }
+}
+
+void unshuffle_2_sse2(const unsigned char * in, unsigned char * out, size_t num_elements)
+{
+    for (size_t i = 0; i + 16 <= num_elements; i += 16)
+    {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + num_elements + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2), _mm_unpacklo_epi8(first, second));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2 + 16), _mm_unpackhi_epi8(first, second));
+    }
+}
+void unshuffle_4_sse2(const unsigned char * in, unsigned char * out, size_t num_elements)
+{
+    for (size_t i = 0; i + 16 <= num_elements; i += 16)
+    {
+        __m128i p[4];
+        for (int byte = 0; byte < 4; ++byte)
+            p[byte] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + byte * num_elements + i));
+        __m128i lo01 = _mm_unpacklo_epi8(p[0], p[1]);
+        __m128i hi01 = _mm_unpackhi_epi8(p[0], p[1]);
+        __m128i lo23 = _mm_unpacklo_epi8(p[2], p[3]);
+        __m128i hi23 = _mm_unpackhi_epi8(p[2], p[3]);
+        __m128i * dest = reinterpret_cast<__m128i *>(out + i * 4);
+        _mm_storeu_si128(dest, _mm_unpacklo_epi16(lo01, lo23));
+        _mm_storeu_si128(dest + 1, _mm_unpackhi_epi16(lo01, lo23));
+        _mm_storeu_si128(dest + 2, _mm_unpacklo_epi16(hi01, hi23));
+        _mm_storeu_si128(dest + 3, _mm_unpackhi_epi16(hi01, hi23));
+    }
+}
+void unshuffle_8_sse2(const unsigned char * in, unsigned char * out, size_t num_elements)
+{
+    for (size_t i = 0; i + 16 <= num_elements; i += 16)
+    {
+        __m128i p[8];
+        for (int byte = 0; byte < 8; ++byte)
+            p[byte] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + byte * num_elements + i));
+        __m128i bytes[8];
+        for (int j = 0; j < 4; ++j)
+        {
+            bytes[j * 2] = _mm_unpacklo_epi8(p[j * 2], p[j * 2 + 1]);
+            bytes[j * 2 + 1] = _mm_unpackhi_epi8(p[j * 2], p[j * 2 + 1]);
+        }
+        // bytes[0] and bytes[1] have the first two bytes of elements 0-7 and
+        // 8-15, bytes[2] and bytes[3] have the next two bytes etc.
+        __m128i pairs[8];
+        for (int j = 0; j < 2; ++j)
+        {
+            pairs[j * 4] = _mm_unpacklo_epi16(bytes[j * 4], bytes[j * 4 + 2]);
+            pairs[j * 4 + 1] = _mm_unpackhi_epi16(bytes[j * 4], bytes[j * 4 + 2]);
+            pairs[j * 4 + 2] = _mm_unpacklo_epi16(bytes[j * 4 + 1], bytes[j * 4 + 3]);
+            pairs[j * 4 + 3] = _mm_unpackhi_epi16(bytes[j * 4 + 1], bytes[j * 4 + 3]);
+        }
+        __m128i * dest = reinterpret_cast<__m128i *>(out + i * 8);
+        for (int j = 0; j < 4; ++j)
+        {
+            _mm_storeu_si128(dest + j * 2, _mm_unpacklo_epi32(pairs[j], pairs[j + 4]));
+            _mm_storeu_si128(dest + j * 2 + 1, _mm_unpackhi_epi32(pairs[j], pairs[j + 4]));
+        }
+    }
+}
+#endif
+
+size_t num_vectorized_elements(size_t num_elements, size_t element_size)
+{
+#ifdef __SSE2__
+    if (element_size == 2 || element_size == 4 || element_size == 8)
+        return num_elements - num_elements % 16;
+#else
+    static_cast<void>(element_size);
+#endif
+    return 0;
+}
+
+// transposes an 8x8 matrix of bits. afterwards byte i contains bit i of every
+// input byte. from hacker's delight. doing it twice gives the original back
+void transpose_8x8_bits(unsigned char * bytes)
+{
+    uint64_t x;
+    std::memcpy(&x, bytes, sizeof(x));
+    uint64_t t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc0000ccccull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ull;
+    x = x ^ t ^ (t << 28);
+    std::memcpy(bytes, &x, sizeof(x));
+}
+}
+
+void byte_shuffle(ArrayView<const unsigned char> input, ArrayView<unsigned char> output, size_t element_size)
+{
+    RAW_ASSERT(input.size() == output.size() && element_size > 0, "invalid arguments for the shuffle");
+    size_t num_elements = input.size() / element_size;
+    const unsigned char * in = input.begin();
+    unsigned char * out = output.begin();
+    size_t done = num_vectorized_elements(num_elements, element_size);
+#ifdef __SSE2__
+    if (element_size == 2)
+        shuffle_2_sse2(in, out, num_elements);
+    else if (element_size == 4)
+        shuffle_4_sse2(in, out, num_elements);
+    else if (element_size == 8)
+        shuffle_8_sse2(in, out, num_elements);
+#endif
+    for (size_t i = done; i < num_elements; ++i)
+    {
+        for (size_t byte = 0; byte < element_size; ++byte)
+            out[byte * num_elements + i] = in[i * element_size + byte];
+    }
+    size_t shuffled_size = num_elements * element_size;
+    std::memcpy(out + shuffled_size, in + shuffled_size, input.size() - shuffled_size);
+}
+void byte_unshuffle(ArrayView<const unsigned char> input, ArrayView<unsigned char> output, size_t element_size)
+{
+    RAW_ASSERT(input.size() == output.size() && element_size > 0, "invalid arguments for the shuffle");
+    size_t num_elements = input.size() / element_size;
+    const unsigned char * in = input.begin();
+    unsigned char * out = output.begin();
+    size_t done = num_vectorized_elements(num_elements, element_size);
+#ifdef __SSE2__
+    if (element_size == 2)
+        unshuffle_2_sse2(in, out, num_elements);
+    else if (element_size == 4)
+        unshuffle_4_sse2(in, out, num_elements);
+    else if (element_size == 8)
+        unshuffle_8_sse2(in, out, num_elements);
+#endif
+    for (size_t i = done; i < num_elements; ++i)
+    {
+        for (size_t byte = 0; byte < element_size; ++byte)
+            out[i * element_size + byte] = in[byte * num_elements + i];
+    }
+    size_t shuffled_size = num_elements * element_size;
+    std::memcpy(out + shuffled_size, in + shuffled_size, input.size() - shuffled_size);
+}
+
+// after the byte shuffle every plane has num_elements bytes. the bit shuffle
+// splits the first num_elements / 8 * 8 of those into eight rows of bits: row
+// r has bit r of every byte in the plane. the bytes at the end of the plane
+// that don't make a full group of eight are kept as they are
+void bit_shuffle(ArrayView<const unsigned char> input, ArrayView<unsigned char> output, size_t element_size)
+{
+    std::unique_ptr<unsigned char[]> planes(new unsigned char[input.size()]);
+    byte_shuffle(input, { planes.get(), planes.get() + input.size() }, element_size);
+    std::memcpy(output.begin(), planes.get(), input.size());
+    size_t num_elements = input.size() / element_size;
+    size_t num_groups = num_elements / 8;
+    for (size_t plane = 0; plane < element_size; ++plane)
+    {
+        const unsigned char * in = planes.get() + plane * num_elements;
+        unsigned char * out = output.begin() + plane * num_elements;
+        for (size_t group = 0; group < num_groups; ++group)
+        {
+            unsigned char bytes[8];
+            std::memcpy(bytes, in + group * 8, 8);
+            transpose_8x8_bits(bytes);
+            for (size_t row = 0; row < 8; ++row)
+                out[row * num_groups + group] = bytes[row];
+        }
+    }
+}
+void bit_unshuffle(ArrayView<const unsigned char> input, ArrayView<unsigned char> output, size_t element_size)
+{
+    RAW_ASSERT(input.size() == output.size() && element_size > 0, "invalid arguments for the shuffle");
+    std::unique_ptr<unsigned char[]> planes(new unsigned char[input.size()]);
+    std::memcpy(planes.get(), input.begin(), input.size());
+    size_t num_elements = input.size() / element_size;
+    size_t num_groups = num_elements / 8;
+    for (size_t plane = 0; plane < element_size; ++plane)
+    {
+        const unsigned char * in = input.begin() + plane * num_elements;
+        unsigned char * out = planes.get() + plane * num_elements;
+        for (size_t group = 0; group < num_groups; ++group)
+        {
+            unsigned char bytes[8];
+            for (size_t row = 0; row < 8; ++row)
+                bytes[row] = in[row * num_groups + group];
+            transpose_8x8_bits(bytes);
+            std::memcpy(out + group * 8, bytes, 8);
+        }
+    }
+    byte_unshuffle({ planes.get(), planes.get() + input.size() }, output, element_size);
+}
+
+#ifndef DISABLE_GTEST
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+static std::vector<unsigned char> shuffle_test_bytes(size_t size)
+{
+    std::vector<unsigned char> result(size);
+    for (size_t i = 0; i < size; ++i)
+        result[i] = static_cast<unsigned char>(i * 7 + i / 5);
+    return result;
+}
+
+TEST(shuffle, byte_shuffle_layout)
+{
+    // four elements of size three
+    std::vector<unsigned char> input = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13 };
+    std::vector<unsigned char> output(input.size());
+    byte_shuffle({ input.data(), input.data() + input.size() }, { output.data(), output.data() + output.size() }, 3);
+    std::vector<unsigned char> expected = { 1, 4, 7, 10, 2, 5, 8, 11, 3, 6, 9, 12, 13 };
+    ASSERT_EQ(expected, output);
+}
+TEST(shuffle, vectorized_matches_scalar)
+{
+    // 37 elements so that both the vectorized part and the remainder run.
+    // the element at index i has byte b set to i * 16 + b
+    for (size_t element_size : { 2u, 4u, 8u })
+    {
+        size_t num_elements = 37;
+        std::vector<unsigned char> input(num_elements * element_size + element_size - 1);
+        for (size_t i = 0; i < num_elements; ++i)
+            for (size_t b = 0; b < element_size; ++b)
+                input[i * element_size + b] = static_cast<unsigned char>(i * 16 + b);
+        std::vector<unsigned char> output(input.size());
+        byte_shuffle({ input.data(), input.data() + input.size() }, { output.data(), output.data() + output.size() }, element_size);
+        for (size_t i = 0; i < num_elements; ++i)
+            for (size_t b = 0; b < element_size; ++b)
+                ASSERT_EQ(input[i * element_size + b], output[b * num_elements + i]) << element_size << " " << i << " " << b;
+        std::vector<unsigned char> roundtrip(input.size());
+        byte_unshuffle({ output.data(), output.data() + output.size() }, { roundtrip.data(), roundtrip.data() + roundtrip.size() }, element_size);
+        ASSERT_EQ(input, roundtrip);
+    }
+}
+TEST(shuffle, bit_shuffle_roundtrip)
+{
+    for (size_t element_size : { 1u, 3u, 4u, 8u })
+    {
+        std::vector<unsigned char> input = shuffle_test_bytes(1001);
+        std::vector<unsigned char> shuffled(input.size());
+        std::vector<unsigned char> roundtrip(input.size());
+        ShuffleFilter filter = ShuffleFilter::Bits(element_size);
+        filter.apply({ input.data(), input.data() + input.size() }, { shuffled.data(), shuffled.data() + shuffled.size() });
+        filter.undo({ shuffled.data(), shuffled.data() + shuffled.size() }, { roundtrip.data(), roundtrip.data() + roundtrip.size() });
+        ASSERT_EQ(input, roundtrip);
+    }
+}
+TEST(shuffle, bit_shuffle_layout)
+{
+    // eight one byte elements. bit row r should have bit r of every element
+    std::vector<unsigned char> input = { 1, 0, 1, 0, 1, 0, 1, 0 };
+    std::vector<unsigned char> output(input.size());
+    bit_shuffle({ input.data(), input.data() + input.size() }, { output.data(), output.data() + output.size() }, 1);
+    std::vector<unsigned char> expected = { 0x55, 0, 0, 0, 0, 0, 0, 0 };
+    ASSERT_EQ(expected, output);
+    // the filter has to do the same instead of skipping single bytes
+    ASSERT_TRUE(ShuffleFilter::Bits(1).is_active());
+    ASSERT_FALSE(ShuffleFilter::Bytes(1).is_active());
+    std::fill(output.begin(), output.end(), 0);
+    ShuffleFilter::Bits(1).apply({ input.data(), input.data() + input.size() }, { output.data(), output.data() + output.size() });
+    ASSERT_EQ(expected, output);
+}
+
+#endif
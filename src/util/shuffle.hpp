@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include "util/view.hpp"
+
+// a pre-filter for compressing arrays of numbers, the same idea as in blosc.
+// in an array of floats the sign and exponent bytes are very similar from one
+// element to the next, but the mantissa bytes are noisy. and since they are
+// interleaved lz4 doesn't find many matches. the byte shuffle writes the first
+// byte of every element, then the second byte of every element etc. the bit
+// shuffle goes one step further and does the same for every bit. that's slower
+// but works better when neighboring values are close to each other.
+//
+// element_size is the size of one array element. for reflected types use
+// MetaType::GetSize() of the element type. if the input is not a multiple of
+// element_size, the remaining bytes are left as they are at the end
+struct ShuffleFilter
+{
+    enum Mode
+    {
+        NoShuffle,
+        ByteShuffle,
+        BitShuffle
+    };
+
+    static ShuffleFilter None()
+    {
+        return { NoShuffle, 1 };
+    }
+    static ShuffleFilter Bytes(size_t element_size)
+    {
+        return { ByteShuffle, element_size };
+    }
+    static ShuffleFilter Bits(size_t element_size)
+    {
+        return { BitShuffle, element_size };
+    }
+
+    // output has to be the same size as the input and may not overlap with it
+    void apply(ArrayView<const unsigned char> input, ArrayView<unsigned char> output) const;
+    void undo(ArrayView<const unsigned char> input, ArrayView<unsigned char> output) const;
+
+    // the byte shuffle doesn't change arrays of single bytes, but the bit
+    // shuffle still splits them into bit planes
+    bool is_active() const
+    {
+        if (mode == BitShuffle)
+            return element_size > 0;
+        return mode == ByteShuffle && element_size > 1;
+    }
+
+    Mode mode;
+    size_t element_size;
+};
+
+void byte_shuffle(ArrayView<const unsigned char> input, ArrayView<unsigned char> output, size_t element_size);
+void byte_unshuffle(ArrayView<const unsigned char> input, ArrayView<unsigned char> output, size_t element_size);
+// these byte shuffle first and then transpose the bits of every byte plane.
+// they need a temporary buffer of the same size as the input
+void bit_shuffle(ArrayView<const unsigned char> input, ArrayView<unsigned char> output, size_t element_size);
+void bit_unshuffle(ArrayView<const unsigned char> input, ArrayView<unsigned char> output, size_t element_size);
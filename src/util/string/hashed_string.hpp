@@ -1,9 +1,31 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <memory>
 #include <functional>
 
+// fnv-1a. std::hash doesn't promise to give the same result in a different
+// build or even a different process, so use this for hashes that get stored
+// in files. use it as HashedString<uint64_t, StableStringHash>
+struct StableStringHash
+{
+    static uint64_t hash(const char * begin, const char * end) noexcept
+    {
+        uint64_t result = 14695981039346656037ull;
+        for (; begin != end; ++begin)
+        {
+            result ^= static_cast<unsigned char>(*begin);
+            result *= 1099511628211ull;
+        }
+        return result;
+    }
+    uint64_t operator()(const std::string & str) const noexcept
+    {
+        return hash(str.data(), str.data() + str.size());
+    }
+};
+
 template<typename HashType = size_t, typename HashFunction = std::hash<std::string>>
 struct HashedString
 {